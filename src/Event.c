@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "Event.h"
+#include "Utils.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static uint32_t gEventTriggers;
+
+static int gControlSocket = -1;
+static int gControlRunning;
+static pthread_t gControlThread;
+static EventQueryFunc gControlQuery;
+
+void eventTrigger(void)
+{
+    __atomic_add_fetch(&gEventTriggers, 1, __ATOMIC_RELEASE);
+}
+
+static void eventSegmentFrame(void *arg, const MediaFrame *frame)
+{
+    segmenterWrite((SegmenterContext *)arg, frame);
+}
+
+void eventWrite(EventContext *ev, const MediaFrame *frame)
+{
+    uint32_t triggers = __atomic_load_n(&gEventTriggers, __ATOMIC_ACQUIRE);
+
+    if (triggers != ev->handled) {
+        ev->handled = triggers;
+        ev->endPts = frame->pts + (uint64_t)ev->postRoll * 1000000;
+        if (!ev->recording) {
+            ev->recording = 1;
+            ev->events++;
+            preRollPush(&ev->pre, frame);
+            LOGD("event %u: recording, %d s pre-roll\n", ev->events, preRollDuration(&ev->pre));
+            preRollFlush(&ev->pre, eventSegmentFrame, ev->seg);
+            return;
+        }
+    }
+
+    if (!ev->recording) {
+        preRollPush(&ev->pre, frame);
+        return;
+    }
+
+    segmenterWrite(ev->seg, frame);
+    if (frame->pts >= ev->endPts) {
+        LOGD("event %u: done\n", ev->events);
+        segmenterClose(ev->seg);
+        ev->recording = 0;  // the ring starts again at the next IDR
+    }
+}
+
+int eventStart(EventContext *ev)
+{
+    if (NULL == ev || NULL == ev->seg || ev->preRoll <= 0 || ev->postRoll < 0 || ev->memory == 0 || ev->frameRate <= 0) {
+        LOGE("eventStart param error.\n");
+        return -1;
+    }
+
+    ev->pre.size = ev->memory;
+    ev->pre.duration = (uint32_t)ev->preRoll;
+    ev->pre.frameRate = (uint32_t)ev->frameRate;
+    if (preRollInit(&ev->pre)) {
+        return -1;
+    }
+    ev->handled = __atomic_load_n(&gEventTriggers, __ATOMIC_ACQUIRE);
+    ev->recording = 0;
+    ev->events = 0;
+
+    LOGD("event recording: %d s pre-roll in %u KB, %d s post-roll\n", ev->preRoll, ev->memory / 1024, ev->postRoll);
+    return 0;
+}
+
+void eventStop(EventContext *ev)
+{
+    if (NULL == ev || NULL == ev->pre.data)
+        return;
+
+    if (ev->recording) {
+        segmenterClose(ev->seg);
+        ev->recording = 0;
+    }
+    eventDumpStats(ev);
+    preRollDestroy(&ev->pre);
+}
+
+void eventDumpStats(EventContext *ev)
+{
+    LOGI("events %u%s, pre-roll %d s, %u frames evicted for memory, %u for GOPs over %d s\n", ev->events,
+         ev->recording ? " (recording)" : "", preRollDuration(&ev->pre), ev->pre.evicted, ev->pre.overflow, PREROLL_GOP_MAX);
+}
+
+static void *eventControlThread(void *arg)
+{
+    char buf[64];
+    char reply[EVENT_REPLY_MAX];
+    struct sockaddr_in from;
+    socklen_t fromLen;
+    struct timeval tv;
+    fd_set fds;
+    int res, n;
+
+    (void)arg;
+    prctl(PR_SET_NAME, "EventControl", 0, 0, 0);
+
+    while (gControlRunning) {
+        FD_ZERO(&fds);
+        FD_SET(gControlSocket, &fds);
+        tv.tv_sec = 1;  // check running once a second
+        tv.tv_usec = 0;
+        res = select(gControlSocket + 1, &fds, NULL, NULL, &tv);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("event control select %s\n", strerror(errno));
+            break;
+        }
+
+        if (res > 0 && FD_ISSET(gControlSocket, &fds)) {
+            fromLen = sizeof(from);
+            n = (int)recvfrom(gControlSocket, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&from, &fromLen);
+            if (n > 0 && !strncmp(buf, "trigger", 7)) {
+                eventTrigger();
+            } else if (n > 0 && gControlQuery && !strncmp(buf, "latency", 7)) {
+                n = gControlQuery(reply, sizeof(reply));
+                sendto(gControlSocket, reply, n, 0, (struct sockaddr *)&from, fromLen);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int eventControlStart(int port, EventQueryFunc query)
+{
+    struct sockaddr_in addr;
+
+    gControlSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (gControlSocket < 0) {
+        LOGE("event control socket error.\n");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(gControlSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOGE("event control bind port %d error. %s\n", port, strerror(errno));
+        close(gControlSocket);
+        gControlSocket = -1;
+        return -1;
+    }
+
+    gControlQuery = query;
+    gControlRunning = 1;
+    if (pthread_create(&gControlThread, NULL, eventControlThread, NULL)) {
+        LOGE("event control pthread_create error.\n");
+        gControlRunning = 0;
+        close(gControlSocket);
+        gControlSocket = -1;
+        return -1;
+    }
+
+    if (query) {
+        LOGD("latency stats: echo latency | nc -u -w1 127.0.0.1 %d\n", port);
+    } else {
+        LOGD("event trigger: echo trigger | nc -u 127.0.0.1 %d, or kill -USR1\n", port);
+    }
+    return 0;
+}
+
+void eventControlStop(void)
+{
+    if (!gControlRunning)
+        return;
+
+    gControlRunning = 0;
+    pthread_join(gControlThread, NULL);
+    close(gControlSocket);
+    gControlSocket = -1;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_EVENT_H
+#define HISILIVE_EVENT_H
+
+#include "Media.h"
+#include "PreRoll.h"
+#include "Segmenter.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define EVENT_CONTROL_PORT 5555  // UDP, loopback only
+#define EVENT_POST_ROLL 10       // s, default
+#define EVENT_REPLY_MAX 4096     // bytes of a reply to a query
+
+/*
+ * Event triggered recording: frames only go to a pre-roll ring in memory. A trigger writes the ring to the
+ * segmenter and records live until postRoll seconds after the last trigger, then back to the ring.
+ */
+typedef struct {
+    int preRoll;        // s
+    int postRoll;       // s after the last trigger
+    uint32_t memory;    // bytes of the pre-roll ring
+    int frameRate;      // fps, sizes the frame ring of the pre-roll
+    SegmenterContext *seg;
+
+    PreRoll pre;
+    uint32_t handled;  // triggers seen
+    int recording;
+    uint64_t endPts;  // μs
+    uint32_t events;
+} EventContext;
+
+/* any thread, also async-signal-safe: start or extend an event in every EventContext */
+void eventTrigger(void);
+
+int eventStart(EventContext *ev);
+
+/* finish a running event recording */
+void eventStop(EventContext *ev);
+
+/* recorder thread: buffer or record a frame */
+void eventWrite(EventContext *ev, const MediaFrame *frame);
+
+void eventDumpStats(EventContext *ev);
+
+/* writes the reply to a query into buf, return its length */
+typedef int (*EventQueryFunc)(char *buf, int size);
+
+/* a thread triggering on "trigger" datagrams to 127.0.0.1:port, and answering "latency" with query if set */
+int eventControlStart(int port, EventQueryFunc query);
+
+void eventControlStop(void);
+
+#endif  // HISILIVE_EVENT_H
@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "FEC.h"
+#include "RTP.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#define FEC_HEADER_LEN 10
+#define FEC_LEVEL_HEADER_LEN 8  // protection length + 48 bit mask (L=1)
+
+typedef void (*FECXorFunc)(uint8_t *dst, const uint8_t *src, int len);
+
+static void fec_xor_c(uint8_t *dst, const uint8_t *src, int len)
+{
+    int i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, dst + i, 8);
+        memcpy(&b, src + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < len; i++) {
+        dst[i] ^= src[i];
+    }
+}
+
+#if defined(__SSE2__)
+static void fec_xor_sse2(uint8_t *dst, const uint8_t *src, int len)
+{
+    int i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m128i a0 = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(dst + i + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(src + i + 16));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(a0, b0));
+        _mm_storeu_si128((__m128i *)(dst + i + 16), _mm_xor_si128(a1, b1));
+    }
+
+    fec_xor_c(dst + i, src + i, len - i);
+}
+
+__attribute__((target("avx2"))) static void fec_xor_avx2(uint8_t *dst, const uint8_t *src, int len)
+{
+    int i = 0;
+
+    for (; i + 64 <= len; i += 64) {
+        __m256i a0 = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i a1 = _mm256_loadu_si256((const __m256i *)(dst + i + 32));
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(a0, b0));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), _mm256_xor_si256(a1, b1));
+    }
+    for (; i + 16 <= len; i += 16) {  // stay in VEX code, legacy SSE here costs a state transition
+        __m128i a = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(a, b));
+    }
+    for (; i < len; i++) {
+        dst[i] ^= src[i];
+    }
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+static void fec_xor_neon(uint8_t *dst, const uint8_t *src, int len)
+{
+    int i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        uint8x16_t a0 = vld1q_u8(dst + i);
+        uint8x16_t a1 = vld1q_u8(dst + i + 16);
+        uint8x16_t b0 = vld1q_u8(src + i);
+        uint8x16_t b1 = vld1q_u8(src + i + 16);
+        vst1q_u8(dst + i, veorq_u8(a0, b0));
+        vst1q_u8(dst + i + 16, veorq_u8(a1, b1));
+    }
+
+    fec_xor_c(dst + i, src + i, len - i);
+}
+#endif
+
+static void fec_xor_init(uint8_t *dst, const uint8_t *src, int len);
+
+static FECXorFunc fec_xor = fec_xor_init;
+
+// on first use, by the SIMD level getCPUSimd probed for all kernels
+static void fec_xor_init(uint8_t *dst, const uint8_t *src, int len)
+{
+    FECXorFunc func = fec_xor_c;
+    const char *name;
+    int simd = getCPUSimd(&name);
+
+#if defined(__SSE2__)
+    func = simd == CPU_SIMD_AVX2 ? fec_xor_avx2 : fec_xor_sse2;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    if (simd == CPU_SIMD_NEON)
+        func = fec_xor_neon;
+#endif
+    (void)simd;
+
+    LOGD("FEC XOR: %s\n", name);
+    fec_xor = func;
+    func(dst, src, len);
+}
+
+void fecXor(uint8_t *dst, const uint8_t *src, int len)
+{
+    fec_xor(dst, src, len);
+}
+
+int fecInit(FECContext *ctx)
+{
+    if (NULL == ctx || ctx->groupSize <= 0 || ctx->groupSize > FEC_GROUP_MAX || ctx->groupSizeKey < 0 ||
+        ctx->groupSizeKey > FEC_GROUP_MAX) {
+        LOGE("fecInit param error.\n");
+        return -1;
+    }
+
+    if (ctx->payloadType <= 0)
+        ctx->payloadType = FEC_PAYLOAD_TYPE;
+    if (ctx->groupSizeKey == 0)
+        ctx->groupSizeKey = ctx->groupSize;
+    ctx->count = 0;
+    ctx->sent = 0;
+
+    return 0;
+}
+
+/*
+ * ULPFEC packet, RFC 5109 7, one protection level
+ *
+ *  0                   1                   2                   3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                         RTP Header                            |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |E|L|P|X|  CC   |M| PT recovery |            SN base            |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                          TS recovery                          |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |        length recovery        |       Protection Length       |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |             mask              |      mask cont. (L = 1)       |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                 XOR of the protected payloads                 |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * bit i of the mask (from the most significant) protects SN base + i, the sequence number and SSRC of the
+ * RTP header are set by the sender
+ */
+static void fecBuildPacket(FECContext *ctx, uint8_t *out, UDPPacket *pkt)
+{
+    uint64_t mask = ctx->mask;
+    uint8_t *p = out;
+
+    p = Load8(p, 0x80);  // V=2
+    p = Load8(p, (uint8_t)(ctx->payloadType & 0x7f));
+    p = Load16(p, 0);
+    memcpy(p, ctx->timestamp, 4);  // of the media packet sent before
+    p += 4;
+    p = Load32(p, 0);
+
+    p = Load8(p, (uint8_t)(0x40 | (ctx->header[0] & 0x3f)));  // E=0, L=1, P X CC recovery
+    p = Load8(p, ctx->header[1]);                            // M PT recovery
+    p = Load16(p, ctx->snBase);
+    memcpy(p, &ctx->header[4], 4);  // TS recovery
+    p += 4;
+    p = Load16(p, ctx->length);
+    p = Load16(p, (uint16_t)ctx->protLen);
+    p = Load16(p, (uint16_t)(mask >> 32));
+    p = Load32(p, (uint32_t)mask);
+    memcpy(p, ctx->payload, ctx->protLen);
+    p += ctx->protLen;
+
+    pkt->iov[0].iov_base = out;
+    pkt->iov[0].iov_len = (size_t)(p - out);
+    pkt->iov[1].iov_base = NULL;
+    pkt->iov[1].iov_len = 0;
+}
+
+int fecProtect(FECContext *ctx, const UDPPacket *packet, int count, int keyFrame)
+{
+    int i, j, out = 0;
+
+    for (i = 0; i < count; i++) {
+        const uint8_t *header = (const uint8_t *)packet[i].iov[0].iov_base;
+        int headerLen = (int)packet[i].iov[0].iov_len - RTP_HEADER_SIZE;  // FU indicator/header
+        int len = headerLen + (int)packet[i].iov[1].iov_len;
+        uint16_t seq = (uint16_t)((header[2] << 8) | header[3]);
+
+        if (len > FEC_PACKET_MAX - RTP_HEADER_SIZE - FEC_HEADER_LEN - FEC_LEVEL_HEADER_LEN) {
+            ctx->count = 0;  // cannot be protected, the mask could not skip it
+            continue;
+        }
+
+        if (ctx->count > 0 && (uint16_t)(seq - ctx->snBase) >= FEC_GROUP_MAX) {
+            fecBuildPacket(ctx, ctx->out[out], &ctx->packet[out]);  // out of the mask, close the group early
+            out++;
+            ctx->count = 0;
+        }
+
+        if (ctx->count == 0) {
+            memset(ctx->payload, 0, sizeof(ctx->payload));
+            memset(ctx->header, 0, sizeof(ctx->header));
+            ctx->length = 0;
+            ctx->protLen = 0;
+            ctx->snBase = seq;
+            ctx->mask = 0;
+            ctx->size = keyFrame ? ctx->groupSizeKey : ctx->groupSize;
+        }
+
+        for (j = 0; j < 8; j++) {
+            ctx->header[j] ^= header[j];
+        }
+        ctx->length ^= (uint16_t)len;
+        fecXor(ctx->payload, header + RTP_HEADER_SIZE, headerLen);
+        fecXor(ctx->payload + headerLen, (const uint8_t *)packet[i].iov[1].iov_base, (int)packet[i].iov[1].iov_len);
+        if (len > ctx->protLen)
+            ctx->protLen = len;
+        memcpy(ctx->timestamp, &header[4], 4);
+        ctx->mask |= 1ULL << (47 - (uint16_t)(seq - ctx->snBase));
+        ctx->count++;
+
+        // close the group when full or at the end of the frame (marker bit), a single packet goes on into the next
+        // frame: its FEC packet would only be a copy of it
+        if (ctx->count >= ctx->size || ((header[1] & 0x80) && ctx->count > 1)) {
+            fecBuildPacket(ctx, ctx->out[out], &ctx->packet[out]);
+            out++;
+            ctx->count = 0;
+        }
+    }
+
+    ctx->sent += out;
+    return out;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_FEC_H
+#define HISILIVE_FEC_H
+
+#include "Network.h"
+#include <stdint.h>
+
+#define FEC_PAYLOAD_TYPE 127  // ulpfec/90000
+#define FEC_GROUP_MAX 48      // media packets protected by one FEC packet, the 48 bit mask
+#define FEC_PACKET_MAX 1500
+
+typedef struct {
+    int payloadType;   // FEC_PAYLOAD_TYPE if 0
+    int groupSize;     // media packets per FEC packet in other frames, (0, FEC_GROUP_MAX]
+    int groupSizeKey;  // media packets per FEC packet in key frames, usually smaller
+
+    // the group being protected, XOR of everything seen so far
+    uint8_t payload[FEC_PACKET_MAX];
+    uint8_t header[8];     // first 8 bytes of the RTP headers
+    uint8_t timestamp[4];  // of the last protected packet
+    uint16_t length;       // payload lengths
+    uint16_t snBase;
+    uint64_t mask;  // protected sequence numbers from snBase, FEC packets of earlier groups may be in between
+    int count;
+    int size;  // the group is closed after size packets, or at the end of the frame
+    int protLen;
+
+    // FEC packets of the groups closed by the last fecProtect, the sender sets their SSRC and sequence numbers:
+    // FEC is a payload type of the media stream (one SSRC and sequence number space), RFC 5109 14.1
+    uint8_t out[UDP_BATCH_MAX][FEC_PACKET_MAX];
+    UDPPacket packet[UDP_BATCH_MAX];
+    uint32_t sent;
+} FECContext;
+
+int fecInit(FECContext *ctx);
+
+/* protect count sent RTP packets, return the number of FEC packets ready in ctx->packet */
+int fecProtect(FECContext *ctx, const UDPPacket *packet, int count, int keyFrame);
+
+/* dst ^= src, vectorized */
+void fecXor(uint8_t *dst, const uint8_t *src, int len);
+
+#endif  // HISILIVE_FEC_H
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "FileSource.h"
+#include "Utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* the NAL header after the start code at p */
+static const uint8_t *fileSourceNALHeader(const uint8_t *p, const uint8_t *end)
+{
+    while (p < end && !*p)
+        p++;
+    return p + 1;  // skip 01
+}
+
+/*
+ * A NAL starts a new access unit once the current one has a slice: a parameter set, SEI, AUD or another
+ * non-VCL NAL that precedes slices, or the first slice of a picture (first_mb_in_slice 0 /
+ * first_slice_segment_in_pic_flag 1).
+ */
+static int fileSourceStartsFrame(int codec, const uint8_t *h, const uint8_t *end, int *vcl)
+{
+    int type;
+
+    if (codec == 0) {
+        type = h[0] & 0x1f;
+        *vcl = type >= H264_NAL_SLICE && type <= H264_NAL_IDR;
+        if (*vcl)
+            return h + 1 < end && (h[1] & 0x80);
+        return (type >= H264_NAL_SEI && type <= 9) || (type >= 14 && type <= 18);
+    }
+
+    type = (h[0] >> 1) & 0x3f;
+    *vcl = type < 32;
+    if (*vcl)
+        return h + 2 < end && (h[2] & 0x80);
+    return (type >= HEVC_NAL_VPS && type <= 35) || type == HEVC_NAL_SEI_PREFIX || (type >= 41 && type <= 44) ||
+           (type >= 48 && type <= 55);
+}
+
+static int fileSourceRead(MediaSource *src, MediaFrame *frame)
+{
+    FileSource *fs = (FileSource *)src;
+    const uint8_t *end = fs->data + fs->size;
+    const uint8_t *p, *h, *next;
+    int n = 0, slices = 0, vcl, starts, type;
+
+    frame->keyFrame = 0;
+    frame->reference = 0;
+    frame->readTime = 0;
+
+    p = ff_avc_find_startcode(fs->data + fs->pos, end);
+    if (p >= end) {
+        if (++fs->played == fs->loop) {
+            return 1;
+        }
+        p = ff_avc_find_startcode(fs->data, end);  // play again, pts go on
+    }
+
+    while (p < end) {
+        h = fileSourceNALHeader(p, end);
+        if (h >= end) {
+            p = end;
+            break;
+        }
+        next = ff_avc_find_startcode(h, end);
+        starts = fileSourceStartsFrame(src->codec, h, next, &vcl);
+        if (slices > 0 && starts) {
+            break;
+        }
+
+        if (n < FILE_SOURCE_PACK_MAX) {
+            fs->packs[n].data = p;
+            fs->packs[n].len = (uint32_t)(next - p);
+            fs->packs[n].nalType = src->codec == 0 ? (h[0] & 0x1f) : ((h[0] >> 1) & 0x3f);
+            fs->packs[n].nalCount = 1;
+            n++;
+        } else {  // the last pack takes the rest of the frame
+            fs->packs[n - 1].len = (uint32_t)(next - fs->packs[n - 1].data);
+            fs->packs[n - 1].nalType = -1;
+            fs->packs[n - 1].nalCount = 0;
+        }
+
+        if (vcl) {
+            slices++;
+            if (src->codec == 0) {
+                type = h[0] & 0x1f;
+                frame->keyFrame |= type == H264_NAL_IDR;
+                frame->reference |= (h[0] & 0x60) != 0;  // nal_ref_idc
+            } else {
+                type = (h[0] >> 1) & 0x3f;
+                frame->keyFrame |= type >= 16 && type <= 21;  // IRAP
+                frame->reference |= type > 14 || (type & 1);  // not a sub-layer non-reference picture
+            }
+        }
+        p = next;
+    }
+    fs->pos = (size_t)(p - fs->data);
+
+    if (n == 0) {
+        return -1;
+    }
+
+    frame->packs = fs->packs;
+    frame->packCount = n;
+    frame->pts = fs->frames * 1000000 / (uint64_t)src->frameRate;
+    frame->reference |= frame->keyFrame;
+    fs->frames++;
+    return 0;
+}
+
+static void fileSourceClose(MediaSource *src)
+{
+    FileSource *fs = (FileSource *)src;
+
+    if (fs->data) {
+        munmap(fs->data, fs->size);
+        fs->data = NULL;
+    }
+}
+
+/* from the extension, else from the first NAL: an H.265 VPS/SPS/PPS/AUD or an H.264 slice/SEI/SPS/AUD */
+static int fileSourceDetectCodec(FileSource *fs, const char *path)
+{
+    const char *ext = strrchr(path, '.');
+    const uint8_t *end = fs->data + fs->size;
+    const uint8_t *h;
+    int type;
+
+    if (ext && (!strcasecmp(ext, ".h265") || !strcasecmp(ext, ".265") || !strcasecmp(ext, ".hevc"))) {
+        return 1;
+    } else if (ext && (!strcasecmp(ext, ".h264") || !strcasecmp(ext, ".264") || !strcasecmp(ext, ".avc"))) {
+        return 0;
+    }
+
+    h = fileSourceNALHeader(ff_avc_find_startcode(fs->data, end), end);
+    if (h + 1 >= end || (h[0] & 0x80)) {
+        return -1;
+    }
+    type = (h[0] >> 1) & 0x3f;
+    if (type >= HEVC_NAL_VPS && type <= 35 && h[1] == 0x01) {
+        return 1;
+    }
+    type = h[0] & 0x1f;
+    if (type == H264_NAL_SLICE || type == H264_NAL_IDR || type == H264_NAL_SEI || type == H264_NAL_SPS || type == 9) {
+        return 0;
+    }
+    return -1;
+}
+
+int fileSourceOpen(FileSource *fs, const char *path)
+{
+    struct stat st;
+    int fd;
+
+    if (NULL == fs || NULL == path || fs->loop < 0) {
+        LOGE("fileSourceOpen param error.\n");
+        return -1;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        LOGE("fileSourceOpen %s error. %s\n", path, fd < 0 ? strerror(errno) : "empty file");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    // the whole stream is read in order once per play
+    fs->size = (size_t)st.st_size;
+    fs->data = (uint8_t *)mmap(NULL, fs->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == fs->data) {
+        LOGE("fileSourceOpen mmap %s error. %s\n", path, strerror(errno));
+        fs->data = NULL;
+        return -1;
+    }
+    madvise(fs->data, fs->size, MADV_SEQUENTIAL);
+
+    if (fs->src.codec < 0) {
+        fs->src.codec = fileSourceDetectCodec(fs, path);
+        if (fs->src.codec < 0) {
+            LOGE("fileSourceOpen %s: not an H.264/H.265 elementary stream.\n", path);
+            fileSourceClose(&fs->src);
+            return -1;
+        }
+    }
+    if (fs->src.frameRate <= 0) {
+        fs->src.frameRate = FILE_SOURCE_FRAME_RATE;
+    }
+    fs->src.name = path;
+    fs->src.read = fileSourceRead;
+    fs->src.close = fileSourceClose;
+    fs->pos = 0;
+    fs->played = 0;
+    fs->frames = 0;
+
+    LOGD("file source %s: %s, %zu KB, %d fps\n", path, fs->src.codec ? "H.265" : "H.264", fs->size / 1024, fs->src.frameRate);
+    return 0;
+}
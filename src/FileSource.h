@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_FILESOURCE_H
+#define HISILIVE_FILESOURCE_H
+
+#include "Source.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define FILE_SOURCE_PACK_MAX 64  // NALs of a frame kept as single packs, the rest goes into the last pack
+#define FILE_SOURCE_FRAME_RATE 30
+
+/*
+ * A recorded H.264/H.265 elementary stream (Annex-B, e.g. stream_chn0.h264 of file mode) mapped into memory
+ * and split into access units, one pack per NAL. The file has no timing, pts advance by 1/frameRate.
+ */
+typedef struct {
+    MediaSource src;  // first member, codec -1: from the file name or the first NAL
+    int loop;         // times the stream is played, 0: forever
+
+    uint8_t *data;
+    size_t size;
+    size_t pos;
+    int played;
+    uint64_t frames;  // frames read, for the pts
+    MediaPack packs[FILE_SOURCE_PACK_MAX];
+} FileSource;
+
+/* set src.codec, src.frameRate (FILE_SOURCE_FRAME_RATE if 0) and loop before */
+int fileSourceOpen(FileSource *fs, const char *path);
+
+#endif  // HISILIVE_FILESOURCE_H
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "FrameQueue.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t roundUpPow2(uint32_t x)
+{
+    uint32_t n = 1;
+    while (n < x)
+        n <<= 1;
+    return n;
+}
+
+int frameQueueInit(FrameQueue *q, uint32_t size, int slots)
+{
+    if (NULL == q || size == 0 || slots <= 0 || slots > FRAME_QUEUE_SLOT_MAX) {
+        LOGE("frameQueueInit param error.\n");
+        return -1;
+    }
+
+    q->size = roundUpPow2(size);
+    q->slotCount = roundUpPow2((uint32_t)slots);
+    q->data = (uint8_t *)malloc(q->size);
+    if (NULL == q->data) {
+        LOGE("frameQueueInit malloc %u error.\n", q->size);
+        return -1;
+    }
+
+    q->tail = q->head = 0;
+    q->writePos = q->readPos = 0;
+    q->waitKeyFrame = 0;
+    q->pushed = q->popped = 0;
+    q->droppedFull = q->droppedWaitKey = q->droppedNonRef = 0;
+    q->maxOccupancy = 0;
+
+    return 0;
+}
+
+void frameQueueDestroy(FrameQueue *q)
+{
+    if (q && q->data) {
+        free(q->data);
+        q->data = NULL;
+    }
+}
+
+int frameQueueOccupancy(FrameQueue *q)
+{
+    uint32_t tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    uint32_t writePos = __atomic_load_n(&q->writePos, __ATOMIC_ACQUIRE);
+    uint32_t readPos = __atomic_load_n(&q->readPos, __ATOMIC_ACQUIRE);
+    uint32_t slots = (tail - head) * 100 / q->slotCount;
+    uint32_t bytes = (uint32_t)((uint64_t)(writePos - readPos) * 100 / q->size);
+
+    return (int)(slots > bytes ? slots : bytes);
+}
+
+int frameQueuePush(FrameQueue *q, const MediaFrame *frame)
+{
+    uint32_t head, readPos, pos, pad, total = 0;
+    uint32_t occupancy;
+    FrameSlot *slot;
+    uint8_t *dst;
+    int i, n;
+
+    if (q->waitKeyFrame && !frame->keyFrame) {  // its reference is gone
+        q->droppedWaitKey++;
+        return -1;
+    }
+
+    for (i = 0; i < frame->packCount; i++) {
+        total += frame->packs[i].len;
+    }
+
+    // the consumer only moves head/readPos forward, stale values underestimate the free space
+    head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+    readPos = __atomic_load_n(&q->readPos, __ATOMIC_ACQUIRE);
+    pos = q->writePos & (q->size - 1);
+    pad = pos + total > q->size ? q->size - pos : 0;  // a frame is contiguous, skip the end of the ring
+    if (q->tail - head >= q->slotCount || q->writePos + pad + total - readPos > q->size) {
+        q->droppedFull++;
+        q->waitKeyFrame = frame->reference || frame->keyFrame;
+        return -1;
+    }
+    q->waitKeyFrame = 0;
+
+    slot = &q->slot[q->tail & (q->slotCount - 1)];
+    slot->frame = *frame;
+    slot->frame.packs = slot->packs;
+    dst = q->data + ((q->writePos + pad) & (q->size - 1));
+    for (i = 0, n = 0; i < frame->packCount; i++) {
+        memcpy(dst, frame->packs[i].data, frame->packs[i].len);
+        if (n < FRAME_PACK_MAX) {
+            slot->packs[n] = frame->packs[i];
+            slot->packs[n].data = dst;
+            n++;
+        } else {  // contiguous with the last pack, which now holds several NALs
+            slot->packs[n - 1].len += frame->packs[i].len;
+            slot->packs[n - 1].nalCount = 0;
+        }
+        dst += frame->packs[i].len;
+    }
+    slot->frame.packCount = n;
+    slot->end = q->writePos + pad + total;
+
+    // publish the frame after its data
+    __atomic_store_n(&q->writePos, slot->end, __ATOMIC_RELEASE);
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+    q->pushed++;
+
+    occupancy = (uint32_t)frameQueueOccupancy(q);
+    if (occupancy > q->maxOccupancy)
+        q->maxOccupancy = occupancy;
+
+    return 0;
+}
+
+static void frameQueueRelease(FrameQueue *q)
+{
+    FrameSlot *slot = &q->slot[q->head & (q->slotCount - 1)];
+
+    __atomic_store_n(&q->readPos, slot->end, __ATOMIC_RELEASE);
+    __atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+}
+
+const MediaFrame *frameQueueFront(FrameQueue *q)
+{
+    FrameSlot *slot;
+
+    while (q->head != __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) {
+        slot = &q->slot[q->head & (q->slotCount - 1)];
+        if (q->dropWatermark > 0 && !slot->frame.reference && !slot->frame.keyFrame &&
+            frameQueueOccupancy(q) > q->dropWatermark) {  // behind, nothing depends on this frame
+            q->droppedNonRef++;
+            frameQueueRelease(q);
+            continue;
+        }
+        return &slot->frame;
+    }
+
+    return NULL;
+}
+
+void frameQueuePop(FrameQueue *q)
+{
+    frameQueueRelease(q);
+    q->popped++;
+}
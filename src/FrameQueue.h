@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_FRAME_QUEUE_H
+#define HISILIVE_FRAME_QUEUE_H
+
+#include "Media.h"
+#include <stdint.h>
+
+#define FRAME_QUEUE_SLOT_MAX 64
+#define FRAME_PACK_MAX 16  // packs after this are merged into the last one, which is then scanned
+
+typedef struct {
+    MediaFrame frame;
+    MediaPack packs[FRAME_PACK_MAX];  // data points into the queue's byte ring
+    uint32_t end;                     // byte ring position after this frame
+} FrameSlot;
+
+/*
+ * Single producer / single consumer frame queue, lock free.
+ *
+ * Frames are copied into a byte ring, so the encoder buffer can be released as soon as frameQueuePush returns.
+ * Positions are free running uint32_t counters, the ring and slot counts are powers of two.
+ *
+ * Drop policy: a frame that does not fit is dropped by the producer; if it was a reference frame, the following
+ * frames are dropped until the next key frame. Above dropWatermark the consumer skips non-reference frames first.
+ */
+typedef struct {
+    uint8_t *data;  // byte ring
+    uint32_t size;  // bytes, power of two
+    uint32_t slotCount;
+    FrameSlot slot[FRAME_QUEUE_SLOT_MAX];
+    int dropWatermark;  // %, 0: the consumer never drops
+
+    // written by the producer
+    uint32_t tail;
+    uint32_t writePos;
+    int waitKeyFrame;
+    uint32_t pushed;
+    uint32_t droppedFull;
+    uint32_t droppedWaitKey;
+    uint32_t maxOccupancy;  // %
+
+    // written by the consumer
+    uint32_t head;
+    uint32_t readPos;
+    uint32_t popped;
+    uint32_t droppedNonRef;
+} FrameQueue;
+
+/* size: bytes of the ring, rounded up to a power of two; slots: (0, FRAME_QUEUE_SLOT_MAX], rounded up too */
+int frameQueueInit(FrameQueue *q, uint32_t size, int slots);
+
+void frameQueueDestroy(FrameQueue *q);
+
+/* producer: copy the frame into the queue, return 0 or -1 if it was dropped */
+int frameQueuePush(FrameQueue *q, const MediaFrame *frame);
+
+/* consumer: the oldest frame, NULL if the queue is empty; valid until frameQueuePop */
+const MediaFrame *frameQueueFront(FrameQueue *q);
+
+/* consumer: release the frame returned by frameQueueFront */
+void frameQueuePop(FrameQueue *q);
+
+/* occupancy in %, the larger of slots and bytes */
+int frameQueueOccupancy(FrameQueue *q);
+
+#endif  // HISILIVE_FRAME_QUEUE_H
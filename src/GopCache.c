@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "GopCache.h"
+#include "Utils.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <time.h>
+
+/*
+ * The sender saves packets before sending them, so a receiver which has been sent every cached packet is
+ * resumed without a gap: a packet saved later is sent live to it. A packet saved just before may also be
+ * sent live once more, the receiver drops the duplicate sequence number.
+ */
+
+static void gopCacheWait(GopCache *gop, uint64_t us)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += (time_t)(us / 1000000);
+    ts.tv_nsec += (long)(us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&gop->cond, &gop->lock, &ts);
+}
+
+// called with lock held
+static void gopCacheResume(GopCache *gop, int i, uint32_t *counter, const char *reason)
+{
+    GopCacheJoin *join = &gop->join[i];
+    uint64_t time = getMonotonicTime() - join->start;
+
+    if (udpResumeDest(gop->udp, &join->dst) == 0) {
+        (*counter)++;
+        gop->joinTime += time;
+        LOGD("receiver %s live %s, %u packets burst in %llu ms\n",
+             join->dst.tcpSocket >= 0 ? "interleaved" : inet_ntoa(join->dst.addr.sin_addr), reason, join->next,
+             (unsigned long long)time / 1000);
+    }
+    gop->join[i] = gop->join[--gop->joinCount];
+}
+
+static void *gopCacheThread(void *arg)
+{
+    GopCache *gop = (GopCache *)arg;
+    uint8_t buf[GOP_CACHE_BURST][GOP_CACHE_PACKET_SIZE];
+    int len[GOP_CACHE_BURST];
+    UDPDest dst;
+    uint64_t rate = (uint64_t)gop->bitRate * 1000 / 8 * gop->rate;  // bytes/s
+    uint64_t now, nextSend = 0;
+    uint32_t bytes, generation;
+    int i, n, next = 0;
+
+    prctl(PR_SET_NAME, "GopCache", 0, 0, 0);
+
+    pthread_mutex_lock(&gop->lock);
+    while (gop->running) {
+        GopCacheJoin *join = NULL;
+
+        // round robin over the receivers with packets to send, the ones caught up go live
+        for (i = 0; i < gop->joinCount && !join;) {
+            GopCacheJoin *j = &gop->join[(next + i) % gop->joinCount];
+            if (j->wait || !gop->valid) {
+                i++;
+            } else if (j->next == gop->count) {
+                gopCacheResume(gop, (next + i) % gop->joinCount, &gop->caughtUp, "caught up");
+            } else {
+                join = j;
+                next = (next + i + 1) % gop->joinCount;
+            }
+        }
+
+        if (NULL == join) {
+            pthread_cond_wait(&gop->cond, &gop->lock);
+            continue;
+        }
+
+        now = getMonotonicTime();
+        if (now < nextSend) {  // woken by the sender before the burst is due
+            gopCacheWait(gop, nextSend - now);
+            continue;
+        }
+
+        // copy a few packets, the sender may reset the cache while they are sent
+        for (n = 0, bytes = 0; n < GOP_CACHE_BURST && join->next < gop->count; n++, join->next++) {
+            GopCachePacket *pkt = &gop->packet[join->next];
+            memcpy(buf[n], gop->data + pkt->offset, pkt->len);
+            len[n] = (int)pkt->len;
+            bytes += pkt->len;
+        }
+        dst = join->dst;
+        generation = gop->generation;
+        pthread_mutex_unlock(&gop->lock);
+
+        // a reset since the copy made the receiver live, the IDR may be on its way: the rest of the GOP is stale
+        pthread_mutex_lock(&gop->sendLock);
+        if (gop->generation != generation)
+            n = 0;
+        for (i = 0; i < n; i++) {
+            udpSendToDest(gop->udp, &dst, buf[i], len[i]);
+        }
+        pthread_mutex_unlock(&gop->sendLock);
+        nextSend = now + (uint64_t)bytes * 1000000 / rate;
+
+        pthread_mutex_lock(&gop->lock);
+        gop->burstPackets += n;
+    }
+    pthread_mutex_unlock(&gop->lock);
+
+    return NULL;
+}
+
+void gopCacheReset(GopCache *gop)
+{
+    pthread_mutex_lock(&gop->sendLock);  // a burst being sent goes out before the IDR
+    pthread_mutex_lock(&gop->lock);
+    while (gop->joinCount > 0) {  // the IDR is sent live to them
+        gopCacheResume(gop, 0, &gop->atIDR, "at IDR");
+    }
+    gop->used = 0;
+    gop->count = 0;
+    gop->gopTime = getMonotonicTime();
+    gop->valid = 1;
+    gop->generation++;
+    pthread_mutex_unlock(&gop->lock);
+    pthread_mutex_unlock(&gop->sendLock);
+}
+
+void gopCacheSave(GopCache *gop, const UDPPacket *packet, int count)
+{
+    GopCachePacket *pkt;
+    size_t len;
+    int i;
+
+    pthread_mutex_lock(&gop->lock);
+    for (i = 0; i < count && gop->valid; i++) {
+        len = packet[i].iov[0].iov_len + packet[i].iov[1].iov_len;
+        if (gop->count >= GOP_CACHE_PACKET_MAX || gop->used + len > gop->size || len > GOP_CACHE_PACKET_SIZE) {
+            LOGE("GOP over %u packets or %u KB, not cached\n", gop->count, gop->size / 1024);
+            gop->valid = 0;  // joining receivers wait for the next IDR
+            break;
+        }
+        pkt = &gop->packet[gop->count++];
+        pkt->offset = gop->used;
+        pkt->len = (uint32_t)len;
+        memcpy(gop->data + gop->used, packet[i].iov[0].iov_base, packet[i].iov[0].iov_len);
+        memcpy(gop->data + gop->used + packet[i].iov[0].iov_len, packet[i].iov[1].iov_base, packet[i].iov[1].iov_len);
+        gop->used += (uint32_t)len;
+    }
+    if (gop->joinCount > 0) {
+        pthread_cond_signal(&gop->cond);
+    }
+    pthread_mutex_unlock(&gop->lock);
+}
+
+int gopCacheJoin(GopCache *gop, const UDPDest *dst)
+{
+    GopCacheJoin *join;
+    uint64_t now = getMonotonicTime();
+    int request;
+
+    pthread_mutex_lock(&gop->lock);
+    if (gop->joinCount >= UDP_DEST_MAX || udpJoinDest(gop->udp, dst)) {
+        pthread_mutex_unlock(&gop->lock);
+        return -1;
+    }
+
+    join = &gop->join[gop->joinCount++];
+    join->dst = *dst;
+    join->next = 0;
+    join->start = now;
+    request = gop->requestKeyFrame && (!gop->valid || (gop->maxAge > 0 && now - gop->gopTime > (uint64_t)gop->maxAge * 1000));
+    join->wait = !gop->valid || request;  // a fresh IDR comes sooner than the old GOP catches up
+    gop->joins++;
+    gop->requests += request;
+    pthread_cond_signal(&gop->cond);
+    pthread_mutex_unlock(&gop->lock);
+
+    if (request) {
+        gop->requestKeyFrame(gop->arg);
+    }
+    return 0;
+}
+
+void gopCacheLeave(GopCache *gop, const UDPDest *dst)
+{
+    int i;
+
+    pthread_mutex_lock(&gop->lock);
+    for (i = 0; i < gop->joinCount; i++) {
+        GopCacheJoin *join = &gop->join[i];
+        if (dst->tcpSocket >= 0 ? join->dst.tcpSocket == dst->tcpSocket
+                                : join->dst.tcpSocket < 0 && join->dst.addr.sin_addr.s_addr == dst->addr.sin_addr.s_addr &&
+                                      join->dst.addr.sin_port == dst->addr.sin_port) {
+            gop->join[i] = gop->join[--gop->joinCount];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&gop->lock);
+}
+
+int gopCacheStart(GopCache *gop)
+{
+    pthread_condattr_t attr;
+
+    if (NULL == gop || NULL == gop->udp || gop->bitRate <= 0 || gop->rate < 2) {
+        LOGE("gopCacheStart param error.\n");
+        return -1;
+    }
+
+    if (gop->size == 0)
+        gop->size = GOP_CACHE_SIZE;
+    gop->data = (uint8_t *)malloc(gop->size);
+    if (NULL == gop->data) {
+        LOGE("gopCacheStart malloc %u error.\n", gop->size);
+        return -1;
+    }
+    gop->used = 0;
+    gop->count = 0;
+    gop->valid = 0;  // until the first IDR
+    gop->joinCount = 0;
+
+    pthread_mutex_init(&gop->lock, NULL);
+    pthread_mutex_init(&gop->sendLock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&gop->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    gop->running = 1;
+    if (pthread_create(&gop->thread, NULL, gopCacheThread, gop)) {
+        LOGE("GOP cache pthread_create error.\n");
+        gop->running = 0;
+        pthread_cond_destroy(&gop->cond);
+        pthread_mutex_destroy(&gop->sendLock);
+        pthread_mutex_destroy(&gop->lock);
+        free(gop->data);
+        gop->data = NULL;
+        return -1;
+    }
+
+    LOGD("GOP cache: %u KB, burst at %d x %d kbps\n", gop->size / 1024, gop->rate, gop->bitRate);
+    return 0;
+}
+
+void gopCacheStop(GopCache *gop)
+{
+    if (NULL == gop || !gop->running)
+        return;
+
+    pthread_mutex_lock(&gop->lock);
+    gop->running = 0;
+    pthread_cond_signal(&gop->cond);
+    pthread_mutex_unlock(&gop->lock);
+    pthread_join(gop->thread, NULL);
+
+    pthread_cond_destroy(&gop->cond);
+    pthread_mutex_destroy(&gop->sendLock);
+    pthread_mutex_destroy(&gop->lock);
+    free(gop->data);
+    gop->data = NULL;
+}
+
+void gopCacheDumpStats(GopCache *gop)
+{
+    uint32_t live;
+
+    pthread_mutex_lock(&gop->lock);
+    live = gop->caughtUp + gop->atIDR;
+    LOGI("GOP cache: %u packets %u KB, age %llu ms, joins %u, live %u (caught up %u, at IDR %u, avg %u ms), "
+         "IDR requests %u, burst packets %u\n",
+         gop->count, gop->used / 1024, (unsigned long long)(getMonotonicTime() - gop->gopTime) / 1000, gop->joins, live,
+         gop->caughtUp, gop->atIDR, live ? (uint32_t)(gop->joinTime / live / 1000) : 0, gop->requests, gop->burstPackets);
+    pthread_mutex_unlock(&gop->lock);
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_GOPCACHE_H
+#define HISILIVE_GOPCACHE_H
+
+#include "Network.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define GOP_CACHE_SIZE (2 * 1024 * 1024)  // bytes of RTP packets, default
+#define GOP_CACHE_PACKET_MAX 4096         // packets of a GOP, a longer GOP is not cached
+#define GOP_CACHE_PACKET_SIZE 1500        // RTP header + FU header + payload
+#define GOP_CACHE_BURST 4                 // packets sent back to back at most
+#define GOP_CACHE_RATE 4                  // burst bitrate, times the stream bitrate, default
+
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+} GopCachePacket;
+
+typedef struct {
+    UDPDest dst;
+    uint32_t next;  // next cached packet to send
+    int wait;       // no usable GOP, the receiver gets the stream from the next IDR
+    uint64_t start;  // monotonic μs of the join
+} GopCacheJoin;
+
+/*
+ * The RTP packets of the current GOP, from the last IDR (with its VPS/SPS/PPS) on. A new receiver is added as
+ * joining: the live stream skips it while the cache thread sends it the GOP at rate times the stream bitrate,
+ * then it gets the live stream once it has caught up, or at the next IDR. Packets keep their sequence numbers
+ * and timestamps, so the burst and the live stream are one RTP stream to the receiver.
+ */
+typedef struct {
+    UDPContext *udp;
+    int bitRate;  // kbps of the stream
+    int rate;     // times bitRate, a burst must be faster than the stream to catch up
+    uint32_t size;  // bytes, GOP_CACHE_SIZE if 0
+    int maxAge;     // ms, a receiver joining an older GOP requests an IDR instead, 0: never
+    void (*requestKeyFrame)(void *arg);  // optional, asks the encoder for an IDR now
+    void *arg;
+
+    uint8_t *data;
+    uint32_t used;
+    GopCachePacket packet[GOP_CACHE_PACKET_MAX];
+    uint32_t count;
+    uint64_t gopTime;     // monotonic μs of the IDR
+    int valid;            // the cache holds the GOP from its IDR on
+    uint32_t generation;  // GOPs started, written with both locks held
+
+    GopCacheJoin join[UDP_DEST_MAX];
+    int joinCount;
+
+    uint32_t joins;
+    uint32_t caughtUp;  // receivers live after a whole burst
+    uint32_t atIDR;     // receivers live at the next IDR
+    uint32_t requests;  // IDRs requested for joins
+    uint32_t burstPackets;
+    uint64_t joinTime;  // μs from join to live, all receivers
+
+    int running;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_mutex_t sendLock;  // held while a burst is sent, taken before lock
+    pthread_cond_t cond;
+} GopCache;
+
+/* start the burst thread */
+int gopCacheStart(GopCache *gop);
+
+void gopCacheStop(GopCache *gop);
+
+/* sender: a key frame starts, receivers still joining get the stream from here */
+void gopCacheReset(GopCache *gop);
+
+/* sender: keep a copy of the RTP packets about to be sent */
+void gopCacheSave(GopCache *gop, const UDPPacket *packet, int count);
+
+/* add dst as a joining receiver of gop->udp and burst the cached GOP to it */
+int gopCacheJoin(GopCache *gop, const UDPDest *dst);
+
+/* stop a burst to dst, it is removed from gop->udp by the caller */
+void gopCacheLeave(GopCache *gop, const UDPDest *dst);
+
+void gopCacheDumpStats(GopCache *gop);
+
+#endif  // HISILIVE_GOPCACHE_H
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "Histogram.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Values below HISTOGRAM_SUB_COUNT have a bucket each. Above, every power of two [2^k, 2^(k+1)) is split into
+ * HISTOGRAM_SUB_COUNT buckets of 2^(k - HISTOGRAM_SUB_BITS) values.
+ */
+static int histogramBucket(uint64_t value)
+{
+    int msb, shift, bucket;
+
+    if (value < HISTOGRAM_SUB_COUNT)
+        return (int)value;
+
+    msb = 63 - __builtin_clzll(value);
+    shift = msb - HISTOGRAM_SUB_BITS;
+    bucket = (shift + 1) * HISTOGRAM_SUB_COUNT + (int)((value >> shift) & (HISTOGRAM_SUB_COUNT - 1));
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+/* the middle of a bucket */
+static uint64_t histogramValue(int bucket)
+{
+    int shift;
+
+    if (bucket < HISTOGRAM_SUB_COUNT)
+        return (uint64_t)bucket;
+
+    shift = bucket / HISTOGRAM_SUB_COUNT - 1;
+    return ((uint64_t)(HISTOGRAM_SUB_COUNT + bucket % HISTOGRAM_SUB_COUNT) << shift) + ((1ULL << shift) >> 1);
+}
+
+void histogramReset(Histogram *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void histogramAdd(Histogram *h, uint64_t value)
+{
+    __atomic_add_fetch(&h->count[histogramBucket(value)], 1, __ATOMIC_RELAXED);
+    if (h->total == 0 || value < h->min)
+        __atomic_store_n(&h->min, value, __ATOMIC_RELAXED);
+    if (value > h->max)
+        __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, value, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->total, 1, __ATOMIC_RELEASE);
+}
+
+void histogramMerge(Histogram *dst, const Histogram *src)
+{
+    int i;
+    uint64_t total = __atomic_load_n(&src->total, __ATOMIC_ACQUIRE);
+
+    if (total == 0)
+        return;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        dst->count[i] += __atomic_load_n(&src->count[i], __ATOMIC_RELAXED);
+    }
+    if (dst->total == 0 || src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    dst->sum += __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+    dst->total += total;
+}
+
+uint64_t histogramPercentile(const Histogram *h, double p)
+{
+    uint64_t total = 0, rank, seen = 0, value;
+    int i;
+
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        total += __atomic_load_n(&h->count[i], __ATOMIC_RELAXED);
+    }
+    if (total == 0)
+        return 0;
+
+    rank = (uint64_t)(p / 100 * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += __atomic_load_n(&h->count[i], __ATOMIC_RELAXED);
+        if (seen >= rank)
+            break;
+    }
+
+    // a bucket is coarse, the exact extremes are known
+    value = histogramValue(i < HISTOGRAM_BUCKETS ? i : HISTOGRAM_BUCKETS - 1);
+    if (value > h->max)
+        value = h->max;
+    if (value < h->min)
+        value = h->min;
+    return value;
+}
+
+int histogramFormat(const Histogram *h, char *buf, int size)
+{
+    uint64_t total = __atomic_load_n(&h->total, __ATOMIC_ACQUIRE);
+
+    if (total == 0)
+        return snprintf(buf, size, "n 0");
+
+    return snprintf(buf, size, "n %llu avg %llu min %llu p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu",
+                    (unsigned long long)total, (unsigned long long)(h->sum / total), (unsigned long long)h->min,
+                    (unsigned long long)histogramPercentile(h, 50), (unsigned long long)histogramPercentile(h, 90),
+                    (unsigned long long)histogramPercentile(h, 99), (unsigned long long)histogramPercentile(h, 99.9),
+                    (unsigned long long)h->max);
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_HISTOGRAM_H
+#define HISILIVE_HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BITS 3  // 8 buckets per power of two, within 12.5%
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((40 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)  // values up to 2^40
+
+/*
+ * Log-linear histogram of non-negative values, e.g. latencies in μs. One thread adds values, any thread may
+ * read them: the counters are updated atomically, a reader sees each counter but not one consistent snapshot.
+ */
+typedef struct {
+    uint32_t count[HISTOGRAM_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+} Histogram;
+
+void histogramReset(Histogram *h);
+
+void histogramAdd(Histogram *h, uint64_t value);
+
+/* dst += src */
+void histogramMerge(Histogram *dst, const Histogram *src);
+
+/* the value below which p (0, 100] percent of the values are, 0 if empty */
+uint64_t histogramPercentile(const Histogram *h, double p);
+
+/* "n 100 avg 12 min 3 p50 11 p90 20 p99 31 p99.9 40 max 41", return the string length */
+int histogramFormat(const Histogram *h, char *buf, int size);
+
+#endif  // HISILIVE_HISTOGRAM_H
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "JitterBuffer.h"
+#include "RTP.h"
+#include <string.h>
+
+void jitterReset(JitterBuffer *jb)
+{
+    int i;
+
+    jb->started = 0;
+    jb->buffered = 0;
+    for (i = 0; i < JITTER_SLOT_MAX; i++) {
+        jb->slot[i].used = 0;
+    }
+}
+
+int jitterPush(JitterBuffer *jb, const uint8_t *buf, int len, uint64_t now)
+{
+    JitterSlot *slot;
+    uint16_t seq;
+    int diff;
+
+    if (len < RTP_HEADER_SIZE || len > JITTER_SLOT_SIZE || (buf[0] >> 6) != RTP_VERSION)
+        return -1;
+
+    seq = (uint16_t)((buf[2] << 8) | buf[3]);
+    if (!jb->started) {
+        jb->started = 1;
+        jb->next = seq;
+        jb->highest = seq;
+    }
+
+    diff = (int16_t)(seq - jb->next);
+    if (diff <= -JITTER_SLOT_MAX || diff >= JITTER_SLOT_MAX) {  // sender restarted or a long outage
+        jitterReset(jb);
+        jb->started = 1;
+        jb->next = seq;
+        jb->highest = seq;
+        diff = 0;
+    } else if (diff < 0) {
+        jb->late++;
+        return -1;
+    }
+
+    slot = &jb->slot[seq % JITTER_SLOT_MAX];
+    if (slot->used && slot->seq == seq) {
+        jb->duplicates++;
+        return -1;
+    }
+
+    if ((int16_t)(seq - jb->highest) < 0)
+        jb->reordered++;
+    else
+        jb->highest = seq;
+
+    memcpy(slot->data, buf, len);
+    slot->len = len;
+    slot->used = 1;
+    slot->seq = seq;
+    slot->arrival = now;
+    jb->buffered++;
+    jb->received++;
+    return 0;
+}
+
+/* the first buffered packet after next, NULL if none */
+static JitterSlot *jitterFirst(const JitterBuffer *jb)
+{
+    int span = (uint16_t)(jb->highest - jb->next);
+    int i;
+
+    for (i = 0; i <= span; i++) {
+        const JitterSlot *slot = &jb->slot[(uint16_t)(jb->next + i) % JITTER_SLOT_MAX];
+        if (slot->used && slot->seq == (uint16_t)(jb->next + i))
+            return (JitterSlot *)slot;
+    }
+    return NULL;
+}
+
+const JitterSlot *jitterPop(JitterBuffer *jb, uint64_t now, int *gap)
+{
+    JitterSlot *slot;
+
+    *gap = 0;
+    if (jb->buffered == 0)
+        return NULL;
+
+    slot = jitterFirst(jb);
+    if (NULL == slot || now < slot->arrival + (uint64_t)jb->delay * 1000)
+        return NULL;  // held for the playout delay, the missing packets before it may still come
+
+    if (slot->seq != jb->next) {
+        *gap = (uint16_t)(slot->seq - jb->next);
+        jb->lost += *gap;
+    }
+
+    // the data stays valid until the slot is reused JITTER_SLOT_MAX packets later
+    slot->used = 0;
+    jb->buffered--;
+    jb->next = (uint16_t)(slot->seq + 1);
+    if ((int16_t)(jb->highest - slot->seq) < 0)
+        jb->highest = slot->seq;
+    return slot;
+}
+
+int64_t jitterWaitTime(const JitterBuffer *jb, uint64_t now)
+{
+    const JitterSlot *slot;
+    uint64_t deadline;
+
+    if (jb->buffered == 0)
+        return -1;
+
+    slot = jitterFirst(jb);
+    if (NULL == slot)
+        return -1;
+
+    deadline = slot->arrival + (uint64_t)jb->delay * 1000;
+    return deadline > now ? (int64_t)(deadline - now) : 0;
+}
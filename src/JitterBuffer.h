@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_JITTER_BUFFER_H
+#define HISILIVE_JITTER_BUFFER_H
+
+#include <stdint.h>
+
+#define JITTER_SLOT_MAX 1024   // packets buffered, indexed by seq % JITTER_SLOT_MAX
+#define JITTER_SLOT_SIZE 1500  // max RTP packet
+
+typedef struct {
+    uint8_t data[JITTER_SLOT_SIZE];
+    int len;
+    int used;  // 0: empty or popped
+    uint16_t seq;
+    uint64_t arrival;  // monotonic μs
+} JitterSlot;
+
+typedef struct {
+    int delay;  // ms every packet is held after its arrival, the time the missing packets before it have to come
+
+    int started;
+    uint16_t next;     // seq of the next packet to pop
+    uint16_t highest;  // highest seq received
+    int buffered;
+
+    // stats
+    uint32_t received;
+    uint32_t lost;        // skipped after waiting delay
+    uint32_t duplicates;  // e.g. retransmitted after the packet arrived
+    uint32_t reordered;   // arrived after a higher seq
+    uint32_t late;        // arrived after its seq was popped or skipped
+
+    JitterSlot slot[JITTER_SLOT_MAX];
+} JitterBuffer;
+
+/* drop the buffered packets, the stats are kept; a zeroed JitterBuffer is ready to use */
+void jitterReset(JitterBuffer *jb);
+
+/* buffer one RTP packet received at now (monotonic μs), return -1 if it is dropped (late, duplicate, invalid) */
+int jitterPush(JitterBuffer *jb, const uint8_t *buf, int len, uint64_t now);
+
+/*
+ * take the next packet in seq order once it has been buffered delay ms, return its slot or NULL if none is ready;
+ * a gap is skipped when the packet after it is ready, *gap is set to the packets skipped before the returned one
+ */
+const JitterSlot *jitterPop(JitterBuffer *jb, uint64_t now, int *gap);
+
+/* μs until the next jitterPop may return a packet, -1 if the buffer is empty */
+int64_t jitterWaitTime(const JitterBuffer *jb, uint64_t now);
+
+#endif  // HISILIVE_JITTER_BUFFER_H
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "Latency.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *gStageName[LATENCY_STAGE_NUM] = {"encode", "get", "hold", "queue", "send", "total"};
+
+void latencyReset(LatencyStats *ls)
+{
+    int i;
+
+    for (i = 0; i < LATENCY_STAGE_NUM; i++) {
+        histogramReset(&ls->stage[i]);
+    }
+}
+
+void latencyAdd(LatencyStats *ls, int stage, uint64_t from, uint64_t to)
+{
+    if (from == 0 || stage < 0 || stage >= LATENCY_STAGE_NUM)
+        return;
+    histogramAdd(&ls->stage[stage], to > from ? to - from : 0);
+}
+
+const char *latencyStageName(int stage)
+{
+    return stage >= 0 && stage < LATENCY_STAGE_NUM ? gStageName[stage] : "unknown";
+}
+
+int latencyFormat(const LatencyStats *ls, const char *prefix, char *buf, int size)
+{
+    int i, len = 0;
+
+    if (size > 0)
+        buf[0] = '\0';
+    for (i = 0; i < LATENCY_STAGE_NUM && len < size; i++) {
+        if (__atomic_load_n(&ls->stage[i].total, __ATOMIC_ACQUIRE) == 0)
+            continue;
+        len += snprintf(buf + len, size - len, "%s %s: ", prefix, gStageName[i]);
+        if (len >= size)
+            break;
+        len += histogramFormat(&ls->stage[i], buf + len, size - len);
+        if (len >= size)
+            break;
+        len += snprintf(buf + len, size - len, "\n");
+    }
+
+    return len < size ? len : size - 1;
+}
+
+void latencyDumpStats(const LatencyStats *ls, const char *prefix)
+{
+    char buf[256];
+    int i, len = 0;
+
+    for (i = 0; i < LATENCY_STAGE_NUM && len < (int)sizeof(buf); i++) {
+        if (__atomic_load_n(&ls->stage[i].total, __ATOMIC_ACQUIRE) == 0)
+            continue;
+        len += snprintf(buf + len, sizeof(buf) - len, " %s %llu/%llu", gStageName[i],
+                        (unsigned long long)histogramPercentile(&ls->stage[i], 50),
+                        (unsigned long long)histogramPercentile(&ls->stage[i], 99));
+    }
+
+    if (len > 0) {
+        LOGI("%s latency p50/p99 μs:%s\n", prefix, buf);
+    }
+}
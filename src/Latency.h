@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_LATENCY_H
+#define HISILIVE_LATENCY_H
+
+#include "Histogram.h"
+#include <stdint.h>
+
+/*
+ * Where a frame spends its time from the sensor to the wire, monotonic μs:
+ *
+ *   PTS    wakeup    GetStream             ReleaseStream
+ *    |--------|----------|------------------------|             capture thread
+ *     encode      get    |          hold
+ *                        |-------------|--------|               sender thread
+ *                             queue    first    last packet
+ *                                        send
+ *    |----------------------------------------------|
+ *                         total
+ */
+// clang-format off
+enum {
+    LATENCY_ENCODE,  // encoder PTS -> the capture thread is woken up
+    LATENCY_GET,     // wakeup -> HI_MPI_VENC_GetStream returned
+    LATENCY_HOLD,    // GetStream -> ReleaseStream, the encoder buffer is held while the frame is queued
+    LATENCY_QUEUE,   // GetStream -> the first packet is handed to the kernel (or the pacer)
+    LATENCY_SEND,    // the first -> the last packet handed to the kernel
+    LATENCY_TOTAL,   // encoder PTS -> the last packet handed to the kernel
+    LATENCY_STAGE_NUM
+};
+// clang-format on
+
+/* one histogram per stage, each stage is added by one thread and can be read by any */
+typedef struct {
+    Histogram stage[LATENCY_STAGE_NUM];
+} LatencyStats;
+
+void latencyReset(LatencyStats *ls);
+
+/* add to - from to a stage, nothing if from is unknown (0); a negative time (clock skew) counts as 0 */
+void latencyAdd(LatencyStats *ls, int stage, uint64_t from, uint64_t to);
+
+const char *latencyStageName(int stage);
+
+/* one line per stage with samples, "<prefix> <stage>: n ... p50 ... max ...", return the length */
+int latencyFormat(const LatencyStats *ls, const char *prefix, char *buf, int size);
+
+/* log p50/p99 of every stage in one line */
+void latencyDumpStats(const LatencyStats *ls, const char *prefix);
+
+#endif  // HISILIVE_LATENCY_H
@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "Log.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_PATH_MAX 256
+
+typedef struct {
+    uint32_t seq;  // position: free for the producer claiming it, position + 1: written, for the logger thread
+    uint8_t level;
+    uint8_t color;
+    uint16_t len;
+    const char *func;  // NULL: no prefix
+    int line;
+    uint32_t suppressed;  // lines of the call site suppressed before this one
+    uint64_t time;        // realtime μs
+    char text[LOG_LINE_MAX];
+} LogSlot;
+
+/*
+ * Bounded multi-producer / single-consumer ring (D. Vyukov): a producer claims a position with a CAS on tail,
+ * formats the line into the slot and publishes it through the slot's seq; the logger thread reads in order.
+ */
+typedef struct {
+    LogSlot slot[LOG_RING_SLOTS];
+    uint32_t tail;     // claimed by producers
+    uint32_t head;     // logger thread
+    uint32_t dropped;  // the ring was full
+
+    char path[LOG_PATH_MAX];
+    uint32_t maxSize;
+    int keep;
+    FILE *file;
+    uint32_t fileSize;
+
+    int running;
+    pthread_t thread;
+} Logger;
+
+int gLogLevel = LOG_LEVEL_DEBUG;
+static Logger gLogger;
+
+static const char *gColor[] = {"", "\033[32m", "\033[31m"};
+static const char gLevelName[] = "EID";
+
+// the first LOG_RATE_LIMIT lines of a second pass, racing threads may let one or two more through
+static int logAllow(LogSite *site, uint32_t second, uint32_t *suppressed)
+{
+    uint32_t last = __atomic_load_n(&site->second, __ATOMIC_RELAXED);
+
+    *suppressed = 0;
+    if (last != second && __atomic_compare_exchange_n(&site->second, &last, second, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&site->count, 1, __ATOMIC_RELAXED);
+        *suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+        return 1;
+    }
+    if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) <= LOG_RATE_LIMIT) {
+        return 1;
+    }
+    __atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static LogSlot *logClaim(uint32_t *pos)
+{
+    uint32_t tail = __atomic_load_n(&gLogger.tail, __ATOMIC_RELAXED);
+    LogSlot *slot;
+    int32_t diff;
+
+    for (;;) {
+        slot = &gLogger.slot[tail & (LOG_RING_SLOTS - 1)];
+        diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - tail);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&gLogger.tail, &tail, tail + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos = tail;
+                return slot;
+            }  // tail was reloaded by the failed CAS
+        } else if (diff < 0) {
+            return NULL;  // the logger thread has not written this slot one lap ago
+        } else {
+            tail = __atomic_load_n(&gLogger.tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void logFormat(LogSlot *slot, const char *fmt, va_list ap)
+{
+    int n = vsnprintf(slot->text, LOG_LINE_MAX, fmt, ap);
+
+    if (n < 0) {
+        n = 0;
+        slot->text[0] = '\0';
+    } else if (n >= LOG_LINE_MAX) {  // cut, and still a line
+        n = LOG_LINE_MAX - 1;
+        memcpy(slot->text + n - 4, "...\n", 4);
+    }
+    slot->len = (uint16_t)n;
+}
+
+// return the bytes written
+static int logWrite(FILE *fp, const LogSlot *slot, const char *time)
+{
+    int eol = slot->func && (slot->len == 0 || slot->text[slot->len - 1] != '\n');
+    int color = fp == stdout ? slot->color : LOG_COLOR_NONE;
+    int len = 0;
+
+    fputs(gColor[color], fp);
+    if (time) {
+        len += fprintf(fp, "%s %c ", time, gLevelName[slot->level]);
+    }
+    if (slot->func) {
+        len += fprintf(fp, "[%s:%d]:", slot->func, slot->line);
+    }
+    if (slot->suppressed) {
+        len += fprintf(fp, "(+%u suppressed) ", slot->suppressed);
+    }
+    len += (int)fwrite(slot->text, 1, slot->len, fp);
+    if (eol) {
+        len += fputc('\n', fp) != EOF;
+    }
+    if (color != LOG_COLOR_NONE) {
+        fputs("\033[0m", fp);
+    }
+
+    return len;
+}
+
+void logPrint(LogSite *site, int level, int color, const char *func, int line, const char *fmt, ...)
+{
+    struct timespec ts;
+    uint32_t suppressed = 0, pos = 0;
+    LogSlot local, *slot = NULL;
+    va_list ap;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if (site && !logAllow(site, (uint32_t)ts.tv_sec, &suppressed))
+        return;
+
+    if (__atomic_load_n(&gLogger.running, __ATOMIC_ACQUIRE)) {
+        slot = logClaim(&pos);
+        if (NULL == slot) {
+            __atomic_add_fetch(&gLogger.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    // no logger thread: written by the caller, to the console only
+    if (NULL == slot) {
+        slot = &local;
+    }
+    slot->level = (uint8_t)level;
+    slot->color = (uint8_t)color;
+    slot->func = func;
+    slot->line = line;
+    slot->suppressed = suppressed;
+    slot->time = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+    va_start(ap, fmt);
+    logFormat(slot, fmt, ap);
+    va_end(ap);
+
+    if (slot == &local) {
+        logWrite(stdout, slot, NULL);
+    } else {
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    }
+}
+
+// path -> path.1 -> ... -> path.keep, the oldest is overwritten
+static void logRotate(void)
+{
+    char from[LOG_PATH_MAX + 16], to[LOG_PATH_MAX + 16];
+    int i;
+
+    if (gLogger.file) {
+        fclose(gLogger.file);
+    }
+    for (i = gLogger.keep; i > 0; i--) {
+        if (i > 1) {
+            snprintf(from, sizeof(from), "%s.%d", gLogger.path, i - 1);
+        } else {
+            snprintf(from, sizeof(from), "%s", gLogger.path);
+        }
+        snprintf(to, sizeof(to), "%s.%d", gLogger.path, i);
+        rename(from, to);
+    }
+
+    gLogger.file = fopen(gLogger.path, "w");
+    gLogger.fileSize = 0;
+}
+
+// a line to the console, and with the time to the log file
+static void logOutput(const LogSlot *slot)
+{
+    static time_t lastSecond = 0;
+    static char second[24];
+    char time[32];
+    struct tm tm;
+    time_t t;
+
+    logWrite(stdout, slot, NULL);
+    if (gLogger.file) {
+        t = (time_t)(slot->time / 1000000);
+        if (t != lastSecond) {
+            localtime_r(&t, &tm);
+            strftime(second, sizeof(second), "%Y-%m-%d %H:%M:%S", &tm);
+            lastSecond = t;
+        }
+        snprintf(time, sizeof(time), "%s.%03u", second, (unsigned)(slot->time / 1000 % 1000));
+        gLogger.fileSize += (uint32_t)logWrite(gLogger.file, slot, time);
+        if (gLogger.fileSize >= gLogger.maxSize) {
+            logRotate();
+        }
+    }
+}
+
+// write the published lines, return how many
+static int logDrain(void)
+{
+    struct timespec ts;
+    LogSlot note;
+    LogSlot *slot;
+    uint32_t dropped;
+    int n = 0;
+
+    dropped = __atomic_exchange_n(&gLogger.dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        memset(&note, 0, sizeof(note));
+        note.level = LOG_LEVEL_ERROR;
+        note.color = LOG_COLOR_RED;
+        note.func = __FUNCTION__;
+        note.line = __LINE__;
+        note.time = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+        note.len = (uint16_t)snprintf(note.text, LOG_LINE_MAX, "%u lines dropped, the log ring was full\n", dropped);
+        logOutput(&note);
+    }
+
+    for (;;) {
+        slot = &gLogger.slot[gLogger.head & (LOG_RING_SLOTS - 1)];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != gLogger.head + 1)
+            break;  // empty, or the producer is still formatting
+
+        logOutput(slot);
+        __atomic_store_n(&slot->seq, gLogger.head + LOG_RING_SLOTS, __ATOMIC_RELEASE);
+        gLogger.head++;
+        n++;
+    }
+
+    if (n > 0 || dropped) {
+        fflush(stdout);
+        if (gLogger.file) {
+            fflush(gLogger.file);
+        }
+    }
+
+    return n;
+}
+
+static void *logThread(void *arg)
+{
+    (void)arg;
+    prctl(PR_SET_NAME, "Logger", 0, 0, 0);
+
+    while (__atomic_load_n(&gLogger.running, __ATOMIC_ACQUIRE)) {
+        if (logDrain() == 0) {
+            usleep(LOG_FLUSH_INTERVAL * 1000);
+        }
+    }
+    logDrain();
+
+    return NULL;
+}
+
+int logStart(const char *path, uint32_t maxSize, int keep)
+{
+    static int registered = 0;
+    struct stat st;
+    uint32_t i;
+
+    if (gLogger.running)
+        return 0;
+
+    for (i = 0; i < LOG_RING_SLOTS; i++) {
+        gLogger.slot[i].seq = i;
+    }
+    gLogger.head = 0;
+    gLogger.tail = 0;
+    gLogger.dropped = 0;
+    gLogger.file = NULL;
+
+    if (path && path[0]) {
+        snprintf(gLogger.path, sizeof(gLogger.path), "%s", path);
+        gLogger.maxSize = maxSize > 0 ? maxSize : LOG_FILE_MAX;
+        gLogger.keep = keep;
+        if (stat(path, &st) == 0 && st.st_size > 0) {  // the log of the previous run is kept as path.1
+            logRotate();
+        } else {
+            gLogger.file = fopen(path, "w");
+            gLogger.fileSize = 0;
+        }
+        if (NULL == gLogger.file) {
+            LOGE("open log file %s error.\n", path);
+        }
+    }
+
+    __atomic_store_n(&gLogger.running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&gLogger.thread, NULL, logThread, NULL)) {
+        __atomic_store_n(&gLogger.running, 0, __ATOMIC_RELEASE);
+        LOGE("logger thread create error.\n");
+        return -1;
+    }
+
+    if (!registered) {
+        atexit(logStop);
+        registered = 1;
+    }
+    return 0;
+}
+
+void logStop(void)
+{
+    if (!__atomic_load_n(&gLogger.running, __ATOMIC_ACQUIRE))
+        return;
+
+    __atomic_store_n(&gLogger.running, 0, __ATOMIC_RELEASE);
+    pthread_join(gLogger.thread, NULL);
+    if (gLogger.file) {
+        fclose(gLogger.file);
+        gLogger.file = NULL;
+    }
+}
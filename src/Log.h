@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_LOG_H
+#define HISILIVE_LOG_H
+
+#include <stdint.h>
+
+#define LOG_RING_SLOTS 256      // lines queued for the logger thread, power of two
+#define LOG_LINE_MAX 384        // bytes of a line, longer ones are cut
+#define LOG_RATE_LIMIT 10       // lines per second from one call site, the rest are counted
+#define LOG_FLUSH_INTERVAL 50   // ms the logger thread sleeps when there is nothing to write
+#define LOG_FILE_MAX (1 << 20)  // bytes of the log file before it is rotated
+#define LOG_FILE_KEEP 2         // rotated files kept, path.1 is the newest
+
+// clang-format off
+enum {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+};
+
+enum {
+    LOG_COLOR_NONE,
+    LOG_COLOR_GREEN,
+    LOG_COLOR_RED
+};
+// clang-format on
+
+/* one per call site: lines within the current second, and lines suppressed since the last one written */
+typedef struct {
+    uint32_t second;
+    uint32_t count;
+    uint32_t suppressed;
+} LogSite;
+
+extern int gLogLevel;  // lines above it are not even formatted
+
+/*
+ * Every line is formatted by the calling thread into a slot of a lock-free ring and written to the console
+ * and the log file by the logger thread, so a slow serial console or SD card never blocks a streaming thread.
+ * A full ring drops the line. Before logStart and after logStop lines are written by the caller.
+ */
+#define LOG_PRINT(level, color, fmt...)                                                                                                    \
+    do {                                                                                                                                   \
+        static LogSite _logSite;                                                                                                           \
+        if ((level) <= gLogLevel)                                                                                                          \
+            logPrint(&_logSite, level, color, __FUNCTION__, __LINE__, fmt);                                                                \
+    } while (0)
+
+// console output without the call site and rate limit, e.g. the results of a tool
+#define LOG_CONSOLE(level, color, fmt...)                                                                                                  \
+    do {                                                                                                                                   \
+        if ((level) <= gLogLevel)                                                                                                          \
+            logPrint((LogSite *)0, level, color, (const char *)0, 0, fmt);                                                                 \
+    } while (0)
+
+#define LOG(fmt...) LOG_PRINT(LOG_LEVEL_DEBUG, LOG_COLOR_NONE, fmt)
+
+#define LOGI(fmt...) LOG_PRINT(LOG_LEVEL_INFO, LOG_COLOR_GREEN, fmt)  // periodic summaries
+
+#define LOGD(fmt...) LOG_PRINT(LOG_LEVEL_DEBUG, LOG_COLOR_GREEN, fmt)
+
+#define LOGE(fmt...) LOG_PRINT(LOG_LEVEL_ERROR, LOG_COLOR_RED, fmt)
+
+#define GREEN(fmt...) LOG_CONSOLE(LOG_LEVEL_INFO, LOG_COLOR_GREEN, fmt)
+
+#define RED(fmt...) LOG_CONSOLE(LOG_LEVEL_ERROR, LOG_COLOR_RED, fmt)
+
+/* site: NULL for no rate limit; func: NULL for no "[func:line]:" prefix */
+void logPrint(LogSite *site, int level, int color, const char *func, int line, const char *fmt, ...)
+    __attribute__((format(printf, 6, 7)));
+
+/* start the logger thread, also writing to path (NULL: console only), rotated at maxSize keeping keep files */
+int logStart(const char *path, uint32_t maxSize, int keep);
+
+/* write the queued lines and stop the logger thread, also called at exit */
+void logStop(void);
+
+#endif  // HISILIVE_LOG_H
@@ -3,8 +3,20 @@
  */
 
 #include "Media.h"
+#include "Utils.h"
 #include <stdio.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+typedef const uint8_t *(*FindStartcodeFunc)(const uint8_t *p, const uint8_t *end);
+
 static const uint8_t *ff_avc_find_startcode_internal(const uint8_t *p, const uint8_t *end)
 {
     const uint8_t *a = p + 4 - ((intptr_t)p & 3);  // a=p后面第一个地址为00的位置上
@@ -40,9 +52,102 @@ static const uint8_t *ff_avc_find_startcode_internal(const uint8_t *p, const uin
     return end + 3;  // no start code in [p, end], return end.
 }
 
+/*
+ * Vector kernels, same result as ff_avc_find_startcode_internal(): the first 00 00 01 at
+ * a position < end - 3, or end. Each iteration tests 16/32 positions i for
+ * p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1, the tail is left to the scalar version.
+ */
+#if defined(__SSE2__)
+static const uint8_t *find_startcode_sse2(const uint8_t *p, const uint8_t *end)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+
+    for (; end - p >= 16 + 3; p += 16) {  // last position tested is end - 4, last byte read end - 2
+        __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 1));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(p + 2));
+        __m128i m = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(v0, zero), _mm_cmpeq_epi8(v1, zero)), _mm_cmpeq_epi8(v2, one));
+        int mask = _mm_movemask_epi8(m);
+        if (mask)
+            return p + __builtin_ctz((unsigned)mask);
+    }
+
+    return ff_avc_find_startcode_internal(p, end);
+}
+
+__attribute__((target("avx2"))) static const uint8_t *find_startcode_avx2(const uint8_t *p, const uint8_t *end)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+
+    for (; end - p >= 32 + 3; p += 32) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+        __m256i v2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+        __m256i m = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(v0, zero), _mm256_cmpeq_epi8(v1, zero)),
+                                     _mm256_cmpeq_epi8(v2, one));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+
+    return find_startcode_sse2(p, end);
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+static const uint8_t *find_startcode_neon(const uint8_t *p, const uint8_t *end)
+{
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+
+    for (; end - p >= 16 + 3; p += 16) {
+        uint8x16_t v0 = vld1q_u8(p);
+        uint8x16_t v1 = vld1q_u8(p + 1);
+        uint8x16_t v2 = vld1q_u8(p + 2);
+        uint8x16_t m = vandq_u8(vandq_u8(vceqq_u8(v0, zero), vceqq_u8(v1, zero)), vceqq_u8(v2, one));
+        uint64x2_t m64 = vreinterpretq_u64_u8(m);
+        if (vgetq_lane_u64(m64, 0) | vgetq_lane_u64(m64, 1)) {
+            int i;
+            for (i = 0; i < 16; i++) {
+                if (p[i] == 0 && p[i + 1] == 0 && p[i + 2] == 1)
+                    return p + i;
+            }
+        }
+    }
+
+    return ff_avc_find_startcode_internal(p, end);
+}
+#endif
+
+static const uint8_t *find_startcode_init(const uint8_t *p, const uint8_t *end);
+
+static FindStartcodeFunc find_startcode = find_startcode_init;
+
+// pick the kernel for this CPU on first use
+static const uint8_t *find_startcode_init(const uint8_t *p, const uint8_t *end)
+{
+    FindStartcodeFunc func = ff_avc_find_startcode_internal;
+    const char *name;
+    int simd = getCPUSimd(&name);
+
+#if defined(__SSE2__)
+    func = simd == CPU_SIMD_AVX2 ? find_startcode_avx2 : find_startcode_sse2;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    if (simd == CPU_SIMD_NEON)
+        func = find_startcode_neon;
+#endif
+    (void)simd;
+
+    LOGD("start code scanner: %s\n", name);
+    find_startcode = func;
+    return func(p, end);
+}
+
 const uint8_t *ff_avc_find_startcode(const uint8_t *p, const uint8_t *end)
 {
-    const uint8_t *out = ff_avc_find_startcode_internal(p, end);
+    const uint8_t *out = find_startcode(p, end);
     if (p < out && out < end && !out[-1])
         out--;  // find 0001 in x001
     return out;
@@ -7,7 +7,46 @@
 
 #include <stdint.h>
 
-/* copy from FFmpeg libavformat/acv.c */
+// clang-format off
+/* NAL unit types used by the streaming path */
+enum {
+    H264_NAL_SLICE = 1,
+    H264_NAL_IDR = 5,
+    H264_NAL_SEI = 6,
+    H264_NAL_SPS = 7,
+    H264_NAL_PPS = 8,
+};
+
+enum {
+    HEVC_NAL_TRAIL_R = 1,
+    HEVC_NAL_IDR_W_RADL = 19,
+    HEVC_NAL_IDR_N_LP = 20,
+    HEVC_NAL_VPS = 32,
+    HEVC_NAL_SPS = 33,
+    HEVC_NAL_PPS = 34,
+    HEVC_NAL_SEI_PREFIX = 39,
+};
+// clang-format on
+
+/* one encoder output pack, H.264/HEVC Annex-B byte stream */
+typedef struct {
+    const uint8_t *data;  // starts with a start code
+    uint32_t len;
+    int nalType;   // NAL unit type from the encoder, -1 unknown
+    int nalCount;  // 1: the pack is a single NAL; 0: unknown or several NALs, scan for start codes
+} MediaPack;
+
+/* one encoded frame (access unit) made of one or more packs */
+typedef struct {
+    const MediaPack *packs;
+    int packCount;
+    uint64_t pts;  // μs
+    int keyFrame;   // IDR frame
+    int reference;  // other frames refer to it, a non-reference frame can be dropped alone
+    uint64_t readTime;  // monotonic μs when the frame was taken from the encoder or source, 0: unknown
+} MediaFrame;
+
+/* copy from FFmpeg libavformat/acv.c, with NEON/SSE2/AVX2 kernels picked at runtime */
 const uint8_t *ff_avc_find_startcode(const uint8_t *p, const uint8_t *end);
 
 #endif  // HISILIVE_MEDIA_H
@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "Metrics.h"
+#include "Utils.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define METRICS_REQUEST_MAX 1024
+#define METRICS_TIMEOUT 1  // s a client has to send its request or take the response
+
+#define LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+
+// clang-format off
+enum {
+    METRIC_FRAMES,
+    METRIC_PACKS,
+    METRIC_BYTES,
+    METRIC_LEFT_FRAMES,
+    METRIC_QUEUE_FRAMES,
+    METRIC_QUEUE_OCCUPANCY,
+    METRIC_QUEUE_MAX,
+    METRIC_DROP_FULL,
+    METRIC_DROP_WAIT_KEY,
+    METRIC_DROP_NON_REF,
+    METRIC_RTP_PACKETS,
+    METRIC_RTP_BYTES,
+    METRIC_UDP_PACKETS,
+    METRIC_UDP_BYTES,
+    METRIC_UDP_ERRORS,
+    METRIC_UDP_AGAIN,
+    METRIC_UDP_GSO_SENDS,
+    METRIC_RECEIVERS,
+    METRIC_PACER_DROPPED,
+    METRIC_NUM
+};
+// clang-format on
+
+typedef struct {
+    const char *name;
+    const char *type;  // NULL: one more sample of the previous family
+    const char *help;
+    const char *labels;  // appended to the chn label
+} MetricsFamily;
+
+static const MetricsFamily gFamily[METRIC_NUM] = {
+    {"hisilive_frames_total", "counter", "Frames got from the encoder.", ""},
+    {"hisilive_packs_total", "counter", "Packs (NAL units) got from the encoder.", ""},
+    {"hisilive_encoded_bytes_total", "counter", "Bytes got from the encoder.", ""},
+    {"hisilive_encoder_left_frames", "gauge", "Frames in the encoder stream buffer when the last frame was taken.", ""},
+    {"hisilive_queue_frames_total", "counter", "Frames queued for the sender or recorder thread.", ""},
+    {"hisilive_queue_occupancy_percent", "gauge", "Occupancy of the frame queue.", ""},
+    {"hisilive_queue_max_occupancy_percent", "gauge", "Highest occupancy of the frame queue.", ""},
+    {"hisilive_frames_dropped_total", "counter", "Frames dropped by the frame queue.", ",reason=\"full\""},
+    {"hisilive_frames_dropped_total", NULL, NULL, ",reason=\"wait_idr\""},
+    {"hisilive_frames_dropped_total", NULL, NULL, ",reason=\"non_reference\""},
+    {"hisilive_rtp_packets_total", "counter", "RTP packets of the stream, before they are sent to each receiver.", ""},
+    {"hisilive_rtp_payload_bytes_total", "counter", "RTP payload bytes of the stream.", ""},
+    {"hisilive_udp_packets_total", "counter", "UDP datagrams sent, once per receiver.", ""},
+    {"hisilive_udp_bytes_total", "counter", "UDP payload bytes sent, once per receiver.", ""},
+    {"hisilive_udp_send_errors_total", "counter", "UDP datagrams which could not be sent.", ""},
+    {"hisilive_udp_send_again_total", "counter", "Send errors because the socket buffer or device queue was full.", ""},
+    {"hisilive_udp_gso_sends_total", "counter", "Sends of several UDP datagrams as one, segmented by UDP GSO.", ""},
+    {"hisilive_receivers", "gauge", "Receivers of the stream, UDP and interleaved.", ""},
+    {"hisilive_pacer_dropped_total", "counter", "Packets dropped because the pacer queue was full.", ""},
+};
+
+static const double gQuantile[] = {0.5, 0.9, 0.99, 0.999};
+
+static void metricsPrintf(MetricsServer *server, const char *fmt, ...)
+{
+    int room = METRICS_BUF_SIZE - server->len;
+    int n;
+    va_list ap;
+
+    if (room <= 1)
+        return;
+    va_start(ap, fmt);
+    n = vsnprintf(server->buf + server->len, room, fmt, ap);
+    va_end(ap);
+    server->len += n < room ? n : room - 1;
+}
+
+static void metricsFamily(MetricsServer *server, const char *name, const char *type, const char *help)
+{
+    metricsPrintf(server, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// value of metric m of a stream, return -1 if the stream has no such part
+static int metricsValue(const MetricsStream *st, int m, uint64_t *value)
+{
+    FrameQueue *q = st->sink && LOAD(&st->sink->running) ? &st->sink->queue : NULL;
+
+    if ((m <= METRIC_LEFT_FRAMES && !st->capture) || (m >= METRIC_QUEUE_FRAMES && m <= METRIC_DROP_NON_REF && !q) ||
+        (m >= METRIC_RTP_PACKETS && m <= METRIC_RTP_BYTES && !st->rtp) || (m >= METRIC_UDP_PACKETS && m <= METRIC_RECEIVERS && !st->udp) ||
+        (m == METRIC_PACER_DROPPED && (!st->pacer || !LOAD(&st->pacer->running))))
+        return -1;
+
+    switch (m) {
+    case METRIC_FRAMES: *value = LOAD(&st->capture->frames); break;
+    case METRIC_PACKS: *value = LOAD(&st->capture->packs); break;
+    case METRIC_BYTES: *value = LOAD(&st->capture->bytes); break;
+    case METRIC_LEFT_FRAMES: *value = LOAD(&st->capture->leftFrames); break;
+    case METRIC_QUEUE_FRAMES: *value = LOAD(&q->pushed); break;
+    case METRIC_QUEUE_OCCUPANCY: *value = (uint64_t)frameQueueOccupancy(q); break;
+    case METRIC_QUEUE_MAX: *value = LOAD(&q->maxOccupancy); break;
+    case METRIC_DROP_FULL: *value = LOAD(&q->droppedFull); break;
+    case METRIC_DROP_WAIT_KEY: *value = LOAD(&q->droppedWaitKey); break;
+    case METRIC_DROP_NON_REF: *value = LOAD(&q->droppedNonRef); break;
+    case METRIC_RTP_PACKETS: *value = LOAD(&st->rtp->sentPackets); break;
+    case METRIC_RTP_BYTES: *value = LOAD(&st->rtp->sentOctets); break;
+    case METRIC_UDP_PACKETS: *value = LOAD(&st->udp->stats.packets); break;
+    case METRIC_UDP_BYTES: *value = LOAD(&st->udp->stats.bytes); break;
+    case METRIC_UDP_ERRORS: *value = LOAD(&st->udp->stats.errors); break;
+    case METRIC_UDP_AGAIN: *value = LOAD(&st->udp->stats.again); break;
+    case METRIC_UDP_GSO_SENDS: *value = LOAD(&st->udp->stats.gsoSends); break;
+    case METRIC_RECEIVERS: *value = (uint64_t)LOAD(&st->udp->dstCount); break;  // not udp->lock, the senders take it
+    case METRIC_PACER_DROPPED: *value = LOAD(&st->pacer->dropped); break;
+    default: return -1;
+    }
+
+    return 0;
+}
+
+static void metricsReceivers(MetricsServer *server)
+{
+    static RTCPReceiverStats stats[METRICS_STREAM_MAX][RTCP_RECEIVER_MAX];  // only the server thread formats
+    int count[METRICS_STREAM_MAX];
+    char labels[METRICS_STREAM_MAX][RTCP_RECEIVER_MAX][96];
+    int i, j, total = 0;
+
+    for (i = 0; i < server->streamCount; i++) {
+        RTCPContext *rtcp = server->stream[i].rtcp;
+        count[i] = rtcp && LOAD(&rtcp->running) ? rtcpGetStats(rtcp, stats[i], RTCP_RECEIVER_MAX) : 0;
+        for (j = 0; j < count[i]; j++) {
+            snprintf(labels[i][j], sizeof(labels[i][j]), "chn=\"%s\",receiver=\"%s:%d\",ssrc=\"%08X\"", server->stream[i].label,
+                     inet_ntoa(stats[i][j].addr.sin_addr), ntohs(stats[i][j].addr.sin_port), stats[i][j].ssrc);
+        }
+        total += count[i];
+    }
+    if (total == 0)
+        return;
+
+    metricsFamily(server, "hisilive_receiver_lost_packets", "gauge", "Cumulative packets lost, from the receiver reports.");
+    for (i = 0; i < server->streamCount; i++) {
+        for (j = 0; j < count[i]; j++) {
+            metricsPrintf(server, "hisilive_receiver_lost_packets{%s} %d\n", labels[i][j], stats[i][j].cumulativeLost);
+        }
+    }
+    metricsFamily(server, "hisilive_receiver_fraction_lost", "gauge", "Fraction of packets lost since the previous report.");
+    for (i = 0; i < server->streamCount; i++) {
+        for (j = 0; j < count[i]; j++) {
+            metricsPrintf(server, "hisilive_receiver_fraction_lost{%s} %.4f\n", labels[i][j], stats[i][j].fractionLost / 256.0);
+        }
+    }
+    metricsFamily(server, "hisilive_receiver_jitter_seconds", "gauge", "Interarrival jitter reported by the receiver.");
+    for (i = 0; i < server->streamCount; i++) {
+        for (j = 0; j < count[i]; j++) {
+            metricsPrintf(server, "hisilive_receiver_jitter_seconds{%s} %.6f\n", labels[i][j], stats[i][j].jitter / 90000.0);
+        }
+    }
+    metricsFamily(server, "hisilive_receiver_rtt_seconds", "gauge", "Round trip time, from the last sender report echoed.");
+    for (i = 0; i < server->streamCount; i++) {
+        for (j = 0; j < count[i]; j++) {
+            if (stats[i][j].rtt >= 0) {
+                metricsPrintf(server, "hisilive_receiver_rtt_seconds{%s} %.6f\n", labels[i][j], stats[i][j].rtt / 1e6);
+            }
+        }
+    }
+}
+
+static void metricsLatency(MetricsServer *server)
+{
+    int i, s, q, family = 0;
+
+    for (i = 0; i < server->streamCount; i++) {
+        LatencyStats *ls = server->stream[i].latency;
+        for (s = 0; ls && s < LATENCY_STAGE_NUM; s++) {
+            const Histogram *h = &ls->stage[s];
+            uint64_t total = __atomic_load_n(&h->total, __ATOMIC_ACQUIRE);
+            if (total == 0)
+                continue;
+            if (!family) {
+                metricsFamily(server, "hisilive_latency_seconds", "summary", "Latency of a frame per stage, see Latency.h.");
+                family = 1;
+            }
+            for (q = 0; q < (int)(sizeof(gQuantile) / sizeof(gQuantile[0])); q++) {
+                metricsPrintf(server, "hisilive_latency_seconds{chn=\"%s\",stage=\"%s\",quantile=\"%g\"} %.6f\n", server->stream[i].label,
+                              latencyStageName(s), gQuantile[q], histogramPercentile(h, gQuantile[q] * 100) / 1e6);
+            }
+            metricsPrintf(server, "hisilive_latency_seconds_sum{chn=\"%s\",stage=\"%s\"} %.6f\n", server->stream[i].label, latencyStageName(s),
+                          LOAD(&h->sum) / 1e6);
+            metricsPrintf(server, "hisilive_latency_seconds_count{chn=\"%s\",stage=\"%s\"} %llu\n", server->stream[i].label,
+                          latencyStageName(s), (unsigned long long)total);
+        }
+    }
+}
+
+int metricsFormat(MetricsServer *server)
+{
+    const MetricsFamily *f;
+    uint64_t value;
+    int i, m, header;
+
+    server->len = 0;
+    server->buf[0] = '\0';
+
+    // all samples of a family are together, the family is left out if no stream has it
+    for (m = 0; m < METRIC_NUM; m++) {
+        f = &gFamily[m];
+        header = f->type != NULL;
+        for (i = 0; i < server->streamCount; i++) {
+            if (metricsValue(&server->stream[i], m, &value))
+                continue;
+            if (header) {
+                metricsFamily(server, f->name, f->type, f->help);
+                header = 0;
+            }
+            metricsPrintf(server, "%s{chn=\"%s\"%s} %llu\n", f->name, server->stream[i].label, f->labels, (unsigned long long)value);
+        }
+    }
+    metricsReceivers(server);
+    metricsLatency(server);
+
+    metricsFamily(server, "hisilive_metrics_scrapes_total", "counter", "Requests of this endpoint.");
+    metricsPrintf(server, "hisilive_metrics_scrapes_total %llu\n", (unsigned long long)server->scrapes);
+
+    return server->len;
+}
+
+static void metricsSend(int socket, const char *status, const char *body, int len)
+{
+    char header[256];
+    int n;
+
+    n = snprintf(header, sizeof(header),
+                 "HTTP/1.0 %s\r\nServer: HisiLive\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                 "Content-Length: %d\r\nConnection: close\r\n\r\n",
+                 status, len);
+    if (send(socket, header, n, MSG_NOSIGNAL | MSG_MORE) != n || send(socket, body, len, MSG_NOSIGNAL) != len) {
+        LOGE("metrics send %s\n", strerror(errno));
+    }
+}
+
+// one request per connection, the client waits at most METRICS_TIMEOUT for each of the request and the response
+static void metricsServe(MetricsServer *server, int socket)
+{
+    char req[METRICS_REQUEST_MAX];
+    struct timeval tv;
+    int n, len = 0;
+
+    tv.tv_sec = METRICS_TIMEOUT;
+    tv.tv_usec = 0;
+    setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    while (len < METRICS_REQUEST_MAX - 1) {
+        n = (int)recv(socket, req + len, METRICS_REQUEST_MAX - 1 - len, 0);
+        if (n <= 0)
+            break;
+        len += n;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n"))
+            break;
+    }
+    if (len == 0)
+        return;
+    req[len] = '\0';
+
+    if (!strncmp(req, "GET /metrics", 12) && (req[12] == ' ' || req[12] == '?')) {
+        server->scrapes++;
+        metricsFormat(server);
+        metricsSend(socket, "200 OK", server->buf, server->len);
+    } else {
+        metricsSend(socket, "404 Not Found", "GET /metrics\n", 13);
+    }
+}
+
+static void *metricsThread(void *arg)
+{
+    MetricsServer *server = (MetricsServer *)arg;
+    struct timeval tv;
+    fd_set fds;
+    int client, res;
+
+    prctl(PR_SET_NAME, "Metrics", 0, 0, 0);
+
+    while (server->running) {
+        FD_ZERO(&fds);
+        FD_SET(server->socket, &fds);
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        res = select(server->socket + 1, &fds, NULL, NULL, &tv);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("metrics select %s\n", strerror(errno));
+            break;
+        }
+        if (res == 0)
+            continue;
+
+        client = accept(server->socket, NULL, NULL);
+        if (client < 0) {
+            LOGE("metrics accept %s\n", strerror(errno));
+            continue;
+        }
+        metricsServe(server, client);
+        close(client);
+    }
+
+    return NULL;
+}
+
+int metricsStart(MetricsServer *server)
+{
+    struct sockaddr_in addr;
+    int on = 1;
+
+    if (NULL == server || server->streamCount > METRICS_STREAM_MAX) {
+        LOGE("metricsStart param error.\n");
+        return -1;
+    }
+
+    server->buf = (char *)malloc(METRICS_BUF_SIZE);
+    if (NULL == server->buf) {
+        LOGE("metrics malloc error.\n");
+        return -1;
+    }
+
+    server->socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->socket < 0) {
+        LOGE("metrics socket error.\n");
+        free(server->buf);
+        return -1;
+    }
+    setsockopt(server->socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)server->port);
+    if (bind(server->socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server->socket, 4) < 0) {
+        LOGE("metrics bind/listen port %d: %s\n", server->port, strerror(errno));
+        close(server->socket);
+        free(server->buf);
+        return -1;
+    }
+
+    server->running = 1;
+    if (pthread_create(&server->thread, NULL, metricsThread, server)) {
+        LOGE("metrics thread create error.\n");
+        server->running = 0;
+        close(server->socket);
+        free(server->buf);
+        return -1;
+    }
+
+    LOGD("metrics on http://*:%d/metrics\n", server->port);
+    return 0;
+}
+
+void metricsStop(MetricsServer *server)
+{
+    if (!server->running)
+        return;
+
+    server->running = 0;
+    pthread_join(server->thread, NULL);
+    close(server->socket);
+    free(server->buf);
+    server->buf = NULL;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_METRICS_H
+#define HISILIVE_METRICS_H
+
+#include "Latency.h"
+#include "Network.h"
+#include "Pacer.h"
+#include "RTCP.h"
+#include "RTP.h"
+#include "Stream.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define METRICS_PORT 9100              // default of the command line options
+#define METRICS_BUF_SIZE (64 * 1024)   // bytes of a response
+#define METRICS_STREAM_MAX 4
+
+/* counters of the capture thread of one encoder channel, only that thread writes them (metricsAdd) */
+typedef struct {
+    uint64_t frames;
+    uint64_t packs;
+    uint64_t bytes;
+    uint64_t leftFrames;  // gauge: u32LeftStreamFrames of the encoder when the last frame was taken
+} CaptureCounters;
+
+/* the parts of one stream to expose, any of them may be NULL */
+typedef struct {
+    const char *label;  // value of the chn label, e.g. "0"
+    CaptureCounters *capture;
+    StreamSink *sink;  // the send or record queue
+    RTPMuxContext *rtp;
+    UDPContext *udp;
+    PacerContext *pacer;
+    RTCPContext *rtcp;  // per receiver reports, if running
+    LatencyStats *latency;
+} MetricsStream;
+
+/*
+ * Prometheus text exposition of the streaming counters on http://host:port/metrics.
+ *
+ * The counters are written by the streaming threads without locks and read with relaxed atomic loads, a scrape
+ * never takes a lock of the send path. The response is built in a buffer allocated at start, one request per
+ * connection, HTTP/1.0.
+ */
+typedef struct {
+    int port;
+    MetricsStream stream[METRICS_STREAM_MAX];  // set before metricsStart
+    int streamCount;
+
+    char *buf;
+    int len;
+    uint64_t scrapes;
+    int socket;
+    int running;
+    pthread_t thread;
+} MetricsServer;
+
+/* single writer: a plain store, no locked read-modify-write, readers never see a torn value */
+static inline void metricsAdd(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static inline void metricsSet(uint64_t *gauge, uint64_t value)
+{
+    __atomic_store_n(gauge, value, __ATOMIC_RELAXED);
+}
+
+/* listen on server->port and answer GET /metrics in a thread */
+int metricsStart(MetricsServer *server);
+
+void metricsStop(MetricsServer *server);
+
+/* write the exposition of all streams to server->buf, return its length */
+int metricsFormat(MetricsServer *server);
+
+#endif  // HISILIVE_METRICS_H
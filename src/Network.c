@@ -2,15 +2,27 @@
  * Copyright (c) 2017 Liming Shao <lmshao@163.com>
  */
 
+#define _GNU_SOURCE  // sendmmsg
 #include "Network.h"
 #include "Utils.h"
 #include <errno.h>
+#include <netinet/udp.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// older libc headers
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
 
 int udpInit(UDPContext *udp)
 {
-    if (NULL == udp || NULL == udp->dstIp || 0 == udp->dstPort) {
+    if (NULL == udp) {
         LOGE("udpInit error.\n");
         return -1;
     }
@@ -21,12 +33,46 @@ int udpInit(UDPContext *udp)
         return -1;
     }
 
-    udp->servAddr.sin_family = AF_INET;
-    udp->servAddr.sin_port = htons(udp->dstPort);
-    inet_aton(udp->dstIp, &udp->servAddr.sin_addr);
+    // bind now, so the local port can be announced (RTSP server_port)
+    struct sockaddr_in local;
+    socklen_t localLen = sizeof(local);
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((uint16_t)udp->localPort);
+    if (bind(udp->socket, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+        getsockname(udp->socket, (struct sockaddr *)&local, &localLen) < 0) {
+        LOGE("udpInit bind port %d error. %s\n", udp->localPort, strerror(errno));
+        close(udp->socket);
+        udp->socket = -1;
+        return -1;
+    }
+    udp->localPort = ntohs(local.sin_port);
+
+    // UDP GSO needs Linux 4.18, older kernels do not know the option
+    int segment = 0;
+    socklen_t segmentLen = sizeof(segment);
+    if (udp->gso && getsockopt(udp->socket, SOL_UDP, UDP_SEGMENT, &segment, &segmentLen) < 0) {
+        LOGE("UDP GSO not supported, %s, send with sendmmsg.\n", strerror(errno));
+        udp->gso = 0;
+    }
+
+    pthread_mutex_init(&udp->lock, NULL);
+    pthread_mutex_init(&udp->tcpLock, NULL);
+    memset(udp->tcpPending, 0, sizeof(udp->tcpPending));
+    udp->dstCount = 0;
+
+    if (udp->dstIp[0] == '\0' || 0 == udp->dstPort) {
+        LOGD("UDP init successfully, no receiver.\n");
+        return 0;
+    }
+
+    if (udpAddDest(udp, udp->dstIp, udp->dstPort, 0)) {
+        return -1;
+    }
 
     // test udp send
-    int num = (int)sendto(udp->socket, "", 1, 0, (struct sockaddr *)&udp->servAddr, sizeof(udp->servAddr));
+    int num = (int)sendto(udp->socket, "", 1, 0, (struct sockaddr *)&udp->dst[0].addr, sizeof(udp->dst[0].addr));
     if (num != 1) {
         LOGE("udpInit sendto test err. %d", num);
         return -1;
@@ -35,13 +81,696 @@ int udpInit(UDPContext *udp)
     return 0;
 }
 
-int udpSend(const UDPContext *udp, const uint8_t *data, uint32_t len)
+int udpAddDest(UDPContext *udp, const char *ip, int port, int rtcpPort)
 {
-    ssize_t num = sendto(udp->socket, data, len, 0, (struct sockaddr *)&udp->servAddr, sizeof(udp->servAddr));
-    if (num != len) {
-        LOGE("sendto %s. %d %u socket[%d]\n", strerror(errno), (int)num, len, udp->socket);
+    struct sockaddr_in addr;
+    int i, res = 0;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (port <= 0 || port > 65535 || !inet_aton(ip, &addr.sin_addr)) {
+        LOGE("udpAddDest invalid receiver %s:%d\n", ip, port);
         return -1;
     }
 
+    pthread_mutex_lock(&udp->lock);
+    for (i = 0; i < udp->dstCount; i++) {
+        if (udp->dst[i].tcpSocket < 0 && udp->dst[i].addr.sin_addr.s_addr == addr.sin_addr.s_addr &&
+            udp->dst[i].addr.sin_port == addr.sin_port)
+            break;
+    }
+    if (i < udp->dstCount) {
+        LOGD("receiver %s:%d already added\n", ip, port);
+    } else if (udp->dstCount >= UDP_DEST_MAX) {
+        LOGE("too many receivers, max %d\n", UDP_DEST_MAX);
+        res = -1;
+    } else {
+        udp->dst[udp->dstCount].addr = addr;
+        udp->dst[udp->dstCount].tcpSocket = -1;
+        udp->dst[udp->dstCount].channel = 0;
+        udp->dst[udp->dstCount].rtcpPort = rtcpPort > 0 ? rtcpPort : port + 1;
+        udp->dst[udp->dstCount].joining = 0;
+        udp->dstCount++;
+        LOGD("add receiver %s:%d, total %d\n", ip, port, udp->dstCount);
+    }
+    pthread_mutex_unlock(&udp->lock);
+
+    return res;
+}
+
+int udpRemoveDest(UDPContext *udp, const char *ip, int port)
+{
+    struct in_addr sin_addr;
+    int i, res = -1;
+
+    if (!inet_aton(ip, &sin_addr))
+        return -1;
+
+    pthread_mutex_lock(&udp->lock);
+    for (i = 0; i < udp->dstCount; i++) {
+        if (udp->dst[i].tcpSocket < 0 && udp->dst[i].addr.sin_addr.s_addr == sin_addr.s_addr &&
+            udp->dst[i].addr.sin_port == htons((uint16_t)port)) {
+            udp->dst[i] = udp->dst[--udp->dstCount];  // order of receivers does not matter
+            res = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&udp->lock);
+
+    if (res == 0) {
+        LOGD("remove receiver %s:%d\n", ip, port);
+    }
+    return res;
+}
+
+int udpAddTCPDest(UDPContext *udp, int tcpSocket, int channel)
+{
+    int res = 0;
+
+    pthread_mutex_lock(&udp->lock);
+    if (udp->dstCount >= UDP_DEST_MAX) {
+        LOGE("too many receivers, max %d\n", UDP_DEST_MAX);
+        res = -1;
+    } else {
+        memset(&udp->dst[udp->dstCount], 0, sizeof(UDPDest));
+        udp->dst[udp->dstCount].tcpSocket = tcpSocket;
+        udp->dst[udp->dstCount].channel = channel;
+        udp->dstCount++;
+        LOGD("add interleaved receiver socket[%d] channel %d, total %d\n", tcpSocket, channel, udp->dstCount);
+    }
+    pthread_mutex_unlock(&udp->lock);
+
+    return res;
+}
+
+int udpRemoveTCPDest(UDPContext *udp, int tcpSocket)
+{
+    int i, res = -1;
+
+    pthread_mutex_lock(&udp->tcpLock);  // wait for a batch being written to this socket
+    pthread_mutex_lock(&udp->lock);
+    for (i = 0; i < udp->dstCount; i++) {
+        if (udp->dst[i].tcpSocket == tcpSocket) {
+            udp->dst[i] = udp->dst[--udp->dstCount];
+            res = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&udp->lock);
+    for (i = 0; i < UDP_DEST_MAX; i++) {  // the socket number may be reused by the next connection
+        if (udp->tcpPending[i].socket == tcpSocket)
+            udp->tcpPending[i].len = 0;
+    }
+    pthread_mutex_unlock(&udp->tcpLock);
+
+    return res;
+}
+
+// called with lock held
+static int udpFindDest(UDPContext *udp, const UDPDest *dst)
+{
+    int i;
+
+    for (i = 0; i < udp->dstCount; i++) {
+        if (dst->tcpSocket >= 0 ? udp->dst[i].tcpSocket == dst->tcpSocket
+                                : udp->dst[i].tcpSocket < 0 && udp->dst[i].addr.sin_addr.s_addr == dst->addr.sin_addr.s_addr &&
+                                      udp->dst[i].addr.sin_port == dst->addr.sin_port)
+            return i;
+    }
+
+    return -1;
+}
+
+int udpJoinDest(UDPContext *udp, const UDPDest *dst)
+{
+    int res = 0;
+
+    pthread_mutex_lock(&udp->lock);
+    if (udpFindDest(udp, dst) >= 0) {
+        LOGE("receiver already added\n");
+        res = -1;
+    } else if (udp->dstCount >= UDP_DEST_MAX) {
+        LOGE("too many receivers, max %d\n", UDP_DEST_MAX);
+        res = -1;
+    } else {
+        udp->dst[udp->dstCount] = *dst;
+        udp->dst[udp->dstCount].joining = 1;
+        udp->dstCount++;
+        LOGD("add joining receiver %s, total %d\n", dst->tcpSocket >= 0 ? "interleaved" : inet_ntoa(dst->addr.sin_addr),
+             udp->dstCount);
+    }
+    pthread_mutex_unlock(&udp->lock);
+
+    return res;
+}
+
+int udpResumeDest(UDPContext *udp, const UDPDest *dst)
+{
+    int i;
+
+    pthread_mutex_lock(&udp->lock);
+    i = udpFindDest(udp, dst);
+    if (i >= 0) {
+        udp->dst[i].joining = 0;
+    }
+    pthread_mutex_unlock(&udp->lock);
+
+    return i >= 0 ? 0 : -1;
+}
+
+// called with tcpLock held: a sender's copy of the destination set may be stale
+static int udpHasTCPDest(UDPContext *udp, int tcpSocket)
+{
+    int i, found = 0;
+
+    pthread_mutex_lock(&udp->lock);
+    for (i = 0; i < udp->dstCount; i++) {
+        if (udp->dst[i].tcpSocket == tcpSocket) {
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&udp->lock);
+
+    return found;
+}
+
+// skip num bytes written of the iovecs of msg
+static void tcpSkip(struct msghdr *msg, size_t num)
+{
+    while (num > 0 && msg->msg_iovlen > 0) {
+        if (num >= msg->msg_iov[0].iov_len) {
+            num -= msg->msg_iov[0].iov_len;
+            msg->msg_iov++;
+            msg->msg_iovlen--;
+        } else {
+            msg->msg_iov[0].iov_base = (uint8_t *)msg->msg_iov[0].iov_base + num;
+            msg->msg_iov[0].iov_len -= num;
+            num = 0;
+        }
+    }
+}
+
+static int tcpWriteAll(int tcpSocket, struct msghdr *msg, size_t len)
+{
+    while (len > 0) {
+        ssize_t num = sendmsg(tcpSocket, msg, MSG_NOSIGNAL);
+        if (num < 0 && errno == EINTR)
+            continue;
+        if (num <= 0) {
+            LOGE("tcp send %s socket[%d]\n", strerror(errno), tcpSocket);
+            shutdown(tcpSocket, SHUT_RDWR);
+            return -1;
+        }
+        len -= (size_t)num;
+        tcpSkip(msg, (size_t)num);
+    }
+
+    return 0;
+}
+
+// write what the socket buffer takes now, return the bytes written (0: full), -1 if the connection failed
+static ssize_t tcpTryWrite(int tcpSocket, struct msghdr *msg)
+{
+    ssize_t num;
+
+    do {
+        num = sendmsg(tcpSocket, msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (num < 0 && errno == EINTR);
+
+    if (num < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (num < 0) {
+        LOGE("tcp send %s socket[%d]\n", strerror(errno), tcpSocket);
+        shutdown(tcpSocket, SHUT_RDWR);
+        return -1;
+    }
+
+    return num;
+}
+
+// called with tcpLock held
+static TCPPending *tcpFindPending(UDPContext *udp, int tcpSocket)
+{
+    int i;
+
+    for (i = 0; i < UDP_DEST_MAX; i++) {
+        if (udp->tcpPending[i].len > 0 && udp->tcpPending[i].socket == tcpSocket)
+            return &udp->tcpPending[i];
+    }
+
+    return NULL;
+}
+
+// write the pending rest of a packet without waiting, return 1 if none is left, 0 if some is, -1 on error
+static int tcpFlushPending(UDPContext *udp, int tcpSocket)
+{
+    TCPPending *pending = tcpFindPending(udp, tcpSocket);
+    struct iovec iov;
+    struct msghdr msg;
+    ssize_t num;
+
+    if (NULL == pending)
+        return 1;
+
+    iov.iov_base = pending->data;
+    iov.iov_len = (size_t)pending->len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    num = tcpTryWrite(tcpSocket, &msg);
+    if (num < 0) {
+        pending->len = 0;
+        return -1;
+    }
+    pending->len -= (int)num;
+    memmove(pending->data, pending->data + num, (size_t)pending->len);
+
+    return pending->len == 0;
+}
+
+// keep the rest (len bytes of msg) of a packet cut by a short write, or write it now if it does not fit
+static int tcpKeepPending(UDPContext *udp, int tcpSocket, struct msghdr *msg, size_t len)
+{
+    TCPPending *pending = NULL;
+    size_t i;
+    int j;
+
+    for (j = 0; j < UDP_DEST_MAX && NULL == pending; j++) {
+        if (udp->tcpPending[j].len == 0)
+            pending = &udp->tcpPending[j];
+    }
+    if (NULL == pending || len > TCP_PENDING_MAX)
+        return tcpWriteAll(tcpSocket, msg, len);
+
+    pending->socket = tcpSocket;
+    pending->len = 0;
+    for (i = 0; i < msg->msg_iovlen; i++) {
+        memcpy(pending->data + pending->len, msg->msg_iov[i].iov_base, msg->msg_iov[i].iov_len);
+        pending->len += (int)msg->msg_iov[i].iov_len;
+    }
+
+    return 0;
+}
+
+int tcpSend(UDPContext *udp, int tcpSocket, const void *data, int len)
+{
+    TCPPending *pending;
+    struct iovec iov;
+    struct msghdr msg;
+    int res;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = (size_t)len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    pthread_mutex_lock(&udp->tcpLock);
+    pending = tcpFindPending(udp, tcpSocket);
+    res = 0;
+    if (pending) {  // a reply waits for the packet before it
+        struct iovec rest = { pending->data, (size_t)pending->len };
+        struct msghdr restMsg;
+        memset(&restMsg, 0, sizeof(restMsg));
+        restMsg.msg_iov = &rest;
+        restMsg.msg_iovlen = 1;
+        res = tcpWriteAll(tcpSocket, &restMsg, (size_t)pending->len);
+        pending->len = 0;
+    }
+    if (res == 0) {
+        res = tcpWriteAll(tcpSocket, &msg, (size_t)len);
+    }
+    pthread_mutex_unlock(&udp->tcpLock);
+
+    return res < 0 ? -1 : len;
+}
+
+static void udpCountSent(UDPContext *udp, uint64_t packets, uint64_t bytes)
+{
+    __atomic_add_fetch(&udp->stats.packets, packets, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&udp->stats.bytes, bytes, __ATOMIC_RELAXED);
+}
+
+// err: errno of the failed send
+static void udpCountError(UDPContext *udp, int err)
+{
+    __atomic_add_fetch(&udp->stats.errors, 1, __ATOMIC_RELAXED);
+    if (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS) {
+        __atomic_add_fetch(&udp->stats.again, 1, __ATOMIC_RELAXED);
+    }
+}
+
+int udpSendToDest(UDPContext *udp, const UDPDest *dst, const uint8_t *data, int len)
+{
+    if (dst->tcpSocket >= 0) {
+        return tcpSendInterleaved(udp, dst->tcpSocket, dst->channel, data, len);
+    }
+
+    if (sendto(udp->socket, data, len, 0, (const struct sockaddr *)&dst->addr, sizeof(dst->addr)) != len) {
+        udpCountError(udp, errno);
+        LOGE("udpSendToDest %s:%d %s\n", inet_ntoa(dst->addr.sin_addr), ntohs(dst->addr.sin_port), strerror(errno));
+        return -1;
+    }
+    udpCountSent(udp, 1, (uint64_t)len);
     return len;
 }
+
+// copy the destination set so sending does not hold the lock
+int udpGetDests(UDPContext *udp, UDPDest *dst)
+{
+    int count;
+
+    pthread_mutex_lock(&udp->lock);
+    count = udp->dstCount;
+    memcpy(dst, udp->dst, sizeof(UDPDest) * count);
+    pthread_mutex_unlock(&udp->lock);
+
+    return count;
+}
+
+/*
+ * RTP over the RTSP connection (RFC 2326 10.12), every packet is prefixed with
+ *   '$' | channel | length (16 bits)
+ * A stalled client must not block the stream: packets are written without waiting, those the socket buffer can
+ * not take are dropped and counted as errors (again), the rest of a packet cut by a short write is kept and
+ * written first next time, so the framing holds. A connection which fails is shut down, the RTSP server then
+ * drops the session.
+ */
+static int tcpSendBatchTo(UDPContext *udp, const UDPDest *dst, const UDPPacket *pkts, int count)
+{
+    uint8_t prefix[UDP_BATCH_MAX][4];
+    struct iovec iov[UDP_BATCH_MAX * 3];
+    size_t pktLen[UDP_BATCH_MAX];
+    struct msghdr msg;
+    ssize_t num;
+    int i, n, res, done = 0;
+
+    pthread_mutex_lock(&udp->tcpLock);
+    if (!udpHasTCPDest(udp, dst->tcpSocket)) {  // removed since the copy was taken
+        pthread_mutex_unlock(&udp->tcpLock);
+        return 0;
+    }
+
+    res = tcpFlushPending(udp, dst->tcpSocket);
+    while (res > 0 && done < count) {
+        n = count - done > UDP_BATCH_MAX ? UDP_BATCH_MAX : count - done;
+        for (i = 0; i < n; i++) {
+            const UDPPacket *pkt = &pkts[done + i];
+            pktLen[i] = pkt->iov[0].iov_len + pkt->iov[1].iov_len;
+            prefix[i][0] = '$';
+            prefix[i][1] = (uint8_t)dst->channel;
+            prefix[i][2] = (uint8_t)(pktLen[i] >> 8);
+            prefix[i][3] = (uint8_t)pktLen[i];
+            iov[i * 3].iov_base = prefix[i];
+            iov[i * 3].iov_len = 4;
+            iov[i * 3 + 1] = pkt->iov[0];
+            iov[i * 3 + 2] = pkt->iov[1];
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)(n * 3);
+        num = tcpTryWrite(dst->tcpSocket, &msg);
+        if (num < 0) {
+            res = -1;
+            break;
+        }
+
+        for (i = 0; i < n && (size_t)num >= 4 + pktLen[i]; i++) {
+            num -= (ssize_t)(4 + pktLen[i]);
+        }
+        if (num > 0) {  // packet i is cut
+            msg.msg_iov = &iov[i * 3];
+            msg.msg_iovlen = 3;
+            tcpSkip(&msg, (size_t)num);
+            res = tcpKeepPending(udp, dst->tcpSocket, &msg, 4 + pktLen[i] - (size_t)num) < 0 ? -1 : 1;
+            if (res > 0)
+                i++;
+        }
+        done += i;
+        if (i < n)
+            break;  // the socket buffer is full
+    }
+    pthread_mutex_unlock(&udp->tcpLock);
+
+    for (i = done; i < count; i++) {
+        udpCountError(udp, res < 0 ? EPIPE : EAGAIN);
+    }
+
+    return done;
+}
+
+int tcpSendInterleaved(UDPContext *udp, int tcpSocket, int channel, const uint8_t *data, int len)
+{
+    UDPDest dst;
+    UDPPacket pkt;
+
+    memset(&dst, 0, sizeof(dst));
+    dst.tcpSocket = tcpSocket;
+    dst.channel = channel;
+    pkt.iov[0].iov_base = (void *)data;
+    pkt.iov[0].iov_len = (size_t)len;
+    pkt.iov[1].iov_base = NULL;
+    pkt.iov[1].iov_len = 0;
+
+    return tcpSendBatchTo(udp, &dst, &pkt, 1) == 1 ? len : -1;
+}
+
+int udpSend(UDPContext *udp, const uint8_t *data, uint32_t len)
+{
+    struct iovec iov;
+
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    return udpSendv(udp, &iov, 1);
+}
+
+static int udpSendvTo(UDPContext *udp, const struct sockaddr_in *dst, const struct iovec *iov, int iovcnt)
+{
+    int i;
+    size_t len = 0;
+    struct msghdr msg;
+
+    for (i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void *)dst;
+    msg.msg_namelen = sizeof(*dst);
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = (size_t)iovcnt;
+
+    ssize_t num = sendmsg(udp->socket, &msg, 0);
+    if (num != (ssize_t)len) {
+        udpCountError(udp, errno);
+        LOGE("sendmsg %s. %d %u socket[%d]\n", strerror(errno), (int)num, (unsigned)len, udp->socket);
+        return -1;
+    }
+    udpCountSent(udp, 1, len);
+
+    return (int)len;
+}
+
+int udpSendv(UDPContext *udp, const struct iovec *iov, int iovcnt)
+{
+    UDPDest dst[UDP_DEST_MAX];
+    UDPPacket pkt;
+    int i, count;
+    int res = 0;
+
+    count = udpGetDests(udp, dst);
+    for (i = 0; i < count; i++) {
+        if (dst[i].joining) {
+            continue;
+        } else if (dst[i].tcpSocket >= 0 && iovcnt <= 2) {
+            pkt.iov[0] = iov[0];
+            pkt.iov[1].iov_base = iovcnt > 1 ? iov[1].iov_base : NULL;
+            pkt.iov[1].iov_len = iovcnt > 1 ? iov[1].iov_len : 0;
+            res = tcpSendBatchTo(udp, &dst[i], &pkt, 1) == 1 ? 0 : -1;
+        } else if (dst[i].tcpSocket < 0) {
+            res = udpSendvTo(udp, &dst[i].addr, iov, iovcnt);
+        }
+    }
+
+    return res;
+}
+
+static int udpSendMmsgTo(UDPContext *udp, const struct sockaddr_in *dst, const UDPPacket *pkts, int count)
+{
+    static int noSendmmsg = 0;  // kernel without sendmmsg, fall back to sendmsg
+    struct mmsghdr msgs[UDP_BATCH_MAX];
+    int i, n, res;
+    int sent = 0;
+    int done = 0;
+
+    while (done < count) {
+        if (noSendmmsg) {
+            if (udpSendvTo(udp, dst, pkts[done].iov, 2) > 0)
+                sent++;
+            done++;
+            continue;
+        }
+
+        n = count - done > UDP_BATCH_MAX ? UDP_BATCH_MAX : count - done;
+        memset(msgs, 0, sizeof(struct mmsghdr) * n);
+        for (i = 0; i < n; i++) {
+            msgs[i].msg_hdr.msg_name = (void *)dst;
+            msgs[i].msg_hdr.msg_namelen = sizeof(*dst);
+            msgs[i].msg_hdr.msg_iov = (struct iovec *)pkts[done + i].iov;
+            msgs[i].msg_hdr.msg_iovlen = 2;
+        }
+
+        res = sendmmsg(udp->socket, msgs, (unsigned int)n, 0);
+        if (res > 0) {  // partial send: retry from the first packet not sent
+            uint64_t bytes = 0;
+            for (i = 0; i < res; i++) {
+                bytes += msgs[i].msg_len;
+            }
+            udpCountSent(udp, (uint64_t)res, bytes);
+            sent += res;
+            done += res;
+        } else if (res < 0 && errno == EINTR) {
+            continue;
+        } else if (res < 0 && errno == ENOSYS) {
+            LOGE("sendmmsg not supported, fall back to sendmsg.\n");
+            noSendmmsg = 1;
+        } else {  // the first packet of the batch can not be sent, drop it
+            udpCountError(udp, errno);
+            LOGE("sendmmsg %s. %d socket[%d]\n", strerror(errno), res, udp->socket);
+            done++;
+        }
+    }
+
+    return sent;
+}
+
+// packets from pkts[0] of one size, the last one may be shorter, which the kernel can cut out of one datagram
+static int udpGSORun(const UDPPacket *pkts, int count)
+{
+    size_t size = pkts[0].iov[0].iov_len + pkts[0].iov[1].iov_len;
+    size_t len = size, pktLen;
+    int n = 1;
+
+    while (n < count && n < UDP_GSO_SEGMENTS_MAX) {
+        pktLen = pkts[n].iov[0].iov_len + pkts[n].iov[1].iov_len;
+        if (pktLen > size || pktLen == 0 || len + pktLen > UDP_GSO_BYTES_MAX)
+            break;
+        len += pktLen;
+        n++;
+        if (pktLen < size)
+            break;  // the short one ends the run
+    }
+
+    return n;
+}
+
+/*
+ * One sendmsg of count packets gathered from their headers and payloads, with a UDP_SEGMENT control message:
+ * the kernel builds one large datagram and segments it (in software, or in the device) at the segment size,
+ * every segment is a UDP datagram with its own RTP (and FU) header. Return -1 if it was not sent.
+ */
+static int udpSendGSO(UDPContext *udp, const struct sockaddr_in *dst, const UDPPacket *pkts, int count)
+{
+    struct iovec iov[UDP_GSO_SEGMENTS_MAX * 2];
+    union {
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    size_t len = 0;
+    ssize_t num;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        iov[i * 2] = pkts[i].iov[0];
+        iov[i * 2 + 1] = pkts[i].iov[1];
+        len += pkts[i].iov[0].iov_len + pkts[i].iov[1].iov_len;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    msg.msg_name = (void *)dst;
+    msg.msg_namelen = sizeof(*dst);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size_t)(count * 2);
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    *(uint16_t *)CMSG_DATA(cm) = (uint16_t)(pkts[0].iov[0].iov_len + pkts[0].iov[1].iov_len);
+
+    do {
+        num = sendmsg(udp->socket, &msg, 0);
+    } while (num < 0 && errno == EINTR);
+
+    if (num != (ssize_t)len) {
+        // no offload for this socket or route (EIO: the device has no checksum offload), do not try again
+        if (num < 0 && (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP)) {
+            LOGE("UDP GSO send %s, fall back to sendmmsg.\n", strerror(errno));
+            __atomic_store_n(&udp->gso, 0, __ATOMIC_RELAXED);
+        }
+        return -1;
+    }
+    udpCountSent(udp, (uint64_t)count, len);
+    __atomic_add_fetch(&udp->stats.gsoSends, 1, __ATOMIC_RELAXED);
+
+    return count;
+}
+
+/*
+ * FU-A fragments of a NAL are all RTP_PAYLOAD_MAX + 12 bytes but the last one: with gso every run of at least two
+ * such packets is one UDP_SEGMENT send, the packets between runs (single NALs, STAP-A) go with sendmmsg.
+ * A run the kernel does not take is sent again with sendmmsg, which counts and logs its errors.
+ */
+static int udpSendBatchTo(UDPContext *udp, const struct sockaddr_in *dst, const UDPPacket *pkts, int count)
+{
+    int i = 0, start = 0, n, res;
+    int sent = 0;
+
+    while (i < count && __atomic_load_n(&udp->gso, __ATOMIC_RELAXED)) {
+        n = udpGSORun(&pkts[i], count - i);
+        if (n < 2) {
+            i++;
+            continue;
+        }
+        if (i > start) {
+            sent += udpSendMmsgTo(udp, dst, &pkts[start], i - start);
+        }
+        res = udpSendGSO(udp, dst, &pkts[i], n);
+        sent += res > 0 ? res : udpSendMmsgTo(udp, dst, &pkts[i], n);
+        i += n;
+        start = i;
+    }
+    if (start < count) {
+        sent += udpSendMmsgTo(udp, dst, &pkts[start], count - start);
+    }
+
+    return sent;
+}
+
+int udpSendBatch(UDPContext *udp, const UDPPacket *pkts, int count)
+{
+    UDPDest dst[UDP_DEST_MAX];
+    int i, n;
+    int sent = count;
+
+    // the same packets (headers and payload pointers) are sent to every receiver
+    n = udpGetDests(udp, dst);
+    for (i = 0; i < n; i++) {
+        if (dst[i].joining) {
+            continue;
+        } else if (dst[i].tcpSocket >= 0) {
+            sent = tcpSendBatchTo(udp, &dst[i], pkts, count);
+        } else {
+            sent = udpSendBatchTo(udp, &dst[i].addr, pkts, count);
+        }
+    }
+
+    return sent;
+}
@@ -7,19 +7,106 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
+#define UDP_BATCH_MAX 64  // max packets per sendmmsg
+#define UDP_DEST_MAX 8    // max receivers of one stream
+
+#define UDP_GSO_SEGMENTS_MAX 64  // max segments of one UDP_SEGMENT send (UDP_MAX_SEGMENTS of the kernel)
+#define UDP_GSO_BYTES_MAX 65000  // max bytes of one UDP_SEGMENT send, an IPv4 datagram before segmentation
+
+typedef struct {
+    struct iovec iov[2];  // header, payload
+} UDPPacket;
+
+#define TCP_PENDING_MAX 2048  // rest of an interleaved packet cut by a short write, packets are up to an MTU
+
+typedef struct {
+    struct sockaddr_in addr;  // UDP receiver
+    int tcpSocket;            // >= 0: RTP interleaved in this RTSP TCP connection instead of UDP
+    int channel;              // interleaved channel
+    int rtcpPort;             // UDP receiver's RTCP port, RTP port + 1 unless negotiated (RTSP client_port)
+    int joining;              // 1: skipped by the stream until udpResumeDest, e.g. while a GOP burst catches up
+} UDPDest;
+
+/* the rest of an interleaved packet the TCP socket buffer did not take, written before anything else */
 typedef struct {
-    char dstIp[16];
+    int socket;
+    int len;  // 0: unused
+    uint8_t data[TCP_PENDING_MAX];
+} TCPPending;
+
+/* send counters of a socket, added by the sending threads and read by any thread (metrics) */
+typedef struct {
+    uint64_t packets;   // UDP datagrams handed to the kernel, once per receiver
+    uint64_t bytes;
+    uint64_t errors;    // datagrams not sent, and interleaved packets dropped
+    uint64_t again;     // of errors: EAGAIN/ENOBUFS, the socket buffer or the device queue is full
+    uint64_t gsoSends;  // sendmsg calls with UDP_SEGMENT, each of them counted in packets once per segment
+} UDPCounters;
+
+typedef struct {
+    char dstIp[16];  // first receiver, optional
     int dstPort;
-    struct sockaddr_in servAddr;
+    int localPort;  // bind port, 0: any; the bound port after udpInit
     int socket;
+
+    pthread_mutex_t lock;  // protects the destination set
+    UDPDest dst[UDP_DEST_MAX];
+    int dstCount;
+
+    pthread_mutex_t tcpLock;  // serializes writes to interleaved TCP receivers, which do not wait, taken before lock
+    TCPPending tcpPending[UDP_DEST_MAX];  // protected by tcpLock
+
+    int gso;  // 1: runs of equal-size packets (FU-A) go as one UDP_SEGMENT send, cleared if the kernel can not
+
+    UDPCounters stats;
 } UDPContext;
 
-/* create UDP socket */
+/* create UDP socket, and add dstIp:dstPort as the first receiver if set */
 int udpInit(UDPContext *udp);
 
-/* send UDP packet */
-int udpSend(const UDPContext *udp, const uint8_t *data, uint32_t len);
+/* add a receiver with its RTCP port (0: port + 1), every packet is sent to all receivers; can be called while streaming */
+int udpAddDest(UDPContext *udp, const char *ip, int port, int rtcpPort);
+
+/* remove a receiver */
+int udpRemoveDest(UDPContext *udp, const char *ip, int port);
+
+/* add a receiver which gets the packets interleaved ($ channel length) in a connected TCP socket */
+int udpAddTCPDest(UDPContext *udp, int tcpSocket, int channel);
+
+/* remove the interleaved receiver of tcpSocket, no packet is written to it after return */
+int udpRemoveTCPDest(UDPContext *udp, int tcpSocket);
+
+/* add a joining receiver (UDP or interleaved): packets sent to all receivers skip it until udpResumeDest */
+int udpJoinDest(UDPContext *udp, const UDPDest *dst);
+
+/* let a joining receiver get the stream, return -1 if it is no longer a receiver */
+int udpResumeDest(UDPContext *udp, const UDPDest *dst);
+
+/* write data (e.g. an RTSP response) to a TCP socket which may carry interleaved packets */
+int tcpSend(UDPContext *udp, int tcpSocket, const void *data, int len);
+
+/* write one packet interleaved on channel of the TCP receiver tcpSocket, if it is still a receiver and its socket
+ * buffer can take it, otherwise it is dropped */
+int tcpSendInterleaved(UDPContext *udp, int tcpSocket, int channel, const uint8_t *data, int len);
+
+/* send one packet to a single receiver, UDP or interleaved */
+int udpSendToDest(UDPContext *udp, const UDPDest *dst, const uint8_t *data, int len);
+
+/* copy the current receivers into dst (UDP_DEST_MAX entries), return the number of receivers */
+int udpGetDests(UDPContext *udp, UDPDest *dst);
+
+/* send UDP packet to all receivers */
+int udpSend(UDPContext *udp, const uint8_t *data, uint32_t len);
+
+/* send UDP packet gathered from iovcnt buffers (header + payload) to all receivers, without copying */
+int udpSendv(UDPContext *udp, const struct iovec *iov, int iovcnt);
+
+/* send count UDP packets to all receivers, one sendmmsg per receiver and batch, with udp->gso runs of equal-size
+ * packets as one sendmsg segmented by the kernel, return the number of packets sent to the last receiver */
+int udpSendBatch(UDPContext *udp, const UDPPacket *pkts, int count);
 
 #endif  // HISILIVE_NETWORK_H
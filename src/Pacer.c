@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "Pacer.h"
+#include "Utils.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <time.h>
+
+/*
+ * Token bucket between the packetizer and the socket.
+ *
+ * A frame is spread over fraction% of the frame interval: every pacerPush sets the rate so that the
+ * queued bytes drain within that window, but never below twice the average bitrate. Up to PACER_BURST
+ * packets may leave back to back, a 200 KB IDR no longer hits the network as one burst.
+ */
+
+static void pacerUpdateRate(PacerContext *pacer)
+{
+    uint64_t minRate = (uint64_t)pacer->bitRate * 1000 / 8 * 2;
+    uint64_t window = 1000000ULL * pacer->fraction / 100 / pacer->frameRate;  // μs
+    uint64_t rate = (uint64_t)pacer->queuedBytes * 1000000 / (window ? window : 1);
+
+    if (minRate < PACER_SLOT_SIZE)
+        minRate = PACER_SLOT_SIZE;
+    pacer->rate = rate > minRate ? rate : minRate;
+}
+
+static void pacerRefill(PacerContext *pacer, uint64_t now)
+{
+    uint64_t burst = PACER_BURST * PACER_SLOT_SIZE;
+
+    pacer->tokens += pacer->rate * (now - pacer->lastRefill) / 1000000;
+    if (pacer->tokens > burst)
+        pacer->tokens = burst;
+    pacer->lastRefill = now;
+}
+
+static void pacerWait(PacerContext *pacer, uint64_t us)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += (time_t)(us / 1000000);
+    ts.tv_nsec += (long)(us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&pacer->cond, &pacer->lock, &ts);
+}
+
+static void *pacerThread(void *arg)
+{
+    PacerContext *pacer = (PacerContext *)arg;
+    UDPPacket packet[UDP_BATCH_MAX];
+
+    prctl(PR_SET_NAME, "Pacer", 0, 0, 0);
+
+    pthread_mutex_lock(&pacer->lock);
+    while (pacer->running) {
+        uint32_t bytes = 0;
+        int i, count = 0;
+
+        if (pacer->head == pacer->tail) {
+            pthread_cond_wait(&pacer->cond, &pacer->lock);
+            continue;
+        }
+
+        pacerRefill(pacer, getMonotonicTime());
+        while (pacer->head + count != pacer->tail && count < UDP_BATCH_MAX) {
+            PacerSlot *slot = &pacer->slot[(pacer->head + count) % PACER_SLOT_MAX];
+            if (pacer->tokens < (uint64_t)slot->len)
+                break;
+            pacer->tokens -= slot->len;
+            bytes += slot->len;
+            packet[count].iov[0].iov_base = slot->data;
+            packet[count].iov[0].iov_len = (size_t)slot->len;
+            packet[count].iov[1].iov_base = NULL;
+            packet[count].iov[1].iov_len = 0;
+            count++;
+        }
+
+        if (count == 0) {  // sleep until the head packet has enough tokens
+            int len = pacer->slot[pacer->head % PACER_SLOT_MAX].len;
+            pacerWait(pacer, (len - pacer->tokens) * 1000000 / pacer->rate + 1);
+            continue;
+        }
+
+        // the slots in [head, head + count) are not touched by the producer until head moves
+        pthread_mutex_unlock(&pacer->lock);
+        i = udpSendBatch(pacer->udp, packet, count);
+        if (i != count) {
+            LOGE("pacer udpSendBatch error %d/%d\n", i, count);
+        }
+        pthread_mutex_lock(&pacer->lock);
+
+        pacer->head += count;
+        pacer->queuedBytes -= bytes;
+    }
+    pthread_mutex_unlock(&pacer->lock);
+
+    return NULL;
+}
+
+int pacerPush(PacerContext *pacer, const UDPPacket *packet, int count)
+{
+    uint32_t head, tail;
+    int i, queued = 0;
+
+    pthread_mutex_lock(&pacer->lock);
+    head = pacer->head;  // may only grow meanwhile, free space is never overestimated
+    tail = pacer->tail;
+    pthread_mutex_unlock(&pacer->lock);
+
+    // copy outside the lock, the slots after tail belong to the producer
+    for (i = 0; i < count; i++) {
+        PacerSlot *slot = &pacer->slot[(tail + queued) % PACER_SLOT_MAX];
+        size_t len = packet[i].iov[0].iov_len + packet[i].iov[1].iov_len;
+
+        if (tail + queued - head >= PACER_SLOT_MAX || len > PACER_SLOT_SIZE) {
+            pacer->dropped++;
+            continue;
+        }
+        memcpy(slot->data, packet[i].iov[0].iov_base, packet[i].iov[0].iov_len);
+        memcpy(slot->data + packet[i].iov[0].iov_len, packet[i].iov[1].iov_base, packet[i].iov[1].iov_len);
+        slot->len = (int)len;
+        queued++;
+    }
+
+    pthread_mutex_lock(&pacer->lock);
+    for (i = 0; i < queued; i++) {
+        pacer->queuedBytes += pacer->slot[(tail + i) % PACER_SLOT_MAX].len;
+    }
+    pacer->tail = tail + queued;
+    pacerUpdateRate(pacer);
+    pthread_cond_signal(&pacer->cond);
+    pthread_mutex_unlock(&pacer->lock);
+
+    if (queued < count) {
+        LOGE("pacer queue full, drop %d packets, total %u\n", count - queued, pacer->dropped);
+    }
+    return queued;
+}
+
+int pacerStart(PacerContext *pacer)
+{
+    pthread_condattr_t attr;
+
+    if (NULL == pacer || NULL == pacer->udp || pacer->frameRate <= 0 || pacer->fraction <= 0 || pacer->fraction > 100) {
+        LOGE("pacerStart param error.\n");
+        return -1;
+    }
+
+    pacer->head = 0;
+    pacer->tail = 0;
+    pacer->queuedBytes = 0;
+    pacer->tokens = PACER_BURST * PACER_SLOT_SIZE;
+    pacer->lastRefill = getMonotonicTime();
+    pacer->dropped = 0;
+    pacerUpdateRate(pacer);
+
+    pthread_mutex_init(&pacer->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pacer->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pacer->running = 1;
+    if (pthread_create(&pacer->thread, NULL, pacerThread, pacer)) {
+        LOGE("pacer pthread_create error.\n");
+        pacer->running = 0;
+        return -1;
+    }
+
+    LOGD("pacer: frames spread over %d%% of %d ms, min rate %llu B/s\n", pacer->fraction, 1000 / pacer->frameRate,
+         (unsigned long long)pacer->rate);
+    return 0;
+}
+
+void pacerStop(PacerContext *pacer)
+{
+    if (NULL == pacer || !pacer->running)
+        return;
+
+    pthread_mutex_lock(&pacer->lock);
+    pacer->running = 0;
+    pthread_cond_signal(&pacer->cond);
+    pthread_mutex_unlock(&pacer->lock);
+    pthread_join(pacer->thread, NULL);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_PACER_H
+#define HISILIVE_PACER_H
+
+#include "Network.h"
+#include <stdint.h>
+
+#define PACER_SLOT_MAX 512    // queued packets, about 1 s at 4 Mbps
+#define PACER_SLOT_SIZE 1500  // RTP header + FU header + payload
+#define PACER_BURST 4         // packets sent back to back at most
+
+typedef struct {
+    uint8_t data[PACER_SLOT_SIZE];
+    int len;
+} PacerSlot;
+
+typedef struct {
+    UDPContext *udp;
+    int frameRate;  // fps
+    int bitRate;    // kbps
+    int fraction;   // %, a frame is sent within this part of the frame interval
+
+    PacerSlot slot[PACER_SLOT_MAX];
+    uint32_t head;  // next packet to send, advanced by the pacer thread
+    uint32_t tail;  // next free slot, advanced by the producer
+    uint32_t queuedBytes;
+
+    uint64_t rate;    // bytes/s, updated for every frame
+    uint64_t tokens;  // bytes
+    uint64_t lastRefill;
+    uint32_t dropped;  // packets dropped because the queue was full
+
+    int running;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} PacerContext;
+
+/* start the pacer thread, packets queued by pacerPush are sent to udp */
+int pacerStart(PacerContext *pacer);
+
+/* stop the pacer thread, queued packets are dropped */
+void pacerStop(PacerContext *pacer);
+
+/* copy count packets into the queue, never blocks; return the number queued */
+int pacerPush(PacerContext *pacer, const UDPPacket *packet, int count);
+
+#endif  // HISILIVE_PACER_H
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "PreRoll.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int preRollInit(PreRoll *pre)
+{
+    uint32_t frames;
+
+    if (NULL == pre || pre->size == 0 || pre->duration == 0 || pre->frameRate == 0) {
+        LOGE("preRollInit param error.\n");
+        return -1;
+    }
+
+    frames = (pre->duration + PREROLL_GOP_MAX) * pre->frameRate;
+    for (pre->frameMax = 1; pre->frameMax < frames; pre->frameMax <<= 1)
+        ;
+    pre->data = (uint8_t *)malloc(pre->size);
+    pre->frame = (PreRollFrame *)malloc(pre->frameMax * sizeof(PreRollFrame));
+    if (NULL == pre->data || NULL == pre->frame) {
+        LOGE("preRollInit malloc %u + %u frames error.\n", pre->size, pre->frameMax);
+        preRollDestroy(pre);
+        return -1;
+    }
+    pre->head = pre->tail = 0;
+    pre->readPos = pre->writePos = 0;
+    pre->evicted = 0;
+    pre->overflow = 0;
+
+    return 0;
+}
+
+void preRollDestroy(PreRoll *pre)
+{
+    if (pre) {
+        free(pre->data);
+        free(pre->frame);
+        pre->data = NULL;
+        pre->frame = NULL;
+    }
+}
+
+/* drop the oldest frame and the rest of its GOP, return the number of frames; the ring must not be empty */
+static uint32_t preRollEvictGOP(PreRoll *pre)
+{
+    uint32_t n = 0;
+
+    do {
+        pre->readPos = pre->frame[pre->head % pre->frameMax].end;
+        pre->head++;
+        n++;
+    } while (pre->head != pre->tail && !pre->frame[pre->head % pre->frameMax].keyFrame);
+
+    return n;
+}
+
+void preRollPush(PreRoll *pre, const MediaFrame *frame)
+{
+    PreRollFrame *f;
+    uint32_t len = 0, offset, pad, i;
+    uint8_t *dst;
+
+    for (i = 0; i < (uint32_t)frame->packCount; i++) {
+        len += frame->packs[i].len;
+    }
+
+    if (len > pre->size) {  // not even one frame fits, start again at the next IDR
+        pre->evicted += pre->tail - pre->head;
+        pre->head = pre->tail;
+        pre->readPos = pre->writePos;
+        return;
+    }
+
+    for (;;) {
+        offset = (uint32_t)(pre->writePos % pre->size);
+        pad = offset + len > pre->size ? pre->size - offset : 0;  // a frame is contiguous
+        if (pre->head == pre->tail) {  // empty, e.g. after preRollFlush: nothing to evict
+            if (!frame->keyFrame)
+                return;  // its IDR is gone or not seen yet
+            pre->writePos += pad;  // start over at the beginning of the buffer, where any frame fits
+            pre->readPos = pre->writePos;
+            pad = 0;
+            break;
+        }
+        if (pre->tail - pre->head >= pre->frameMax) {
+            pre->overflow += preRollEvictGOP(pre);
+            continue;
+        }
+        if (pre->writePos + pad + len - pre->readPos <= pre->size)
+            break;
+        pre->evicted += preRollEvictGOP(pre);
+    }
+
+    f = &pre->frame[pre->tail % pre->frameMax];
+    f->offset = (uint32_t)((pre->writePos + pad) % pre->size);
+    f->len = len;
+    f->end = pre->writePos + pad + len;
+    f->pts = frame->pts;
+    f->keyFrame = frame->keyFrame;
+    dst = pre->data + f->offset;
+    for (i = 0; i < (uint32_t)frame->packCount; i++) {
+        memcpy(dst, frame->packs[i].data, frame->packs[i].len);
+        dst += frame->packs[i].len;
+    }
+    pre->writePos = f->end;
+    pre->tail++;
+
+    // keep only the GOPs needed to cover duration seconds before this frame
+    for (;;) {
+        for (i = pre->head + 1; i != pre->tail && !pre->frame[i % pre->frameMax].keyFrame; i++)
+            ;
+        if (i == pre->tail || frame->pts - pre->frame[i % pre->frameMax].pts < (uint64_t)pre->duration * 1000000)
+            break;
+        preRollEvictGOP(pre);
+    }
+}
+
+void preRollFlush(PreRoll *pre, PreRollFrameFunc func, void *arg)
+{
+    PreRollFrame *f;
+    MediaPack pack;
+    MediaFrame frame;
+
+    for (; pre->head != pre->tail; pre->head++) {
+        f = &pre->frame[pre->head % pre->frameMax];
+        pack.data = pre->data + f->offset;
+        pack.len = f->len;
+        pack.nalType = -1;
+        pack.nalCount = 0;  // several NALs
+        frame.packs = &pack;
+        frame.packCount = 1;
+        frame.pts = f->pts;
+        frame.keyFrame = f->keyFrame;
+        frame.reference = 1;
+        frame.readTime = 0;
+        func(arg, &frame);
+    }
+    pre->readPos = pre->writePos;
+}
+
+int preRollDuration(PreRoll *pre)
+{
+    if (pre->head == pre->tail)
+        return 0;
+    return (int)((pre->frame[(pre->tail - 1) % pre->frameMax].pts - pre->frame[pre->head % pre->frameMax].pts) / 1000000);
+}
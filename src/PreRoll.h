@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_PREROLL_H
+#define HISILIVE_PREROLL_H
+
+#include "Media.h"
+#include <stdint.h>
+
+#define PREROLL_GOP_MAX 2  // s, the frame ring holds duration plus this, the oldest GOP starts before duration
+
+typedef struct {
+    uint64_t end;  // byte position after the frame, free running
+    uint32_t offset;
+    uint32_t len;
+    uint64_t pts;
+    int keyFrame;
+} PreRollFrame;
+
+/*
+ * The last duration seconds of the stream, GOP aligned: the oldest frame is always an IDR with its
+ * parameter sets, frames are evicted one GOP at a time. Frame data lives in one buffer of exactly size
+ * bytes, a frame is contiguous. Used by a single thread.
+ */
+typedef struct {
+    uint32_t size;       // bytes, the memory cap
+    uint32_t duration;   // s
+    uint32_t frameRate;  // fps, sizes the frame ring
+
+    uint8_t *data;
+    PreRollFrame *frame;
+    uint32_t frameMax;  // frames in the ring, a power of 2 so the free running indexes wrap cleanly
+    uint32_t head;      // oldest frame
+    uint32_t tail;      // after the newest
+    uint64_t readPos;
+    uint64_t writePos;
+    uint32_t evicted;   // frames evicted for the memory cap
+    uint32_t overflow;  // frames evicted because the frame ring was full, GOPs longer than PREROLL_GOP_MAX
+} PreRoll;
+
+typedef void (*PreRollFrameFunc)(void *arg, const MediaFrame *frame);
+
+int preRollInit(PreRoll *pre);
+
+void preRollDestroy(PreRoll *pre);
+
+/* copy a frame in, evicting old GOPs; frames before the first IDR are ignored */
+void preRollPush(PreRoll *pre, const MediaFrame *frame);
+
+/* pass every buffered frame, oldest first, as a single pack each; the ring is empty afterwards */
+void preRollFlush(PreRoll *pre, PreRollFrameFunc func, void *arg);
+
+/* buffered seconds */
+int preRollDuration(PreRoll *pre);
+
+#endif  // HISILIVE_PREROLL_H
@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "RTCP.h"
+#include "Utils.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/*
+ * Sender Report, RFC 3550 6.4.1
+ *
+ *  0                   1                   2                   3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |V=2|P|    RC   |   PT=SR=200   |             length            |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                         SSRC of sender                        |
+ * +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+ * |              NTP timestamp, most significant word             |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |             NTP timestamp, least significant word             |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                         RTP timestamp                         |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                     sender's packet count                     |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                      sender's octet count                     |
+ * +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+ *
+ * Report block, in RR (after the reporter SSRC) and SR (after the sender info)
+ *
+ * +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+ * |                 SSRC_1 (SSRC of first source)                 |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * | fraction lost |       cumulative number of packets lost       |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |           extended highest sequence number received           |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                      interarrival jitter                      |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                         last SR (LSR)                         |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                   delay since last SR (DLSR)                  |
+ * +=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+=+
+ */
+
+static uint32_t rtcpRead32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// wall clock in NTP format, 32.32 fixed point
+static uint64_t rtcpNTPTime(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((uint64_t)(tv.tv_sec + NTP_OFFSET) << 32) | (((uint64_t)tv.tv_usec << 32) / 1000000);
+}
+
+// SR + SDES CNAME (+ BYE), a compound packet starts with SR, RFC 3550 6.1
+static int rtcpBuildReport(RTCPContext *ctx, uint8_t *buf, int bye)
+{
+    RTPMuxContext *rtp = ctx->rtp;
+    uint64_t ntp = rtcpNTPTime();
+    uint64_t now = getMonotonicTime();
+    uint64_t sentTime;
+    uint32_t rtpTime;
+    char cname[64] = "hisilive@";
+    uint8_t *p = buf;
+    int cnameLen, sdesLen;
+
+    // the RTP timestamp of "now", from the last frame sent
+    if (rtpGetSentFrame(rtp, &rtpTime, &sentTime) == 0 && now > sentTime)
+        rtpTime += (uint32_t)((now - sentTime) / 100 * 9);  // μs -> 90kHz
+
+    p = Load8(p, 0x80);  // V=2, RC=0
+    p = Load8(p, RTCP_SR);
+    p = Load16(p, 6);
+    p = Load32(p, rtp->ssrc);
+    p = Load32(p, (uint32_t)(ntp >> 32));
+    p = Load32(p, (uint32_t)ntp);
+    p = Load32(p, rtpTime);
+    p = Load32(p, __atomic_load_n(&rtp->sentPackets, __ATOMIC_RELAXED));
+    p = Load32(p, __atomic_load_n(&rtp->sentOctets, __ATOMIC_RELAXED));
+
+    gethostname(cname + strlen(cname), sizeof(cname) - strlen(cname) - 1);
+    cname[sizeof(cname) - 1] = '\0';
+    cnameLen = (int)strlen(cname);
+    sdesLen = (4 + 2 + cnameLen + 1 + 3) / 4;  // SSRC, CNAME item, END, padded to 32 bits
+    p = Load8(p, 0x81);                        // V=2, SC=1
+    p = Load8(p, RTCP_SDES);
+    p = Load16(p, (uint16_t)sdesLen);
+    p = Load32(p, rtp->ssrc);
+    p = Load8(p, 1);  // CNAME
+    p = Load8(p, (uint8_t)cnameLen);
+    memcpy(p, cname, cnameLen);
+    p += cnameLen;
+    memset(p, 0, sdesLen * 4 - (4 + 2 + cnameLen));  // END and padding, after the SSRC and the CNAME item
+    p += sdesLen * 4 - (4 + 2 + cnameLen);
+
+    if (bye) {
+        p = Load8(p, 0x81);  // V=2, SC=1
+        p = Load8(p, RTCP_BYE);
+        p = Load16(p, 1);
+        p = Load32(p, rtp->ssrc);
+    }
+
+    return (int)(p - buf);
+}
+
+static void rtcpSendReport(RTCPContext *ctx, int bye)
+{
+    uint8_t buf[RTCP_PACKET_MAX];
+    UDPDest dst[UDP_DEST_MAX];
+    int i, len, count;
+
+    len = rtcpBuildReport(ctx, buf, bye);
+    count = udpGetDests(ctx->udp, dst);
+    for (i = 0; i < count; i++) {
+        if (dst[i].tcpSocket >= 0) {
+            tcpSendInterleaved(ctx->udp, dst[i].tcpSocket, dst[i].channel + 1, buf, len);
+        } else {
+            struct sockaddr_in addr = dst[i].addr;
+            addr.sin_port = htons((uint16_t)dst[i].rtcpPort);
+            if (sendto(ctx->socket, buf, len, 0, (struct sockaddr *)&addr, sizeof(addr)) != len) {
+                LOGE("rtcp sendto %s:%d %s\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port), strerror(errno));
+            }
+        }
+    }
+}
+
+static RTCPReceiverStats *rtcpGetReceiver(RTCPContext *ctx, uint32_t ssrc, const UDPDest *from)
+{
+    RTCPReceiverStats *r = NULL;
+    int i;
+
+    for (i = 0; i < ctx->receiverCount; i++) {
+        if (ctx->receiver[i].ssrc == ssrc)
+            return &ctx->receiver[i];
+    }
+
+    if (ctx->receiverCount < RTCP_RECEIVER_MAX) {
+        r = &ctx->receiver[ctx->receiverCount++];
+    } else {  // replace the receiver silent for the longest time
+        r = &ctx->receiver[0];
+        for (i = 1; i < ctx->receiverCount; i++) {
+            if (ctx->receiver[i].lastReport < r->lastReport)
+                r = &ctx->receiver[i];
+        }
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->ssrc = ssrc;
+    r->rtt = -1;
+    if (from)
+        r->addr = from->addr;
+    LOGD("rtcp receiver %08X from %s:%d\n", ssrc, inet_ntoa(r->addr.sin_addr), ntohs(r->addr.sin_port));
+
+    return r;
+}
+
+static void rtcpRemoveReceiver(RTCPContext *ctx, uint32_t ssrc)
+{
+    int i;
+
+    for (i = 0; i < ctx->receiverCount; i++) {
+        if (ctx->receiver[i].ssrc == ssrc) {
+            LOGD("rtcp receiver %08X bye\n", ssrc);
+            ctx->receiver[i] = ctx->receiver[--ctx->receiverCount];
+            return;
+        }
+    }
+}
+
+// report blocks about our stream from receiver ssrc
+static void rtcpHandleReportBlocks(RTCPContext *ctx, uint32_t ssrc, const uint8_t *p, int count, const UDPDest *from)
+{
+    uint64_t now = getMonotonicTime();
+    uint32_t a = (uint32_t)(rtcpNTPTime() >> 16);  // middle 32 bits, the LSR/DLSR unit is 1/65536 s
+    int i;
+
+    for (i = 0; i < count; i++, p += 24) {
+        RTCPReceiverStats *r;
+        uint32_t lsr, dlsr;
+        int32_t lost;
+
+        if (rtcpRead32(p) != ctx->rtp->ssrc)
+            continue;
+
+        lost = (int32_t)(rtcpRead32(p + 4) & 0xFFFFFF);
+        if (lost & 0x800000)  // 24 bits signed
+            lost -= 0x1000000;
+        lsr = rtcpRead32(p + 16);
+        dlsr = rtcpRead32(p + 20);
+
+        pthread_mutex_lock(&ctx->lock);
+        r = rtcpGetReceiver(ctx, ssrc, from);
+        r->fractionLost = p[4];
+        r->cumulativeLost = lost;
+        r->highestSeq = rtcpRead32(p + 8);
+        r->jitter = rtcpRead32(p + 12);
+        if (lsr) {  // RTT = A - LSR - DLSR, RFC 3550 6.4.1
+            int32_t rtt = (int32_t)(a - lsr - dlsr);
+            r->rtt = rtt > 0 ? (int32_t)(((int64_t)rtt * 1000000) >> 16) : 0;
+        }
+        r->lastReport = now;
+        if (from)
+            r->addr = from->addr;
+        pthread_mutex_unlock(&ctx->lock);
+    }
+}
+
+/*
+ * Generic NACK, RFC 4585 6.2.1, FMT=1 in a RTPFB packet (PT=205)
+ *
+ *  0                   1                   2                   3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |V=2|P|  FMT=1  |   PT=205      |          length               |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                  SSRC of packet sender                        |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                  SSRC of media source                         |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |            PID                |             BLP               |  one or more
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * PID is a lost packet, bit i of BLP set means PID + i + 1 is lost too
+ */
+static void rtcpHandleNACK(RTCPContext *ctx, const uint8_t *p, int size, const UDPDest *from)
+{
+    uint16_t seq[17 * 16];
+    int i, n = 0;
+
+    if (NULL == ctx->rtp->history || NULL == from || size < 12 || rtcpRead32(p + 8) != ctx->rtp->ssrc)
+        return;
+
+    for (p += 12, size -= 12; size >= 4 && n + 17 <= (int)(sizeof(seq) / sizeof(seq[0])); p += 4, size -= 4) {
+        uint16_t pid = (uint16_t)((p[0] << 8) | p[1]);
+        uint16_t blp = (uint16_t)((p[2] << 8) | p[3]);
+        seq[n++] = pid;
+        for (i = 0; i < 16; i++) {
+            if (blp & (1 << i))
+                seq[n++] = (uint16_t)(pid + i + 1);
+        }
+    }
+
+    retransmitResend(ctx->rtp->history, ctx->udp, from, seq, n);
+}
+
+int rtcpHandlePacket(RTCPContext *ctx, const uint8_t *buf, int len, const UDPDest *from)
+{
+    if (NULL == ctx || NULL == buf)
+        return -1;
+
+    while (len >= 4) {
+        int count = buf[0] & 0x1F;
+        int pt = buf[1];
+        int size = (((buf[2] << 8) | buf[3]) + 1) * 4;
+
+        if ((buf[0] >> 6) != 2 || size > len) {
+            LOGE("rtcp invalid packet, %d bytes left\n", len);
+            return -1;
+        }
+
+        if (pt == RTCP_RR && size >= 8 + count * 24) {
+            rtcpHandleReportBlocks(ctx, rtcpRead32(buf + 4), buf + 8, count, from);
+        } else if (pt == RTCP_SR && size >= 28 + count * 24) {
+            rtcpHandleReportBlocks(ctx, rtcpRead32(buf + 4), buf + 28, count, from);
+        } else if (pt == RTCP_RTPFB && count == 1) {  // count is FMT here
+            rtcpHandleNACK(ctx, buf, size, from);
+        } else if (pt == RTCP_BYE) {
+            int i;
+            pthread_mutex_lock(&ctx->lock);
+            for (i = 0; i < count && 4 + i * 4 + 4 <= size; i++) {
+                rtcpRemoveReceiver(ctx, rtcpRead32(buf + 4 + i * 4));
+            }
+            pthread_mutex_unlock(&ctx->lock);
+        }
+
+        buf += size;
+        len -= size;
+    }
+
+    return 0;
+}
+
+int rtcpGetStats(RTCPContext *ctx, RTCPReceiverStats *stats, int max)
+{
+    int count;
+
+    pthread_mutex_lock(&ctx->lock);
+    count = ctx->receiverCount < max ? ctx->receiverCount : max;
+    memcpy(stats, ctx->receiver, count * sizeof(RTCPReceiverStats));
+    pthread_mutex_unlock(&ctx->lock);
+
+    return count;
+}
+
+// the UDP receiver whose RTCP comes from addr (its RTCP port), NULL if it is not a receiver
+static const UDPDest *rtcpFindDest(RTCPContext *ctx, const struct sockaddr_in *addr, UDPDest *dst)
+{
+    UDPDest all[UDP_DEST_MAX];
+    int i, count = udpGetDests(ctx->udp, all);
+
+    for (i = 0; i < count; i++) {
+        if (all[i].tcpSocket < 0 && all[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            all[i].rtcpPort == ntohs(addr->sin_port)) {
+            *dst = all[i];
+            return dst;
+        }
+    }
+
+    return NULL;
+}
+
+static void *rtcpThread(void *arg)
+{
+    RTCPContext *ctx = (RTCPContext *)arg;
+    uint8_t buf[RTCP_PACKET_MAX];
+    UDPDest dst;
+    uint64_t next = getMonotonicTime();
+    struct timeval tv;
+    fd_set fds;
+    int res;
+
+    prctl(PR_SET_NAME, "RTCP", 0, 0, 0);
+
+    while (ctx->running) {
+        uint64_t now = getMonotonicTime();
+
+        if (now >= next) {
+            uint32_t timestamp;
+            uint64_t sentTime;
+            if (rtpGetSentFrame(ctx->rtp, &timestamp, &sentTime) == 0)  // nothing to report before the first frame
+                rtcpSendReport(ctx, 0);
+            // randomized in [0.5, 1.5] x interval, RFC 3550 6.3.1
+            next = now + (uint64_t)ctx->interval * (500 + rand() % 1000);
+            continue;
+        }
+
+        FD_ZERO(&fds);
+        FD_SET(ctx->socket, &fds);
+        tv.tv_sec = (next - now) / 1000000;
+        tv.tv_usec = (next - now) % 1000000;
+        if (tv.tv_sec > 0) {  // check running at least once a second
+            tv.tv_sec = 1;
+            tv.tv_usec = 0;
+        }
+        res = select(ctx->socket + 1, &fds, NULL, NULL, &tv);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("rtcp select %s\n", strerror(errno));
+            break;
+        }
+
+        if (res > 0 && FD_ISSET(ctx->socket, &fds)) {
+            struct sockaddr_in from;
+            socklen_t fromLen = sizeof(from);
+            int n = (int)recvfrom(ctx->socket, buf, sizeof(buf), 0, (struct sockaddr *)&from, &fromLen);
+            if (n > 0)
+                rtcpHandlePacket(ctx, buf, n, rtcpFindDest(ctx, &from, &dst));
+        }
+    }
+
+    return NULL;
+}
+
+int rtcpStart(RTCPContext *ctx)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+
+    if (NULL == ctx || NULL == ctx->rtp || NULL == ctx->udp) {
+        LOGE("rtcpStart param error.\n");
+        return -1;
+    }
+
+    if (ctx->interval <= 0)
+        ctx->interval = RTCP_INTERVAL;
+
+    ctx->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (ctx->socket < 0) {
+        LOGE("rtcp socket error.\n");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)(ctx->udp->localPort + 1));
+    if (bind(ctx->socket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOGE("rtcp bind port %d error. %s\n", ctx->udp->localPort + 1, strerror(errno));
+        addr.sin_port = 0;
+        if (bind(ctx->socket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(ctx->socket);
+            return -1;
+        }
+    }
+    getsockname(ctx->socket, (struct sockaddr *)&addr, &addrLen);
+    ctx->port = ntohs(addr.sin_port);
+
+    pthread_mutex_init(&ctx->lock, NULL);
+    ctx->receiverCount = 0;
+    ctx->running = 1;
+    if (pthread_create(&ctx->thread, NULL, rtcpThread, ctx)) {
+        LOGE("rtcp pthread_create error.\n");
+        ctx->running = 0;
+        close(ctx->socket);
+        return -1;
+    }
+
+    LOGD("RTCP on port %d, SSRC %08X\n", ctx->port, ctx->rtp->ssrc);
+    return 0;
+}
+
+void rtcpStop(RTCPContext *ctx)
+{
+    if (NULL == ctx || !ctx->running)
+        return;
+
+    ctx->running = 0;
+    pthread_join(ctx->thread, NULL);
+    rtcpSendReport(ctx, 1);
+    close(ctx->socket);
+    pthread_mutex_destroy(&ctx->lock);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_RTCP_H
+#define HISILIVE_RTCP_H
+
+#include "Network.h"
+#include "RTP.h"
+
+#define RTCP_SR 200
+#define RTCP_RR 201
+#define RTCP_SDES 202
+#define RTCP_BYE 203
+#define RTCP_RTPFB 205  // transport layer feedback, RFC 4585
+
+#define NTP_OFFSET 2208988800UL  // seconds from 1900 to 1970, of the NTP timestamp in sender reports
+
+#define RTCP_INTERVAL 5000    // ms, between sender reports
+#define RTCP_PACKET_MAX 1500
+#define RTCP_RECEIVER_MAX 16
+
+typedef struct {
+    uint32_t ssrc;            // reporter
+    struct sockaddr_in addr;  // RTP address of the receiver, the RTSP connection for interleaved
+    uint8_t fractionLost;     // of 256, since the previous report
+    int32_t cumulativeLost;
+    uint32_t highestSeq;  // extended highest sequence number received
+    uint32_t jitter;      // interarrival jitter, RTP timestamp units
+    int32_t rtt;          // μs, -1 until the receiver echoes a sender report
+    uint64_t lastReport;  // monotonic μs
+} RTCPReceiverStats;
+
+typedef struct {
+    RTPMuxContext *rtp;  // SSRC, timestamp and counters of the stream
+    UDPContext *udp;     // receivers, RTCP goes to their RTCP port or interleaved channel + 1
+    int interval;        // ms, RTCP_INTERVAL if 0
+
+    int socket;  // bound to udp->localPort + 1, or any port if that is taken
+    int port;    // bound port
+    int running;
+    pthread_t thread;
+
+    pthread_mutex_t lock;  // protects receiver
+    RTCPReceiverStats receiver[RTCP_RECEIVER_MAX];
+    int receiverCount;
+} RTCPContext;
+
+/* bind the RTCP socket and start sending sender reports in a thread */
+int rtcpStart(RTCPContext *ctx);
+
+/* send BYE and stop the thread */
+void rtcpStop(RTCPContext *ctx);
+
+/* parse a compound RTCP packet from receiver from (NULL if unknown), e.g. one received interleaved in RTSP;
+   NACKed packets are resent to from */
+int rtcpHandlePacket(RTCPContext *ctx, const uint8_t *buf, int len, const UDPDest *from);
+
+/* copy the stats of up to max receivers, return the number copied */
+int rtcpGetStats(RTCPContext *ctx, RTCPReceiverStats *stats, int max);
+
+#endif  // HISILIVE_RTCP_H
@@ -13,26 +13,111 @@
 #include <string.h>
 #include <unistd.h>
 
-#define RTP_VERSION 2
-#define RTP_H264 96
-
-static UDPContext *gUdpContext;
+typedef void (*RTPSendNALFunc)(RTPMuxContext *ctx, const uint8_t *nal, int size, int last);
 
 int initRTPMuxContext(RTPMuxContext *ctx)
 {
     ctx->seq = 0;
     ctx->timestamp = 0;
-    ctx->ssrc = 0x12345678;  // random number
+    ctx->ssrc = getRandom32();  // random number, RFC 3550 8.1
     ctx->aggregation = 0;    // 1 use Aggregation Unit, 0 Single NALU Unit， default 0.
     ctx->buf_ptr = ctx->buf;
+    ctx->bufPending = 0;
     ctx->payload_type = 0;  // 0, H.264/AVC; 1, HEVC/H.265
+    ctx->packetCount = 0;
+    ctx->batchSize = RTP_BATCH_MAX;
+    ctx->pacer = NULL;
+    ctx->history = NULL;
+    ctx->fec = NULL;
+    ctx->gop = NULL;
+    ctx->keyFrame = 0;
+    ctx->udp = NULL;
+    pthread_mutex_init(&ctx->lock, NULL);
+    memset(ctx->paramSetLen, 0, sizeof(ctx->paramSetLen));
+    ctx->sentPackets = 0;
+    ctx->sentOctets = 0;
+    ctx->sentTime = 0;
+    ctx->sentSeq = 0;
+    ctx->sentTimestamp = 0;
+    ctx->sentFrameTime = 0;
     return 0;
 }
 
-// enc RTP packet
-void rtpSendData(RTPMuxContext *ctx, const uint8_t *buf, int len, int mark)
+static void rtpSendPackets(RTPMuxContext *ctx, const UDPPacket *packet, int count)
+{
+    int res;
+
+    if (0 == ctx->firstSendTime) {
+        ctx->firstSendTime = getMonotonicTime();
+    }
+    if (ctx->pacer) {  // copied, the payloads may be released after this
+        pacerPush(ctx->pacer, packet, count);
+    } else {
+        res = udpSendBatch(ctx->udp, packet, count);
+        if (res != count) {
+            LOGE("udpSendBatch error %d/%d\n", res, count);
+        }
+    }
+}
+
+// FEC packets are sent in the media stream: its SSRC, the next sequence numbers
+static void rtpSendFEC(RTPMuxContext *ctx, UDPPacket *packet, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        uint8_t *header = (uint8_t *)packet[i].iov[0].iov_base;
+        Load16(&header[2], (uint16_t)ctx->seq);
+        Load32(&header[8], ctx->ssrc);
+        ctx->seq = (ctx->seq + 1) & 0xffff;
+        __atomic_store_n(&ctx->sentPackets, ctx->sentPackets + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&ctx->sentOctets, ctx->sentOctets + (uint32_t)(packet[i].iov[0].iov_len - RTP_HEADER_SIZE),
+                         __ATOMIC_RELAXED);
+    }
+
+    // a receiver sees no gap in the sequence numbers, neither after a NACK nor in a GOP burst
+    if (ctx->history) {
+        retransmitSave(ctx->history, packet, count);
+    }
+    if (ctx->gop) {
+        gopCacheSave(ctx->gop, packet, count);
+    }
+    rtpSendPackets(ctx, packet, count);
+}
+
+void rtpFlush(RTPMuxContext *ctx)
+{
+    int count;
+
+    if (ctx->packetCount == 0)
+        return;
+
+    if (ctx->history) {
+        retransmitSave(ctx->history, ctx->packet, ctx->packetCount);
+    }
+
+    if (ctx->gop) {  // before sending, a receiver going live misses none of them
+        gopCacheSave(ctx->gop, ctx->packet, ctx->packetCount);
+    }
+
+    rtpSendPackets(ctx, ctx->packet, ctx->packetCount);
+
+    if (ctx->fec) {
+        count = fecProtect(ctx->fec, ctx->packet, ctx->packetCount, ctx->keyFrame);
+        if (count > 0) {
+            rtpSendFEC(ctx, ctx->fec->packet, count);
+        }
+    }
+
+    ctx->packetCount = 0;
+    ctx->bufPending = 0;
+}
+
+// enc RTP packet, the header (RTP header + FU indicator/header) is built in ctx->header,
+// the payload is referenced in place and queued until rtpFlush
+static void rtpSendData(RTPMuxContext *ctx, const uint8_t *fu, int fuLen, const uint8_t *buf, int len, int mark)
 {
-    int res = 0;
+    UDPPacket *pkt;
     /* build the RTP header */
     /*
      *
@@ -51,38 +136,45 @@ void rtpSendData(RTPMuxContext *ctx, const uint8_t *buf, int len, int mark)
      *
      **/
 
-    uint8_t *pos = ctx->cache;
+    uint8_t *pos = ctx->header[ctx->packetCount];
     pos[0] = (RTP_VERSION << 6) & 0xff;                            // V P X CC
     pos[1] = (uint8_t)((RTP_H264 & 0x7f) | ((mark & 0x01) << 7));  // M PayloadType
     Load16(&pos[2], (uint16_t)ctx->seq);                           // Sequence number
     Load32(&pos[4], ctx->timestamp);
     Load32(&pos[8], ctx->ssrc);
 
-    /* copy av data */
-    memcpy(&pos[12], buf, len);
+    /* FU indicator & FU header follow the RTP header */
+    if (fuLen > 0) {
+        memcpy(&pos[RTP_HEADER_SIZE], fu, fuLen);
+    }
+
+    pkt = &ctx->packet[ctx->packetCount];
+    pkt->iov[0].iov_base = pos;
+    pkt->iov[0].iov_len = (size_t)(RTP_HEADER_SIZE + fuLen);
+    pkt->iov[1].iov_base = (void *)buf;
+    pkt->iov[1].iov_len = (size_t)len;
 
-    res = udpSend(gUdpContext, ctx->cache, (uint32_t)(len + 12));
-    if (res <= 0) {
-        LOGE("udpSend error %d\n", res);
+    if (buf == ctx->buf) {
+        ctx->bufPending = 1;
     }
-    // LOG("\n rtpSendData cache [%d]: ", res);
-    // for (int i = 0; i < 4; ++i) {
-    //     LOG("%.2X ", ctx->cache[i]);
-    // }
-    // LOG(" timestamp %d\n", ctx->timestamp);
 
-    memset(ctx->cache, 0, RTP_PAYLOAD_MAX + 10);
-    ctx->buf_ptr = ctx->buf;  // restore buf_ptr
+    // only this thread writes them, the RTCP and metrics threads read them
+    __atomic_store_n(&ctx->sentPackets, ctx->sentPackets + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->sentOctets, ctx->sentOctets + (uint32_t)(fuLen + len), __ATOMIC_RELAXED);
+
     ctx->seq = (ctx->seq + 1) & 0xffff;
+    if (++ctx->packetCount >= ctx->batchSize) {
+        rtpFlush(ctx);
+    }
 }
 
-// 拼接NAL头部 在 ctx->buff, 然后ff_rtp_send_data
-static void rtpSendNAL(RTPMuxContext *ctx, const uint8_t *nal, int size, int last)
+// H.264 (RFC 6184): 拼接NAL头部 (STAP-A 在 ctx->buf, FU-A 在 RTP 头之后), 然后 rtpSendData
+static void rtpSendNALH264(RTPMuxContext *ctx, const uint8_t *nal, int size, int last)
 {
     // Single NAL Packet or Aggregation Packets
     if (size <= RTP_PAYLOAD_MAX) {
-        // Aggregation Packets
-        if (ctx->aggregation) {
+        // Aggregation Packets, STAP-A NAL HDR + NALU Size + NALU must fit in one packet
+        if (ctx->aggregation && size + 3 <= RTP_PAYLOAD_MAX) {
             /*
              *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
              *  |STAP-A NAL HDR | NALU 1 Size | NALU 1 HDR & Data | NALU 2 Size | NALU 2 HDR & Data | ... |
@@ -94,7 +186,8 @@ static void rtpSendNAL(RTPMuxContext *ctx, const uint8_t *nal, int size, int las
 
             // The remaining space in ctx->buf is less than the required space
             if (buffered_size + 2 + size > RTP_PAYLOAD_MAX) {
-                rtpSendData(ctx, ctx->buf, buffered_size, 0);
+                rtpSendData(ctx, NULL, 0, ctx->buf, buffered_size, 0);
+                ctx->buf_ptr = ctx->buf;  // restore buf_ptr
                 buffered_size = 0;
             }
 
@@ -107,6 +200,9 @@ static void rtpSendNAL(RTPMuxContext *ctx, const uint8_t *nal, int size, int las
              *     +---------------+
              * */
             if (buffered_size == 0) {
+                if (ctx->bufPending) {  // previous STAP-A still queued in buf
+                    rtpFlush(ctx);
+                }
                 *ctx->buf_ptr++ = (uint8_t)(24 | curNRI);  // 0x18
             } else {
                 uint8_t lastNRI = (uint8_t)(ctx->buf[0] & 0x60);
@@ -126,7 +222,8 @@ static void rtpSendNAL(RTPMuxContext *ctx, const uint8_t *nal, int size, int las
 
             // meet last NAL, send all buf
             if (last == 1) {
-                rtpSendData(ctx, ctx->buf, (int)(ctx->buf_ptr - ctx->buf), 1);
+                rtpSendData(ctx, NULL, 0, ctx->buf, (int)(ctx->buf_ptr - ctx->buf), 1);
+                ctx->buf_ptr = ctx->buf;  // restore buf_ptr
             }
         }
         // Single NAL Unit RTP Packet
@@ -137,7 +234,11 @@ static void rtpSendNAL(RTPMuxContext *ctx, const uint8_t *nal, int size, int las
              *  |F|NRI|  Type   | a single NAL unit ... |
              *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
              * */
-            rtpSendData(ctx, nal, size, last);
+            if (ctx->buf_ptr > ctx->buf) {  // the pending STAP-A goes first, NALs keep their order
+                rtpSendData(ctx, NULL, 0, ctx->buf, (int)(ctx->buf_ptr - ctx->buf), 0);
+                ctx->buf_ptr = ctx->buf;  // restore buf_ptr
+            }
+            rtpSendData(ctx, NULL, 0, nal, size, last);
         }
 
     } else {  // 分片分组
@@ -153,12 +254,12 @@ static void rtpSendNAL(RTPMuxContext *ctx, const uint8_t *nal, int size, int las
         if (ctx->buf_ptr > ctx->buf) {
             // if (ctx->buf_ptr < ctx->buf + 10000)
             LOGE("send left data %d", ctx->buf_ptr > ctx->buf);
-            rtpSendData(ctx, ctx->buf, (int)(ctx->buf_ptr - ctx->buf), 0);
+            rtpSendData(ctx, NULL, 0, ctx->buf, (int)(ctx->buf_ptr - ctx->buf), 0);
             ctx->buf_ptr = ctx->buf;  // restore buf_ptr
         }
 
         int headerSize;
-        uint8_t *buff = ctx->buf;
+        uint8_t buff[2];
         uint8_t type = nal[0] & 0x1F;
         uint8_t nri = nal[0] & 0x60;
 
@@ -186,29 +287,185 @@ static void rtpSendNAL(RTPMuxContext *ctx, const uint8_t *nal, int size, int las
         nal += 1;
 
         while (size + headerSize > RTP_PAYLOAD_MAX) {
-            memcpy(&buff[headerSize], nal, (size_t)(RTP_PAYLOAD_MAX - headerSize));
-            rtpSendData(ctx, buff, RTP_PAYLOAD_MAX, 0);
+            rtpSendData(ctx, buff, headerSize, nal, RTP_PAYLOAD_MAX - headerSize, 0);
             nal += RTP_PAYLOAD_MAX - headerSize;
             size -= RTP_PAYLOAD_MAX - headerSize;
             buff[1] &= ~(1 << 7);  // buff[1] & 0111111, S(tart) = 0
         }
         buff[1] |= 1 << 6;  // buff[1] | 01000000, E(nd) = 1
-        memcpy(&buff[headerSize], nal, size);
-        rtpSendData(ctx, buff, size + headerSize, last);
+        rtpSendData(ctx, buff, headerSize, nal, size, last);
     }
 }
 
-// 从一段H264流中，查询完整的NAL发送，直到发送完此流中的所有NAL
-void rtpSendH264HEVC(RTPMuxContext *ctx, UDPContext *udp, const uint8_t *buf, int size)
+// HEVC (RFC 7798): 拼接 PayloadHdr (AP 在 ctx->buf, FU 在 RTP 头之后), 然后 rtpSendData
+static void rtpSendNALHEVC(RTPMuxContext *ctx, const uint8_t *nal, int size, int last)
 {
-    const uint8_t *r;
-    const uint8_t *end = buf + size;
-    gUdpContext = udp;
+    /*
+     *    HEVC NAL Header / PayloadHdr
+     *    +---------------+---------------+
+     *    |0|1|2|3|4|5|6|7|0|1|2|3|4|5|6|7|
+     *    +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+     *    |F|   Type    |  LayerId  | TID |
+     *    +-------------+-----------------+
+     * */
+    if (size < 2)
+        return;
 
-    if (NULL == ctx || NULL == udp || NULL == buf || size <= 0) {
-        printf("rtpSendH264HEVC param error.\n");
+    // Single NAL Packet or Aggregation Packets
+    if (size <= RTP_PAYLOAD_MAX) {
+        // Aggregation Packets, PayloadHdr + NALU Size + NALU must fit in one packet
+        if (ctx->aggregation && size + 4 <= RTP_PAYLOAD_MAX) {
+            /*
+             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+             *  | PayloadHdr (Type=48) | NALU 1 Size | NALU 1 HDR & Data | NALU 2 Size | ... |
+             *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+             *
+             * */
+            int buffered_size = (int)(ctx->buf_ptr - ctx->buf);  // size of data in ctx->buf
+
+            // The remaining space in ctx->buf is less than the required space
+            if (buffered_size + 2 + size > RTP_PAYLOAD_MAX) {
+                rtpSendData(ctx, NULL, 0, ctx->buf, buffered_size, 0);
+                ctx->buf_ptr = ctx->buf;  // restore buf_ptr
+                buffered_size = 0;
+            }
+
+            if (buffered_size == 0) {
+                if (ctx->bufPending) {  // previous AP still queued in buf
+                    rtpFlush(ctx);
+                }
+                ctx->buf_ptr[0] = (uint8_t)(48 << 1);  // AP Type = 48
+                ctx->buf_ptr[1] = nal[1];               // LayerId + TID of the first NALU
+                ctx->buf_ptr += 2;
+            } else {
+                // AP LayerId and TID are the lowest values of all aggregated NALUs
+                uint8_t layerId = (uint8_t)(((ctx->buf[0] & 0x01) << 5) | (ctx->buf[1] >> 3));
+                uint8_t curLayerId = (uint8_t)(((nal[0] & 0x01) << 5) | (nal[1] >> 3));
+                if (curLayerId < layerId) {
+                    ctx->buf[0] = (uint8_t)((ctx->buf[0] & 0xFE) | (nal[0] & 0x01));
+                    ctx->buf[1] = (uint8_t)((ctx->buf[1] & 0x07) | (nal[1] & 0xF8));
+                }
+                if ((nal[1] & 0x07) < (ctx->buf[1] & 0x07)) {
+                    ctx->buf[1] = (uint8_t)((ctx->buf[1] & 0xF8) | (nal[1] & 0x07));
+                }
+            }
+
+            // set AP F = 1, if this NAL F is 1.
+            ctx->buf[0] |= (nal[0] & 0x80);
+
+            // NALU Size + NALU Header + NALU Data
+            Load16(ctx->buf_ptr, (uint16_t)size);  // NAL size
+            ctx->buf_ptr += 2;
+            memcpy(ctx->buf_ptr, nal, size);  // NALU Header & Data
+            ctx->buf_ptr += size;
+
+            // meet last NAL, send all buf
+            if (last == 1) {
+                rtpSendData(ctx, NULL, 0, ctx->buf, (int)(ctx->buf_ptr - ctx->buf), 1);
+                ctx->buf_ptr = ctx->buf;  // restore buf_ptr
+            }
+        }
+        // Single NAL Unit RTP Packet, PayloadHdr is the NAL header
+        else {
+            if (ctx->buf_ptr > ctx->buf) {  // the pending AP goes first, NALs keep their order
+                rtpSendData(ctx, NULL, 0, ctx->buf, (int)(ctx->buf_ptr - ctx->buf), 0);
+                ctx->buf_ptr = ctx->buf;  // restore buf_ptr
+            }
+            rtpSendData(ctx, NULL, 0, nal, size, last);
+        }
+
+    } else {  // 分片分组
+        /*
+         *
+         *  0                   1                   2                   3
+         *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+         * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+         * |    PayloadHdr (Type=49)       |   FU header   |  FU payload   |
+         * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+         *
+         * */
+        if (ctx->buf_ptr > ctx->buf) {
+            rtpSendData(ctx, NULL, 0, ctx->buf, (int)(ctx->buf_ptr - ctx->buf), 0);
+            ctx->buf_ptr = ctx->buf;  // restore buf_ptr
+        }
+
+        int headerSize;
+        uint8_t buff[3];
+        uint8_t type = (uint8_t)((nal[0] >> 1) & 0x3F);
+
+        buff[0] = (uint8_t)((nal[0] & 0x81) | (49 << 1));  // PayloadHdr: F, FU Type = 49, LayerId MSB
+        buff[1] = nal[1];                                   // LayerId + TID
+
+        /*
+         *      FU Header
+         *    0 1 2 3 4 5 6 7
+         *   +-+-+-+-+-+-+-+-+
+         *   |S|E|  FuType   |
+         *   +---------------+
+         * */
+        buff[2] = type;     // FuType uses NALU Type
+        buff[2] |= 1 << 7;  // S(tart) = 1
+        headerSize = 3;
+        size -= 2;
+        nal += 2;
+
+        while (size + headerSize > RTP_PAYLOAD_MAX) {
+            rtpSendData(ctx, buff, headerSize, nal, RTP_PAYLOAD_MAX - headerSize, 0);
+            nal += RTP_PAYLOAD_MAX - headerSize;
+            size -= RTP_PAYLOAD_MAX - headerSize;
+            buff[2] &= ~(1 << 7);  // S(tart) = 0
+        }
+        buff[2] |= 1 << 6;  // E(nd) = 1
+        rtpSendData(ctx, buff, headerSize, nal, size, last);
+    }
+}
+
+// keep the latest VPS/SPS/PPS for the SDP, they are only looked for in key frames
+static void rtpSaveParamSet(RTPMuxContext *ctx, const uint8_t *nal, int size)
+{
+    int idx = -1;
+
+    if (ctx->payload_type == 0) {
+        uint8_t type = nal[0] & 0x1F;
+        idx = type == H264_NAL_SPS ? RTP_PARAM_SPS : (type == H264_NAL_PPS ? RTP_PARAM_PPS : -1);
+    } else {
+        uint8_t type = (nal[0] >> 1) & 0x3F;
+        if (type >= HEVC_NAL_VPS && type <= HEVC_NAL_PPS)
+            idx = RTP_PARAM_VPS + type - HEVC_NAL_VPS;
+    }
+
+    if (idx < 0 || size > RTP_PARAM_SET_MAX)
         return;
+
+    if (ctx->paramSetLen[idx] == size && !memcmp(ctx->paramSet[idx], nal, size))
+        return;
+
+    pthread_mutex_lock(&ctx->lock);
+    memcpy(ctx->paramSet[idx], nal, size);
+    ctx->paramSetLen[idx] = size;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+int rtpGetParamSets(RTPMuxContext *ctx, uint8_t sets[RTP_PARAM_NUM][RTP_PARAM_SET_MAX], int lens[RTP_PARAM_NUM])
+{
+    int i, found = 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (i = 0; i < RTP_PARAM_NUM; i++) {
+        lens[i] = ctx->paramSetLen[i];
+        memcpy(sets[i], ctx->paramSet[i], lens[i]);
+        found += lens[i] > 0;
     }
+    pthread_mutex_unlock(&ctx->lock);
+
+    return found;
+}
+
+// 从一段H264流中，查询完整的NAL发送，直到发送完此流中的所有NAL; last: 此流是一帧中的最后一段
+static void rtpSendAnnexB(RTPMuxContext *ctx, RTPSendNALFunc sendNAL, const uint8_t *buf, int size, int last, int keyFrame)
+{
+    const uint8_t *r;
+    const uint8_t *end = buf + size;
 
     r = ff_avc_find_startcode(buf, end);
     while (r < end) {
@@ -217,8 +474,107 @@ void rtpSendH264HEVC(RTPMuxContext *ctx, UDPContext *udp, const uint8_t *buf, in
             ;  // skip current startcode
 
         r1 = ff_avc_find_startcode(r, end);  // find next startcode
+        if (keyFrame && r < r1) {
+            rtpSaveParamSet(ctx, r, (int)(r1 - r));
+        }
         // send a NALU (except NALU startcode), r1 == end indicates this is the last NALU
-        rtpSendNAL(ctx, r, (int)(r1 - r), r1 == end);
+        sendNAL(ctx, r, (int)(r1 - r), last && r1 == end);
         r = r1;
     }
 }
+
+// 单个 NAL 的 pack: 跳过开头的起始码直接发送，不扫描整个 pack
+static void rtpSendPack(RTPMuxContext *ctx, RTPSendNALFunc sendNAL, const MediaPack *pack, int last, int keyFrame)
+{
+    const uint8_t *r = pack->data;
+    const uint8_t *end = pack->data + pack->len;
+
+    if (pack->nalCount != 1) {
+        rtpSendAnnexB(ctx, sendNAL, pack->data, (int)pack->len, last, keyFrame);
+        return;
+    }
+
+    while (r < end && !*r)
+        r++;  // skip 00 .. 00 of the start code
+
+    if (r - pack->data < 2 || r >= end || *r != 1) {  // not a start code, trust the scanner
+        rtpSendAnnexB(ctx, sendNAL, pack->data, (int)pack->len, last, keyFrame);
+        return;
+    }
+
+    r++;
+    if (r < end) {
+        if (keyFrame) {
+            rtpSaveParamSet(ctx, r, (int)(end - r));
+        }
+        sendNAL(ctx, r, (int)(end - r), last);
+    }
+}
+
+void rtpSendH264HEVC(RTPMuxContext *ctx, UDPContext *udp, const uint8_t *buf, int size)
+{
+    if (NULL == ctx || NULL == udp || NULL == buf || size <= 0) {
+        printf("rtpSendH264HEVC param error.\n");
+        return;
+    }
+
+    ctx->udp = udp;
+    rtpSendAnnexB(ctx, ctx->payload_type ? rtpSendNALHEVC : rtpSendNALH264, buf, size, 1, 1);
+    rtpFlush(ctx);
+}
+
+// the RTCP thread reads timestamp and sentTime of one frame, never the new timestamp with the previous send time
+static void rtpPublishSentFrame(RTPMuxContext *ctx)
+{
+    uint32_t seq = ctx->sentSeq;
+
+    __atomic_store_n(&ctx->sentSeq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&ctx->sentTimestamp, ctx->timestamp, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->sentFrameTime, ctx->sentTime, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->sentSeq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void rtpSendFrame(RTPMuxContext *ctx, UDPContext *udp, const MediaFrame *frame)
+{
+    int i;
+    RTPSendNALFunc sendNAL;
+
+    if (NULL == ctx || NULL == udp || NULL == frame || frame->packCount <= 0) {
+        printf("rtpSendFrame param error.\n");
+        return;
+    }
+
+    ctx->udp = udp;
+    ctx->firstSendTime = 0;
+    ctx->timestamp = (uint32_t)(frame->pts / 100 * 9);  // (μs / 10^6) * (90 * 10^3)
+    ctx->keyFrame = frame->keyFrame;
+    if (ctx->gop && frame->keyFrame) {
+        gopCacheReset(ctx->gop);
+    }
+
+    // pick the codec packetizer once per frame, the per-NAL path has no codec branches
+    sendNAL = ctx->payload_type ? rtpSendNALHEVC : rtpSendNALH264;
+    for (i = 0; i < frame->packCount; i++) {
+        rtpSendPack(ctx, sendNAL, &frame->packs[i], i == frame->packCount - 1, frame->keyFrame);
+    }
+
+    // packets refer to the encoder stream buffer, send them before it is released
+    rtpFlush(ctx);
+    ctx->sentTime = getMonotonicTime();
+    rtpPublishSentFrame(ctx);
+}
+
+int rtpGetSentFrame(RTPMuxContext *ctx, uint32_t *timestamp, uint64_t *sentTime)
+{
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&ctx->sentSeq, __ATOMIC_ACQUIRE);
+        *timestamp = __atomic_load_n(&ctx->sentTimestamp, __ATOMIC_RELAXED);
+        *sentTime = __atomic_load_n(&ctx->sentFrameTime, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&ctx->sentSeq, __ATOMIC_RELAXED));
+
+    return seq ? 0 : -1;
+}
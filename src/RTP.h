@@ -5,20 +5,65 @@
 #ifndef HISILIVE_RTP_H
 #define HISILIVE_RTP_H
 
+#include "FEC.h"
+#include "GopCache.h"
+#include "Media.h"
 #include "Network.h"
+#include "Pacer.h"
+#include "Retransmit.h"
 
+#define RTP_VERSION 2
+#define RTP_H264 96  // dynamic payload type of the video stream, H.264 or HEVC
 #define RTP_PAYLOAD_MAX 1400
+#define RTP_HEADER_SIZE 12
+#define RTP_BATCH_MAX UDP_BATCH_MAX
+#define RTP_PARAM_SET_MAX 256  // max size of a cached VPS/SPS/PPS
+
+// clang-format off
+enum {
+    RTP_PARAM_VPS,  // HEVC only
+    RTP_PARAM_SPS,
+    RTP_PARAM_PPS,
+    RTP_PARAM_NUM
+};
+// clang-format on
 
 typedef struct {
-    uint8_t cache[RTP_PAYLOAD_MAX + 12];  // RTP packet = RTP header + buf
-    uint8_t buf[RTP_PAYLOAD_MAX];         // NAL header + NAL
+    uint8_t header[RTP_BATCH_MAX][RTP_HEADER_SIZE + 3];  // RTP header + FU indicator/header (HEVC: PayloadHdr/FU header)
+    UDPPacket packet[RTP_BATCH_MAX];                     // packets waiting for rtpFlush
+    int packetCount;
+    int batchSize;  // packets per sendmmsg, (0, RTP_BATCH_MAX]
+    UDPContext *udp;
+    PacerContext *pacer;  // optional, packets are queued to the pacer instead of sent at once
+    RetransmitContext *history;  // optional, sent packets are kept for NACK retransmission
+    FECContext *fec;             // optional, XOR FEC packets are sent after the protected packets
+    GopCache *gop;               // optional, the packets of the current GOP are kept for new receivers
+
+    uint8_t buf[RTP_PAYLOAD_MAX];  // STAP-A/AP: NAL header + NALs
     uint8_t *buf_ptr;
+    int bufPending;  // a queued packet still refers to buf
 
     int aggregation;   // 0: Single Unit, 1: Aggregation Unit
     int payload_type;  // 0, H.264/AVC; 1, HEVC/H.265
     uint32_t ssrc;
     uint32_t seq;
     uint32_t timestamp;
+    int keyFrame;  // the frame being sent is a key frame
+
+    // for RTCP sender reports and latency stats, the counters are read by other threads with atomic loads
+    uint32_t sentPackets;
+    uint32_t sentOctets;     // payload octets
+    uint64_t sentTime;       // monotonic μs when the frame with timestamp was sent, its last packet handed over
+    uint64_t firstSendTime;  // monotonic μs when the first packet of the frame was handed to the kernel or the pacer
+
+    // timestamp and sentTime of the last frame sent, published together once per frame (seqlock, rtpGetSentFrame)
+    uint32_t sentSeq;  // odd while being written
+    uint32_t sentTimestamp;
+    uint64_t sentFrameTime;
+
+    pthread_mutex_t lock;  // protects the parameter sets, read by the RTSP server
+    uint8_t paramSet[RTP_PARAM_NUM][RTP_PARAM_SET_MAX];
+    int paramSetLen[RTP_PARAM_NUM];
 } RTPMuxContext;
 
 int initRTPMuxContext(RTPMuxContext *ctx);
@@ -26,4 +71,17 @@ int initRTPMuxContext(RTPMuxContext *ctx);
 /* send a H.264/HEVC video stream */
 void rtpSendH264HEVC(RTPMuxContext *ctx, UDPContext *udp, const uint8_t *buf, int size);
 
+/* packetize a whole frame and send its packets in batches, the marker bit is set on the last packet */
+void rtpSendFrame(RTPMuxContext *ctx, UDPContext *udp, const MediaFrame *frame);
+
+/* send all queued packets, or hand them to the pacer */
+void rtpFlush(RTPMuxContext *ctx);
+
+/* RTP timestamp and send time (monotonic μs) of the same frame, the last one sent; return -1 before the first frame.
+   Any thread, without a lock */
+int rtpGetSentFrame(RTPMuxContext *ctx, uint32_t *timestamp, uint64_t *sentTime);
+
+/* copy the latest parameter sets (without start code) seen in key frames, return the number found */
+int rtpGetParamSets(RTPMuxContext *ctx, uint8_t sets[RTP_PARAM_NUM][RTP_PARAM_SET_MAX], int lens[RTP_PARAM_NUM]);
+
 #endif  // HISILIVE_RTP_H
@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "RTPDemux.h"
+#include "Media.h"
+#include "RTP.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int initRTPDemuxContext(RTPDemuxContext *ctx)
+{
+    if (NULL == ctx || NULL == ctx->onFrame) {
+        LOGE("initRTPDemuxContext param error.\n");
+        return -1;
+    }
+
+    ctx->buf = (uint8_t *)malloc(RTP_DEMUX_FRAME_MAX);
+    if (NULL == ctx->buf) {
+        LOGE("initRTPDemuxContext malloc error.\n");
+        return -1;
+    }
+    ctx->started = 0;
+    ctx->inFrame = 0;
+    ctx->len = 0;
+    return 0;
+}
+
+void rtpDemuxClose(RTPDemuxContext *ctx)
+{
+    free(ctx->buf);
+    ctx->buf = NULL;
+}
+
+static void rtpDemuxEndFrame(RTPDemuxContext *ctx, int marker)
+{
+    RTPFrame frame;
+
+    if (!ctx->inFrame)
+        return;
+
+    frame.data = ctx->buf;
+    frame.len = ctx->len;
+    frame.timestamp = ctx->timestamp;
+    frame.keyFrame = ctx->keyFrame;
+    frame.complete = marker && !ctx->broken && !ctx->inFU && ctx->len > 0;
+    frame.packets = ctx->packets;
+    frame.firstArrival = ctx->firstArrival;
+    frame.lastArrival = ctx->lastArrival;
+
+    ctx->frames++;
+    ctx->completeFrames += frame.complete;
+    ctx->inFrame = 0;
+    ctx->onFrame(ctx->arg, &frame);
+}
+
+void rtpDemuxFlush(RTPDemuxContext *ctx)
+{
+    rtpDemuxEndFrame(ctx, 0);
+}
+
+/* append the NAL header hdr (start: with a start code) and data to the frame */
+static void rtpDemuxAppend(RTPDemuxContext *ctx, int start, const uint8_t *hdr, int hdrLen, const uint8_t *data, int len)
+{
+    static const uint8_t startCode[4] = {0, 0, 0, 1};
+    int type;
+
+    if (len < 0 || ctx->len + 4 + hdrLen + len > RTP_DEMUX_FRAME_MAX) {
+        ctx->broken = 1;
+        return;
+    }
+
+    if (start) {
+        memcpy(ctx->buf + ctx->len, startCode, 4);
+        ctx->len += 4;
+        if (ctx->payload_type == 0) {
+            type = hdr[0] & 0x1f;
+            ctx->keyFrame |= type == H264_NAL_IDR;
+        } else {
+            type = (hdr[0] >> 1) & 0x3f;
+            ctx->keyFrame |= type >= 16 && type <= 21;  // IRAP
+        }
+    }
+    memcpy(ctx->buf + ctx->len, hdr, hdrLen);
+    ctx->len += hdrLen;
+    memcpy(ctx->buf + ctx->len, data, len);
+    ctx->len += len;
+}
+
+/* STAP-A / AP: NALU Size + NALU, repeated */
+static void rtpDemuxAggregation(RTPDemuxContext *ctx, const uint8_t *p, int len)
+{
+    int size;
+
+    while (len >= 2) {
+        size = (p[0] << 8) | p[1];
+        p += 2;
+        len -= 2;
+        if (size == 0 || size > len) {
+            ctx->broken = 1;
+            return;
+        }
+        rtpDemuxAppend(ctx, 1, p, size, NULL, 0);
+        p += size;
+        len -= size;
+    }
+}
+
+/* FU-A / FU: hdr is the rebuilt NAL header, fu the FU header (S E) */
+static void rtpDemuxFragment(RTPDemuxContext *ctx, const uint8_t *hdr, int hdrLen, uint8_t fu, const uint8_t *p, int len)
+{
+    if (fu & 0x80) {  // S
+        if (ctx->inFU)  // the end of the previous NAL is missing
+            ctx->broken = 1;
+        rtpDemuxAppend(ctx, 1, hdr, hdrLen, p, len);
+        ctx->inFU = 1;
+    } else if (ctx->inFU) {
+        rtpDemuxAppend(ctx, 0, NULL, 0, p, len);
+    } else {  // the start is missing, drop the fragment
+        ctx->broken = 1;
+        return;
+    }
+
+    if (fu & 0x40)  // E
+        ctx->inFU = 0;
+}
+
+static void rtpDemuxH264(RTPDemuxContext *ctx, const uint8_t *p, int len)
+{
+    uint8_t hdr;
+    int type = p[0] & 0x1f;
+
+    if (type >= 1 && type <= 23) {  // Single NAL Unit
+        rtpDemuxAppend(ctx, 1, p, len, NULL, 0);
+    } else if (type == 24) {  // STAP-A
+        rtpDemuxAggregation(ctx, p + 1, len - 1);
+    } else if (type == 28 && len > 2) {  // FU-A: FU indicator F NRI + FU header Type
+        hdr = (uint8_t)((p[0] & 0xe0) | (p[1] & 0x1f));
+        rtpDemuxFragment(ctx, &hdr, 1, p[1], p + 2, len - 2);
+    } else {
+        ctx->ignored++;
+        ctx->broken = 1;
+    }
+}
+
+static void rtpDemuxHEVC(RTPDemuxContext *ctx, const uint8_t *p, int len)
+{
+    uint8_t hdr[2];
+    int type = (p[0] >> 1) & 0x3f;
+
+    if (len < 2) {
+        ctx->broken = 1;
+    } else if (type < 48) {  // Single NAL Unit
+        rtpDemuxAppend(ctx, 1, p, len, NULL, 0);
+    } else if (type == 48) {  // AP
+        rtpDemuxAggregation(ctx, p + 2, len - 2);
+    } else if (type == 49 && len > 3) {  // FU: PayloadHdr F LayerId TID + FU header Type
+        hdr[0] = (uint8_t)((p[0] & 0x81) | ((p[2] & 0x3f) << 1));
+        hdr[1] = p[1];
+        rtpDemuxFragment(ctx, hdr, 2, p[2], p + 3, len - 3);
+    } else {
+        ctx->ignored++;
+        ctx->broken = 1;
+    }
+}
+
+int rtpDemuxPacket(RTPDemuxContext *ctx, const uint8_t *buf, int len, uint64_t arrival)
+{
+    const uint8_t *p = buf + RTP_HEADER_SIZE;
+    uint32_t timestamp, ssrc;
+    uint16_t seq;
+    int marker, gap;
+
+    if (len < RTP_HEADER_SIZE || (buf[0] >> 6) != RTP_VERSION)
+        return -1;
+    if ((buf[1] & 0x7f) != RTP_H264) {  // FEC, in the sequence numbers of the stream: no gap if it is the next one
+        seq = (uint16_t)((buf[2] << 8) | buf[3]);
+        if (ctx->started && seq == ctx->seq)
+            ctx->seq = (uint16_t)(seq + 1);
+        ctx->ignored++;
+        return 0;
+    }
+
+    // CSRCs, header extension and padding are not sent by RTPMuxContext but allowed
+    p += (buf[0] & 0x0f) * 4;
+    if ((buf[0] & 0x10) && p + 4 <= buf + len)
+        p += 4 + ((p[2] << 8) | p[3]) * 4;
+    if (buf[0] & 0x20)
+        len -= buf[len - 1];
+    if (p >= buf + len) {
+        ctx->ignored++;
+        return -1;
+    }
+
+    marker = buf[1] >> 7;
+    seq = (uint16_t)((buf[2] << 8) | buf[3]);
+    timestamp = ((uint32_t)buf[4] << 24) | ((uint32_t)buf[5] << 16) | ((uint32_t)buf[6] << 8) | buf[7];
+    ssrc = ((uint32_t)buf[8] << 24) | ((uint32_t)buf[9] << 16) | ((uint32_t)buf[10] << 8) | buf[11];
+
+    if (ctx->started && ssrc != ctx->ssrc) {
+        LOGD("rtp demux: SSRC %08X -> %08X\n", ctx->ssrc, ssrc);
+        rtpDemuxEndFrame(ctx, 0);
+        ctx->started = 0;
+    }
+    gap = ctx->started && seq != ctx->seq;
+
+    if (ctx->inFrame && timestamp != ctx->timestamp)  // the marker packet is missing
+        rtpDemuxEndFrame(ctx, 0);
+
+    if (!ctx->inFrame) {
+        ctx->inFrame = 1;
+        ctx->timestamp = timestamp;
+        ctx->broken = gap;  // the lost packets may have been the first of this frame
+        ctx->inFU = 0;
+        ctx->keyFrame = 0;
+        ctx->packets = 0;
+        ctx->len = 0;
+        ctx->firstArrival = arrival;
+    } else if (gap) {
+        ctx->broken = 1;
+        ctx->inFU = 0;
+    }
+
+    ctx->started = 1;
+    ctx->ssrc = ssrc;
+    ctx->seq = (uint16_t)(seq + 1);
+    ctx->packets++;
+    ctx->lastArrival = arrival;
+
+    if (ctx->payload_type == 0)
+        rtpDemuxH264(ctx, p, (int)(buf + len - p));
+    else
+        rtpDemuxHEVC(ctx, p, (int)(buf + len - p));
+
+    if (marker)
+        rtpDemuxEndFrame(ctx, 1);
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_RTP_DEMUX_H
+#define HISILIVE_RTP_DEMUX_H
+
+#include <stdint.h>
+
+#define RTP_DEMUX_FRAME_MAX (4 * 1024 * 1024)  // max Annex-B access unit
+
+typedef struct {
+    const uint8_t *data;  // Annex-B, 00 00 00 01 before every NAL
+    int len;
+    uint32_t timestamp;
+    int keyFrame;   // has an IDR (H.264) / IRAP (HEVC) slice
+    int complete;   // every packet arrived and every fragmented NAL is whole
+    int packets;
+    uint64_t firstArrival;  // caller's time of the first and the last packet
+    uint64_t lastArrival;
+} RTPFrame;
+
+typedef void (*RTPFrameFunc)(void *arg, const RTPFrame *frame);
+
+/* reassembles the access units of the RTP stream sent by RTPMuxContext, RFC 6184 / RFC 7798 */
+typedef struct {
+    int payload_type;  // 0, H.264/AVC; 1, HEVC/H.265
+    RTPFrameFunc onFrame;
+    void *arg;
+
+    int started;
+    uint32_t ssrc;
+    uint16_t seq;  // expected next
+
+    int inFrame;
+    uint32_t timestamp;
+    int broken;  // a packet or a fragment of the frame is missing
+    int inFU;    // a fragmented NAL is being joined
+    int keyFrame;
+    int packets;
+    uint64_t firstArrival;
+    uint64_t lastArrival;
+    uint8_t *buf;
+    int len;
+
+    // stats
+    uint32_t frames;
+    uint32_t completeFrames;
+    uint32_t ignored;  // other payload types (FEC), unsupported packets
+} RTPDemuxContext;
+
+int initRTPDemuxContext(RTPDemuxContext *ctx);
+
+void rtpDemuxClose(RTPDemuxContext *ctx);
+
+/* feed one RTP packet in seq order, e.g. from jitterPop; a finished frame is passed to onFrame */
+int rtpDemuxPacket(RTPDemuxContext *ctx, const uint8_t *buf, int len, uint64_t arrival);
+
+/* pass the frame being joined to onFrame, e.g. at the end of the stream */
+void rtpDemuxFlush(RTPDemuxContext *ctx);
+
+#endif  // HISILIVE_RTP_DEMUX_H
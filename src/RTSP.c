@@ -0,0 +1,557 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "RTSP.h"
+#include "Utils.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/prctl.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RTSP_SESSION_TIMEOUT 60  // s
+
+static void rtspCloseClient(RTSPServer *server, RTSPClient *client);
+
+// value of header "name" in the request, return NULL if not found
+static char *rtspGetHeader(const char *req, const char *name, char *value, int size)
+{
+    const char *line = strstr(req, "\r\n");
+    int nameLen = (int)strlen(name);
+
+    while (line && line[2] != '\r') {
+        line += 2;
+        if (!strncasecmp(line, name, nameLen) && line[nameLen] == ':') {
+            const char *v = line + nameLen + 1;
+            const char *e = strstr(v, "\r\n");
+            int len;
+            while (*v == ' ')
+                v++;
+            len = e ? (int)(e - v) : (int)strlen(v);
+            if (len >= size)
+                len = size - 1;
+            memcpy(value, v, len);
+            value[len] = '\0';
+            return value;
+        }
+        line = strstr(line, "\r\n");
+    }
+
+    return NULL;
+}
+
+static void rtspSend(RTSPServer *server, RTSPClient *client, const char *buf, int len)
+{
+    if (client->playing && client->tcp) {  // shared with interleaved RTP
+        tcpSend(server->udp, client->socket, buf, len);
+    } else if (send(client->socket, buf, len, MSG_NOSIGNAL) != len) {
+        LOGE("rtsp send %s\n", strerror(errno));
+    }
+}
+
+static void rtspReply(RTSPServer *server, RTSPClient *client, int code, const char *reason, const char *cseq, const char *headers,
+                      const char *body)
+{
+    char buf[RTSP_BUF_SIZE];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "RTSP/1.0 %d %s\r\nCSeq: %s\r\nServer: HisiLive\r\n%s", code, reason, cseq, headers ? headers : "");
+    if (client->session[0] && !strstr(buf, "Session:")) {
+        len += snprintf(buf + len, sizeof(buf) - len, "Session: %s;timeout=%d\r\n", client->session, RTSP_SESSION_TIMEOUT);
+    }
+    if (body) {
+        len += snprintf(buf + len, sizeof(buf) - len, "Content-Length: %d\r\n\r\n%s", (int)strlen(body), body);
+    } else {
+        len += snprintf(buf + len, sizeof(buf) - len, "\r\n");
+    }
+
+    if (len >= (int)sizeof(buf))
+        len = sizeof(buf) - 1;
+    rtspSend(server, client, buf, len);
+}
+
+/* SDP of the live stream, parameter sets come from the last key frame */
+static int rtspBuildSDP(RTSPServer *server, RTSPClient *client, char *sdp, int size)
+{
+    uint8_t sets[RTP_PARAM_NUM][RTP_PARAM_SET_MAX];
+    int lens[RTP_PARAM_NUM];
+    char b64[RTP_PARAM_NUM][RTP_PARAM_SET_MAX * 2];
+    struct sockaddr_in local;
+    socklen_t localLen = sizeof(local);
+    RetransmitContext *history = server->rtp->history;
+    FECContext *fec = server->rtp->fec;
+    char types[16] = "";
+    int i, len;
+
+    getsockname(client->socket, (struct sockaddr *)&local, &localLen);
+    rtpGetParamSets(server->rtp, sets, lens);
+    for (i = 0; i < RTP_PARAM_NUM; i++) {
+        base64Encode(sets[i], lens[i], b64[i]);
+    }
+    if (history && history->rtxPayloadType > 0) {
+        snprintf(types, sizeof(types), " %d", history->rtxPayloadType);
+    }
+    if (fec) {
+        snprintf(types + strlen(types), sizeof(types) - strlen(types), " %d", fec->payloadType);
+    }
+
+    len = snprintf(sdp, size,
+                   "v=0\r\n"
+                   "o=- %u 1 IN IP4 %s\r\n"
+                   "s=HisiLive\r\n"
+                   "c=IN IP4 0.0.0.0\r\n"
+                   "t=0 0\r\n"
+                   "a=control:*\r\n"
+                   "a=range:npt=0-\r\n"
+                   "m=video 0 RTP/AVP 96%s\r\n"
+                   "b=AS:%d\r\n"
+                   "a=framerate:%d\r\n",
+                   (unsigned)time(NULL), inet_ntoa(local.sin_addr), types, server->bitRate, server->frameRate);
+
+    if (server->codec == 0) {
+        len += snprintf(sdp + len, size - len, "a=rtpmap:96 H264/90000\r\na=fmtp:96 packetization-mode=1");
+        if (lens[RTP_PARAM_SPS] >= 4 && lens[RTP_PARAM_PPS] > 0) {
+            len += snprintf(sdp + len, size - len, ";profile-level-id=%02X%02X%02X;sprop-parameter-sets=%s,%s", sets[RTP_PARAM_SPS][1],
+                            sets[RTP_PARAM_SPS][2], sets[RTP_PARAM_SPS][3], b64[RTP_PARAM_SPS], b64[RTP_PARAM_PPS]);
+        }
+    } else {
+        len += snprintf(sdp + len, size - len, "a=rtpmap:96 H265/90000");
+        if (lens[RTP_PARAM_VPS] > 0 && lens[RTP_PARAM_SPS] > 0 && lens[RTP_PARAM_PPS] > 0) {
+            len += snprintf(sdp + len, size - len, "\r\na=fmtp:96 sprop-vps=%s;sprop-sps=%s;sprop-pps=%s", b64[RTP_PARAM_VPS],
+                            b64[RTP_PARAM_SPS], b64[RTP_PARAM_PPS]);
+        }
+    }
+    if (history) {  // lost packets can be NACKed, RFC 4585
+        len += snprintf(sdp + len, size - len, "\r\na=rtcp-fb:96 nack");
+        if (history->rtxPayloadType > 0) {
+            len += snprintf(sdp + len, size - len, "\r\na=rtpmap:%d rtx/90000\r\na=fmtp:%d apt=96;rtx-time=%d", history->rtxPayloadType,
+                            history->rtxPayloadType, history->window);
+        }
+    }
+    if (fec) {  // RFC 5109
+        len += snprintf(sdp + len, size - len, "\r\na=rtpmap:%d ulpfec/90000", fec->payloadType);
+    }
+    len += snprintf(sdp + len, size - len, "\r\na=control:trackID=0\r\n");
+
+    return len;
+}
+
+static void rtspGetDest(RTSPClient *client, UDPDest *dst)
+{
+    memset(dst, 0, sizeof(UDPDest));
+    dst->addr = client->addr;
+    dst->addr.sin_port = htons((uint16_t)client->clientPort[0]);
+    dst->tcpSocket = client->tcp ? client->socket : -1;
+    dst->channel = client->channel;
+    dst->rtcpPort = client->clientPort[1];
+}
+
+static void rtspAttach(RTSPServer *server, RTSPClient *client)
+{
+    UDPDest dst;
+
+    if (client->playing)
+        return;
+
+    if (client->tcp) {
+        struct timeval tv = { 0, 200 * 1000 };  // replies to a stalled viewer, RTP is written without waiting
+        setsockopt(client->socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+
+    if (server->gop) {  // the first picture comes from the cached IDR, not the next one
+        rtspGetDest(client, &dst);
+        if (gopCacheJoin(server->gop, &dst) == 0)
+            client->playing = 1;
+    } else if (client->tcp) {
+        if (udpAddTCPDest(server->udp, client->socket, client->channel) == 0)
+            client->playing = 1;
+    } else {
+        if (udpAddDest(server->udp, inet_ntoa(client->addr.sin_addr), client->clientPort[0], client->clientPort[1]) == 0)
+            client->playing = 1;
+    }
+}
+
+static void rtspDetach(RTSPServer *server, RTSPClient *client)
+{
+    UDPDest dst;
+
+    if (!client->playing)
+        return;
+
+    if (server->gop) {
+        rtspGetDest(client, &dst);
+        gopCacheLeave(server->gop, &dst);
+    }
+    if (client->tcp) {
+        udpRemoveTCPDest(server->udp, client->socket);
+    } else {
+        udpRemoveDest(server->udp, inet_ntoa(client->addr.sin_addr), client->clientPort[0]);
+    }
+    client->playing = 0;
+}
+
+static void rtspSetup(RTSPServer *server, RTSPClient *client, const char *req, const char *cseq)
+{
+    char transport[256];
+    char headers[512];
+    const char *p;
+    char *e;
+
+    if (!rtspGetHeader(req, "Transport", transport, sizeof(transport))) {
+        rtspReply(server, client, 461, "Unsupported Transport", cseq, NULL, NULL);
+        return;
+    }
+
+    if (client->playing) {  // transport can not change while playing
+        rtspReply(server, client, 455, "Method Not Valid in This State", cseq, NULL, NULL);
+        return;
+    }
+
+    if (strstr(transport, "RTP/AVP/TCP") || strstr(transport, "interleaved=")) {
+        client->tcp = 1;
+        client->channel = 0;
+        if ((p = strstr(transport, "interleaved=")) != NULL) {
+            client->channel = atoi(p + strlen("interleaved="));
+        }
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP/TCP;unicast;interleaved=%d-%d;ssrc=%08X\r\n", client->channel,
+                 client->channel + 1, server->rtp->ssrc);
+    } else if ((p = strstr(transport, "client_port=")) != NULL) {
+        client->tcp = 0;
+        client->clientPort[0] = (int)strtol(p + strlen("client_port="), &e, 10);
+        client->clientPort[1] = *e == '-' ? atoi(e + 1) : client->clientPort[0] + 1;
+        if (client->clientPort[0] <= 0 || client->clientPort[0] > 65535 || client->clientPort[1] <= 0 || client->clientPort[1] > 65535) {
+            rtspReply(server, client, 461, "Unsupported Transport", cseq, NULL, NULL);
+            return;
+        }
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d;ssrc=%08X\r\n",
+                 client->clientPort[0], client->clientPort[1], server->udp->localPort,
+                 server->rtcp ? server->rtcp->port : server->udp->localPort + 1, server->rtp->ssrc);
+    } else {
+        rtspReply(server, client, 461, "Unsupported Transport", cseq, NULL, NULL);
+        return;
+    }
+
+    if (!client->session[0]) {
+        snprintf(client->session, sizeof(client->session), "%08X%04X", (unsigned)rand(), (unsigned)(rand() & 0xFFFF));
+    }
+
+    rtspReply(server, client, 200, "OK", cseq, headers, NULL);
+}
+
+static void rtspHandleRequest(RTSPServer *server, RTSPClient *client, const char *req)
+{
+    char method[32] = { 0 };
+    char url[256] = { 0 };
+    char cseq[32] = "0";
+    char session[64];
+    char headers[512];
+    char sdp[2048];
+
+    if (sscanf(req, "%31s %255s", method, url) != 2) {
+        rtspReply(server, client, 400, "Bad Request", cseq, NULL, NULL);
+        return;
+    }
+    rtspGetHeader(req, "CSeq", cseq, sizeof(cseq));
+    LOGD("rtsp %s %s CSeq %s\n", method, url, cseq);
+
+    if (strcmp(method, "OPTIONS") && strcmp(method, "DESCRIBE") && strcmp(method, "SETUP")) {
+        // everything else needs the session from SETUP
+        if (!client->session[0] || !rtspGetHeader(req, "Session", session, sizeof(session)) ||
+            strncmp(session, client->session, strlen(client->session))) {
+            rtspReply(server, client, 454, "Session Not Found", cseq, NULL, NULL);
+            return;
+        }
+    }
+
+    if (!strcmp(method, "OPTIONS")) {
+        rtspReply(server, client, 200, "OK", cseq, "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER\r\n", NULL);
+    } else if (!strcmp(method, "DESCRIBE")) {
+        rtspBuildSDP(server, client, sdp, sizeof(sdp));
+        snprintf(headers, sizeof(headers), "Content-Base: %s/\r\nContent-Type: application/sdp\r\n", url);
+        rtspReply(server, client, 200, "OK", cseq, headers, sdp);
+    } else if (!strcmp(method, "SETUP")) {
+        rtspSetup(server, client, req, cseq);
+    } else if (!strcmp(method, "PLAY")) {
+        if (server->gop) {  // the burst starts before the current seq
+            snprintf(headers, sizeof(headers), "Range: npt=0.000-\r\nRTP-Info: url=%s\r\n", url);
+        } else {
+            snprintf(headers, sizeof(headers), "Range: npt=0.000-\r\nRTP-Info: url=%s;seq=%u;rtptime=%u\r\n", url,
+                     server->rtp->seq, server->rtp->timestamp);
+        }
+        rtspReply(server, client, 200, "OK", cseq, headers, NULL);
+        rtspAttach(server, client);  // after the reply, so it is not mixed with RTP
+    } else if (!strcmp(method, "TEARDOWN")) {
+        rtspDetach(server, client);
+        rtspReply(server, client, 200, "OK", cseq, NULL, NULL);
+        client->session[0] = '\0';
+    } else if (!strcmp(method, "GET_PARAMETER")) {  // keep-alive
+        rtspReply(server, client, 200, "OK", cseq, NULL, NULL);
+    } else {
+        rtspReply(server, client, 501, "Not Implemented", cseq, NULL, NULL);
+    }
+}
+
+// handle all complete requests and interleaved packets in the client buffer
+static void rtspProcess(RTSPServer *server, RTSPClient *client)
+{
+    while (client->len > 0) {
+        int used;
+
+        if (client->skip > 0) {
+            used = client->skip < client->len ? client->skip : client->len;
+            client->skip -= used;
+        } else if (client->buf[0] == '$') {  // interleaved packet from the client
+            if (client->len < 4)
+                return;
+            used = 4 + (((uint8_t)client->buf[2] << 8) | (uint8_t)client->buf[3]);
+            if (used > RTSP_BUF_SIZE - 1) {  // never fits, skip it by its length
+                LOGE("rtsp interleaved packet of %d bytes skipped\n", used);
+                client->skip = used;
+                continue;
+            }
+            if (client->len < used)
+                return;
+            if (server->rtcp && (uint8_t)client->buf[1] == client->channel + 1) {
+                UDPDest from;
+                from.addr = client->addr;
+                from.tcpSocket = client->socket;
+                from.channel = client->channel;
+                rtcpHandlePacket(server->rtcp, (uint8_t *)client->buf + 4, used - 4, &from);
+            }
+        } else {
+            char *end;
+            char length[16];
+            client->buf[client->len] = '\0';
+            end = strstr(client->buf, "\r\n\r\n");
+            if (!end) {
+                if (client->len >= RTSP_BUF_SIZE - 1) {  // request too large
+                    LOGE("rtsp request too large\n");
+                    client->len = 0;
+                }
+                return;
+            }
+            used = (int)(end - client->buf) + 4;
+            end[2] = '\0';  // headers only
+            if (rtspGetHeader(client->buf, "Content-Length", length, sizeof(length))) {
+                char *tail;
+                long body = strtol(length, &tail, 10);
+                if (tail == length || *tail != '\0' || body < 0 || body > RTSP_BUF_SIZE - 1 - used) {  // never fits
+                    char cseq[32] = "0";
+                    LOGE("rtsp invalid Content-Length %s\n", length);
+                    rtspGetHeader(client->buf, "CSeq", cseq, sizeof(cseq));
+                    rtspReply(server, client, 400, "Bad Request", cseq, NULL, NULL);
+                    rtspCloseClient(server, client);
+                    return;
+                }
+                used += (int)body;
+                if (client->len < used) {
+                    end[2] = '\r';
+                    return;
+                }
+            }
+            rtspHandleRequest(server, client, client->buf);
+            if (client->socket < 0)
+                return;
+        }
+
+        client->len -= used;
+        memmove(client->buf, client->buf + used, client->len);
+    }
+}
+
+static void rtspCloseClient(RTSPServer *server, RTSPClient *client)
+{
+    LOGD("rtsp client %s:%d closed\n", inet_ntoa(client->addr.sin_addr), ntohs(client->addr.sin_port));
+    rtspDetach(server, client);
+    close(client->socket);
+    client->socket = -1;
+    client->session[0] = '\0';
+    client->len = 0;
+    client->skip = 0;
+}
+
+static void rtspAccept(RTSPServer *server)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int i;
+    int fd = accept(server->socket, (struct sockaddr *)&addr, &addrLen);
+
+    if (fd < 0) {
+        LOGE("rtsp accept %s\n", strerror(errno));
+        return;
+    }
+
+    for (i = 0; i < RTSP_CLIENT_MAX; i++) {
+        if (server->client[i].socket < 0)
+            break;
+    }
+    if (i == RTSP_CLIENT_MAX) {
+        LOGE("too many rtsp clients, max %d\n", RTSP_CLIENT_MAX);
+        close(fd);
+        return;
+    }
+
+    memset(&server->client[i], 0, sizeof(RTSPClient));
+    server->client[i].socket = fd;
+    server->client[i].addr = addr;
+    LOGD("rtsp client %s:%d connected\n", inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+}
+
+// monotonic μs of the last RTCP report from the receiver of a playing client, 0 if none
+static uint64_t rtspLastReport(RTSPServer *server, RTSPClient *client)
+{
+    RTCPReceiverStats stats[RTCP_RECEIVER_MAX];
+    uint64_t last = 0;
+    int i, n;
+
+    if (NULL == server->rtcp || !client->playing)
+        return 0;
+
+    n = rtcpGetStats(server->rtcp, stats, RTCP_RECEIVER_MAX);
+    for (i = 0; i < n; i++) {
+        if (stats[i].addr.sin_addr.s_addr != client->addr.sin_addr.s_addr)
+            continue;
+        if (client->tcp ? stats[i].addr.sin_port != client->addr.sin_port : ntohs(stats[i].addr.sin_port) != client->clientPort[0])
+            continue;
+        if (stats[i].lastReport > last)
+            last = stats[i].lastReport;
+    }
+
+    return last;
+}
+
+static void *rtspThread(void *arg)
+{
+    RTSPServer *server = (RTSPServer *)arg;
+    time_t lastActive[RTSP_CLIENT_MAX] = { 0 };
+    struct timeval tv;
+    fd_set fds;
+    int i, maxfd, res;
+
+    prctl(PR_SET_NAME, "RTSPServer", 0, 0, 0);
+
+    while (server->running) {
+        FD_ZERO(&fds);
+        FD_SET(server->socket, &fds);
+        maxfd = server->socket;
+        for (i = 0; i < RTSP_CLIENT_MAX; i++) {
+            if (server->client[i].socket >= 0) {
+                FD_SET(server->client[i].socket, &fds);
+                if (server->client[i].socket > maxfd)
+                    maxfd = server->client[i].socket;
+            }
+        }
+
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+        res = select(maxfd + 1, &fds, NULL, NULL, &tv);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGE("rtsp select %s\n", strerror(errno));
+            break;
+        }
+
+        if (FD_ISSET(server->socket, &fds)) {
+            rtspAccept(server);
+        }
+
+        for (i = 0; i < RTSP_CLIENT_MAX; i++) {
+            RTSPClient *client = &server->client[i];
+            if (client->socket < 0)
+                continue;
+
+            if (res > 0 && FD_ISSET(client->socket, &fds)) {
+                int n = (int)recv(client->socket, client->buf + client->len, RTSP_BUF_SIZE - 1 - client->len, 0);
+                if (n <= 0) {
+                    rtspCloseClient(server, client);
+                    lastActive[i] = 0;
+                    continue;
+                }
+                client->len += n;
+                lastActive[i] = time(NULL);
+                rtspProcess(server, client);
+            } else if (lastActive[i] == 0) {
+                lastActive[i] = time(NULL);
+            } else if (time(NULL) - lastActive[i] > RTSP_SESSION_TIMEOUT) {
+                // RTCP receiver reports keep a session alive too, RFC 2326 12.37
+                uint64_t report = rtspLastReport(server, client);
+                uint64_t now = getMonotonicTime();
+                if (report && now - report < (uint64_t)RTSP_SESSION_TIMEOUT * 1000000) {
+                    lastActive[i] = time(NULL) - (time_t)((now - report) / 1000000);
+                    continue;
+                }
+                LOGE("rtsp session %s timeout\n", client->session);
+                rtspCloseClient(server, client);
+                lastActive[i] = 0;
+            }
+        }
+    }
+
+    for (i = 0; i < RTSP_CLIENT_MAX; i++) {
+        if (server->client[i].socket >= 0)
+            rtspCloseClient(server, &server->client[i]);
+    }
+
+    return NULL;
+}
+
+int rtspStart(RTSPServer *server)
+{
+    struct sockaddr_in addr;
+    int i, on = 1;
+
+    if (NULL == server || NULL == server->rtp || NULL == server->udp) {
+        LOGE("rtspStart param error.\n");
+        return -1;
+    }
+
+    server->socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->socket < 0) {
+        LOGE("rtsp socket error.\n");
+        return -1;
+    }
+    setsockopt(server->socket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)server->port);
+    if (bind(server->socket, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server->socket, RTSP_CLIENT_MAX) < 0) {
+        LOGE("rtsp bind/listen port %d: %s\n", server->port, strerror(errno));
+        close(server->socket);
+        return -1;
+    }
+
+    for (i = 0; i < RTSP_CLIENT_MAX; i++) {
+        server->client[i].socket = -1;
+    }
+    srand((unsigned)time(NULL) ^ (unsigned)getpid());
+
+    server->running = 1;
+    if (pthread_create(&server->thread, NULL, rtspThread, server)) {
+        LOGE("rtsp thread create error.\n");
+        close(server->socket);
+        return -1;
+    }
+
+    LOGD("RTSP server listening on port %d\n", server->port);
+    return 0;
+}
+
+void rtspStop(RTSPServer *server)
+{
+    if (!server->running)
+        return;
+
+    server->running = 0;
+    pthread_join(server->thread, NULL);
+    close(server->socket);
+}
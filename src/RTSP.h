@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_RTSP_H
+#define HISILIVE_RTSP_H
+
+#include "Network.h"
+#include "RTCP.h"
+#include "RTP.h"
+
+#define RTSP_CLIENT_MAX UDP_DEST_MAX
+#define RTSP_BUF_SIZE 4096
+
+typedef struct {
+    int socket;  // -1: unused
+    struct sockaddr_in addr;
+    char buf[RTSP_BUF_SIZE];
+    int len;
+    int skip;  // bytes left of an interleaved packet too large for buf, discarded as they arrive
+
+    char session[20];  // "" before SETUP
+    int playing;
+    int tcp;             // 1: RTP/AVP/TCP interleaved, 0: RTP/AVP UDP
+    int channel;         // interleaved RTP channel
+    int clientPort[2];   // UDP RTP, RTCP
+} RTSPClient;
+
+typedef struct {
+    int port;       // listen port
+    int codec;      // 0, H.264/AVC; 1, HEVC/H.265
+    int frameRate;  // fps
+    int bitRate;    // kbps
+
+    // sessions are attached to this stream: packetized once, sent to every session
+    RTPMuxContext *rtp;
+    UDPContext *udp;
+    RTCPContext *rtcp;  // optional, receives the reports of interleaved sessions
+    GopCache *gop;      // optional, a new session starts with a burst of the current GOP
+
+    int socket;
+    int running;
+    pthread_t thread;
+    RTSPClient client[RTSP_CLIENT_MAX];
+} RTSPServer;
+
+/* listen on server->port and serve OPTIONS/DESCRIBE/SETUP/PLAY/TEARDOWN in a thread */
+int rtspStart(RTSPServer *server);
+
+/* close all sessions and stop the server thread */
+void rtspStop(RTSPServer *server);
+
+#endif  // HISILIVE_RTSP_H
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#define _GNU_SOURCE  // O_DIRECT
+
+#include "Recorder.h"
+#include "Utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+/*
+ * Frames are copied into RECORDER_BUFFER_SIZE buffers and written by a writer thread, one write() per buffer
+ * instead of one per pack. A partly filled buffer is written every flushInterval. With O_DIRECT only whole
+ * RECORDER_ALIGN blocks are written before close, the rest moves to the next buffer.
+ */
+
+static int recorderWriteAll(int fd, const uint8_t *data, uint32_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        len -= (uint32_t)n;
+    }
+
+    return 0;
+}
+
+static void *recorderThread(void *arg)
+{
+    RecorderContext *rec = (RecorderContext *)arg;
+    RecorderBuffer *buf;
+    uint64_t start, time;
+    int res;
+
+    prctl(PR_SET_NAME, "RecorderWriter", 0, 0, 0);
+
+    pthread_mutex_lock(&rec->lock);
+    for (;;) {
+        if (rec->head == rec->fill) {
+            if (!rec->running)
+                break;  // everything queued is written
+            pthread_cond_wait(&rec->cond, &rec->lock);
+            continue;
+        }
+
+        // buffers in [head, fill) are not touched by the producer until head moves
+        buf = &rec->buffer[rec->head % RECORDER_BUFFER_COUNT];
+        pthread_mutex_unlock(&rec->lock);
+        start = getMonotonicTime();
+        res = recorderWriteAll(rec->fd, buf->data, buf->len);
+        time = getMonotonicTime() - start;
+        pthread_mutex_lock(&rec->lock);
+
+        if (res) {
+            rec->writeErrors++;
+            LOGE("recorder write error: %s\n", strerror(errno));
+        } else {
+            rec->bytes += buf->len;
+            rec->writes++;
+        }
+        if (time > rec->maxWriteTime)
+            rec->maxWriteTime = (uint32_t)time;
+        buf->len = 0;
+        rec->head++;
+        pthread_cond_broadcast(&rec->cond);
+    }
+    pthread_mutex_unlock(&rec->lock);
+
+    return NULL;
+}
+
+/* hand the buffer being filled to the writer thread, wait while no buffer is free */
+static void recorderSubmit(RecorderContext *rec)
+{
+    RecorderBuffer *buf = &rec->buffer[rec->fill % RECORDER_BUFFER_COUNT];
+    RecorderBuffer *next;
+    const uint8_t *rest;
+    uint32_t restLen = 0;
+    uint64_t start;
+
+    rec->lastFlush = getMonotonicTime();
+    if (rec->direct) {
+        restLen = buf->len % RECORDER_ALIGN;
+        if (restLen == buf->len)
+            return;  // not a whole block yet
+        buf->len -= restLen;
+    }
+    rest = buf->data + buf->len;  // the writer only reads the buffer
+
+    pthread_mutex_lock(&rec->lock);
+    rec->fill++;
+    pthread_cond_broadcast(&rec->cond);
+    if (rec->fill - rec->head >= RECORDER_BUFFER_COUNT) {  // the disk is behind, the frame queue absorbs it
+        rec->waits++;
+        start = getMonotonicTime();
+        while (rec->fill - rec->head >= RECORDER_BUFFER_COUNT) {
+            pthread_cond_wait(&rec->cond, &rec->lock);
+        }
+        rec->waitTime += getMonotonicTime() - start;
+    }
+    pthread_mutex_unlock(&rec->lock);
+
+    next = &rec->buffer[rec->fill % RECORDER_BUFFER_COUNT];
+    memcpy(next->data, rest, restLen);
+    next->len = restLen;
+}
+
+int recorderWriteData(RecorderContext *rec, const uint8_t *data, uint32_t len)
+{
+    RecorderBuffer *buf;
+    uint32_t n;
+
+    while (len > 0) {
+        buf = &rec->buffer[rec->fill % RECORDER_BUFFER_COUNT];
+        n = RECORDER_BUFFER_SIZE - buf->len;
+        if (n > len)
+            n = len;
+        memcpy(buf->data + buf->len, data, n);
+        buf->len += n;
+        data += n;
+        len -= n;
+        if (buf->len == RECORDER_BUFFER_SIZE)
+            recorderSubmit(rec);
+    }
+
+    return 0;
+}
+
+int recorderWrite(RecorderContext *rec, const MediaFrame *frame)
+{
+    int i;
+
+    for (i = 0; i < frame->packCount; i++) {
+        recorderWriteData(rec, frame->packs[i].data, frame->packs[i].len);
+    }
+    recorderPoll(rec);
+
+    return 0;
+}
+
+void recorderPoll(RecorderContext *rec)
+{
+    RecorderBuffer *buf = &rec->buffer[rec->fill % RECORDER_BUFFER_COUNT];
+
+    if (buf->len > 0 && getMonotonicTime() - rec->lastFlush >= (uint64_t)rec->flushInterval * 1000)
+        recorderSubmit(rec);
+}
+
+static int recorderOpenFile(RecorderContext *rec, const char *filename)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+    rec->fd = open(filename, flags | (rec->direct ? O_DIRECT : 0), 0644);
+    if (rec->fd < 0 && rec->direct && errno == EINVAL) {
+        LOGE("%s: O_DIRECT not supported, buffered writes\n", filename);
+        rec->direct = 0;
+        rec->fd = open(filename, flags, 0644);
+    }
+    if (rec->fd < 0) {
+        LOGE("open %s error: %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* write everything buffered for the current file and close it, the writer thread keeps running */
+static void recorderCloseFile(RecorderContext *rec)
+{
+    RecorderBuffer *buf = &rec->buffer[rec->fill % RECORDER_BUFFER_COUNT];
+    int flags;
+
+    if (buf->len > 0)
+        recorderSubmit(rec);  // with O_DIRECT the whole blocks, the tail stays
+
+    pthread_mutex_lock(&rec->lock);
+    while (rec->head != rec->fill) {
+        pthread_cond_wait(&rec->cond, &rec->lock);
+    }
+    pthread_mutex_unlock(&rec->lock);
+
+    // the writer is idle, the tail is not a whole block
+    buf = &rec->buffer[rec->fill % RECORDER_BUFFER_COUNT];
+    if (buf->len > 0) {
+        if (rec->direct) {
+            flags = fcntl(rec->fd, F_GETFL);
+            fcntl(rec->fd, F_SETFL, flags & ~O_DIRECT);
+        }
+        pthread_mutex_lock(&rec->lock);
+        if (recorderWriteAll(rec->fd, buf->data, buf->len)) {
+            rec->writeErrors++;
+        } else {
+            rec->bytes += buf->len;
+            rec->writes++;
+        }
+        pthread_mutex_unlock(&rec->lock);
+        buf->len = 0;
+    }
+    fdatasync(rec->fd);
+    close(rec->fd);
+    rec->fd = -1;
+}
+
+int recorderReopen(RecorderContext *rec, const char *filename)
+{
+    if (NULL == rec || !rec->running || NULL == filename)
+        return -1;
+
+    recorderCloseFile(rec);
+    return recorderOpenFile(rec, filename);
+}
+
+int recorderOpen(RecorderContext *rec, const char *filename)
+{
+    int i;
+
+    if (NULL == rec || NULL == filename) {
+        LOGE("recorderOpen param error.\n");
+        return -1;
+    }
+
+    if (recorderOpenFile(rec, filename)) {
+        return -1;
+    }
+
+    for (i = 0; i < RECORDER_BUFFER_COUNT; i++) {
+        if (posix_memalign((void **)&rec->buffer[i].data, RECORDER_ALIGN, RECORDER_BUFFER_SIZE)) {
+            LOGE("recorder buffer malloc error.\n");
+            while (i-- > 0) {
+                free(rec->buffer[i].data);
+            }
+            close(rec->fd);
+            return -1;
+        }
+        rec->buffer[i].len = 0;
+    }
+
+    if (rec->flushInterval <= 0)
+        rec->flushInterval = RECORDER_FLUSH_INTERVAL;
+    rec->head = rec->fill = 0;
+    rec->lastFlush = getMonotonicTime();
+    rec->bytes = 0;
+    rec->writes = rec->writeErrors = 0;
+    rec->maxWriteTime = 0;
+    rec->waits = 0;
+    rec->waitTime = 0;
+
+    pthread_mutex_init(&rec->lock, NULL);
+    pthread_cond_init(&rec->cond, NULL);
+    rec->running = 1;
+    if (pthread_create(&rec->thread, NULL, recorderThread, rec)) {
+        LOGE("recorder pthread_create error.\n");
+        rec->running = 0;
+        for (i = 0; i < RECORDER_BUFFER_COUNT; i++) {
+            free(rec->buffer[i].data);
+        }
+        close(rec->fd);
+        return -1;
+    }
+
+    LOGD("recorder: %s, %d x %d KB buffers, flush every %d ms%s\n", filename, RECORDER_BUFFER_COUNT, RECORDER_BUFFER_SIZE / 1024,
+         rec->flushInterval, rec->direct ? ", O_DIRECT" : "");
+    return 0;
+}
+
+void recorderClose(RecorderContext *rec)
+{
+    int i;
+
+    if (NULL == rec || !rec->running)
+        return;
+
+    recorderCloseFile(rec);
+
+    pthread_mutex_lock(&rec->lock);
+    rec->running = 0;
+    pthread_cond_broadcast(&rec->cond);
+    pthread_mutex_unlock(&rec->lock);
+    pthread_join(rec->thread, NULL);
+
+    recorderDumpStats(rec);
+    for (i = 0; i < RECORDER_BUFFER_COUNT; i++) {
+        free(rec->buffer[i].data);
+        rec->buffer[i].data = NULL;
+    }
+    pthread_cond_destroy(&rec->cond);
+    pthread_mutex_destroy(&rec->lock);
+}
+
+void recorderDumpStats(RecorderContext *rec)
+{
+    pthread_mutex_lock(&rec->lock);
+    LOGI("recorder: %llu KB in %u writes, %u errors, slowest %u ms, queued %u/%d, waited %u times %llu ms\n",
+         (unsigned long long)(rec->bytes / 1024), rec->writes, rec->writeErrors, rec->maxWriteTime / 1000, rec->fill - rec->head,
+         RECORDER_BUFFER_COUNT, rec->waits, (unsigned long long)(rec->waitTime / 1000));
+    pthread_mutex_unlock(&rec->lock);
+}
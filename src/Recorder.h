@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_RECORDER_H
+#define HISILIVE_RECORDER_H
+
+#include "Media.h"
+#include <pthread.h>
+#include <stdint.h>
+
+#define RECORDER_BUFFER_SIZE (1024 * 1024)  // bytes per write(), a multiple of RECORDER_ALIGN
+#define RECORDER_BUFFER_COUNT 4             // 1 being filled, the others queued for the writer thread
+#define RECORDER_ALIGN 4096                 // buffer address and O_DIRECT write size alignment
+#define RECORDER_FLUSH_INTERVAL 1000        // ms, default
+
+typedef struct {
+    uint8_t *data;  // RECORDER_ALIGN aligned
+    uint32_t len;
+} RecorderBuffer;
+
+typedef struct {
+    int flushInterval;  // ms, a partly filled buffer is written after this long; RECORDER_FLUSH_INTERVAL if 0
+    int direct;         // open with O_DIRECT, bypass the page cache
+
+    int fd;
+    RecorderBuffer buffer[RECORDER_BUFFER_COUNT];
+    uint32_t head;  // next buffer to write, advanced by the writer thread
+    uint32_t fill;  // buffer being filled, advanced by recorderWrite; [head, fill) wait for the writer
+    uint64_t lastFlush;
+
+    // back-pressure, written under lock
+    uint64_t bytes;        // written to the file
+    uint32_t writes;
+    uint32_t writeErrors;
+    uint32_t maxWriteTime;  // μs of the slowest write()
+    uint32_t waits;         // frames that waited for a free buffer
+    uint64_t waitTime;      // μs spent waiting in total
+
+    int running;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} RecorderContext;
+
+/* create the file and start the writer thread */
+int recorderOpen(RecorderContext *rec, const char *filename);
+
+/* copy a frame into the current buffer; blocks only while every buffer waits for the disk */
+int recorderWrite(RecorderContext *rec, const MediaFrame *frame);
+
+/* the same for any bytes, call recorderPoll after a frame */
+int recorderWriteData(RecorderContext *rec, const uint8_t *data, uint32_t len);
+
+/* hand a partly filled buffer to the writer once the flush interval is over */
+void recorderPoll(RecorderContext *rec);
+
+/* finish the current file and continue in a new one, the buffers and the writer thread are kept */
+int recorderReopen(RecorderContext *rec, const char *filename);
+
+/* write everything buffered, stop the writer thread and close the file */
+void recorderClose(RecorderContext *rec);
+
+/* log throughput and back-pressure counters */
+void recorderDumpStats(RecorderContext *rec);
+
+#endif  // HISILIVE_RECORDER_H
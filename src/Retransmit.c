@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "Retransmit.h"
+#include "RTP.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <string.h>
+
+int retransmitInit(RetransmitContext *ctx)
+{
+    if (NULL == ctx) {
+        LOGE("retransmitInit param error.\n");
+        return -1;
+    }
+
+    if (ctx->window <= 0)
+        ctx->window = RETRANSMIT_WINDOW;
+    ctx->rtxSsrc = getRandom32();
+    ctx->rtxSeq = (uint16_t)getRandom32();
+    ctx->resent = 0;
+    ctx->expired = 0;
+    memset(ctx->slot, 0, sizeof(ctx->slot));
+    pthread_mutex_init(&ctx->lock, NULL);
+
+    return 0;
+}
+
+void retransmitSave(RetransmitContext *ctx, const UDPPacket *packet, int count)
+{
+    uint64_t now = getMonotonicTime();
+    int i;
+
+    pthread_mutex_lock(&ctx->lock);
+    for (i = 0; i < count; i++) {
+        const uint8_t *header = (const uint8_t *)packet[i].iov[0].iov_base;
+        size_t len = packet[i].iov[0].iov_len + packet[i].iov[1].iov_len;
+        RetransmitSlot *slot = &ctx->slot[((header[2] << 8) | header[3]) % RETRANSMIT_SLOT_MAX];
+
+        if (len > RETRANSMIT_SLOT_SIZE) {
+            slot->len = 0;
+            continue;
+        }
+        memcpy(slot->data, packet[i].iov[0].iov_base, packet[i].iov[0].iov_len);
+        memcpy(slot->data + packet[i].iov[0].iov_len, packet[i].iov[1].iov_base, packet[i].iov[1].iov_len);
+        slot->len = (int)len;
+        slot->time = now;
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+/*
+ * RTX packet, RFC 4588 4
+ *
+ *  0                   1                   2                   3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |                         RTP Header                            |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |            OSN                |                               |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+                               |
+ * |                  Original RTP Packet Payload                  |
+ * |                                                               |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * the RTX stream has its own SSRC and sequence numbers, the timestamp and marker bit are kept
+ */
+static int retransmitBuildRTX(RetransmitContext *ctx, const uint8_t *pkt, int len, uint8_t *out)
+{
+    memcpy(out, pkt, RTP_HEADER_SIZE);
+    out[1] = (uint8_t)((pkt[1] & 0x80) | (ctx->rtxPayloadType & 0x7f));
+    Load16(&out[2], ctx->rtxSeq++);
+    Load32(&out[8], ctx->rtxSsrc);
+    memcpy(&out[RTP_HEADER_SIZE], &pkt[2], 2);  // OSN
+    memcpy(&out[RTP_HEADER_SIZE + 2], pkt + RTP_HEADER_SIZE, len - RTP_HEADER_SIZE);
+
+    return len + 2;
+}
+
+int retransmitResend(RetransmitContext *ctx, UDPContext *udp, const UDPDest *dst, const uint16_t *seq, int count)
+{
+    uint8_t buf[RETRANSMIT_SLOT_SIZE + 2];
+    uint64_t now = getMonotonicTime();
+    RetransmitSlot *slot;
+    int i, len, resent = 0;
+
+    for (i = 0; i < count; i++) {
+        pthread_mutex_lock(&ctx->lock);
+        slot = &ctx->slot[seq[i] % RETRANSMIT_SLOT_MAX];
+        if (slot->len == 0 || ((slot->data[2] << 8) | slot->data[3]) != seq[i] ||
+            now - slot->time > (uint64_t)ctx->window * 1000) {
+            ctx->expired++;
+            pthread_mutex_unlock(&ctx->lock);
+            continue;
+        }
+        if (ctx->rtxPayloadType > 0) {
+            len = retransmitBuildRTX(ctx, slot->data, slot->len, buf);
+        } else {
+            len = slot->len;
+            memcpy(buf, slot->data, len);
+        }
+        ctx->resent++;
+        pthread_mutex_unlock(&ctx->lock);
+
+        if (udpSendToDest(udp, dst, buf, len) == len)
+            resent++;
+    }
+
+    return resent;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_RETRANSMIT_H
+#define HISILIVE_RETRANSMIT_H
+
+#include "Network.h"
+#include <stdint.h>
+
+#define RETRANSMIT_SLOT_MAX 512    // packets kept, indexed by seq % RETRANSMIT_SLOT_MAX
+#define RETRANSMIT_SLOT_SIZE 1500  // RTP header + FU header + payload
+#define RETRANSMIT_WINDOW 1000     // ms, default age limit of a kept packet
+
+typedef struct {
+    uint8_t data[RETRANSMIT_SLOT_SIZE];
+    int len;  // 0: empty
+    uint64_t time;  // monotonic μs when sent
+} RetransmitSlot;
+
+typedef struct {
+    int window;  // ms, packets older than this are not resent
+    int rtxPayloadType;  // > 0: resend as RFC 4588 RTX stream with this payload type, 0: resend the original packet
+    uint32_t rtxSsrc;
+    uint16_t rtxSeq;
+
+    pthread_mutex_t lock;  // the packetizer saves, the RTCP thread resends
+    RetransmitSlot slot[RETRANSMIT_SLOT_MAX];
+
+    uint32_t resent;   // packets resent
+    uint32_t expired;  // requested packets no longer kept
+} RetransmitContext;
+
+int retransmitInit(RetransmitContext *ctx);
+
+/* keep a copy of the sent RTP packets */
+void retransmitSave(RetransmitContext *ctx, const UDPPacket *packet, int count);
+
+/* resend the kept packets with these sequence numbers to dst, return the number resent */
+int retransmitResend(RetransmitContext *ctx, UDPContext *udp, const UDPDest *dst, const uint16_t *seq, int count);
+
+#endif  // HISILIVE_RETRANSMIT_H
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "Segmenter.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int segmenterOutput(void *arg, const uint8_t *data, uint32_t len)
+{
+    SegmenterContext *seg = (SegmenterContext *)arg;
+    return recorderWriteData(&seg->rec, data, len);
+}
+
+/* delete the oldest finished segments while over budget */
+static void segmenterRetain(SegmenterContext *seg)
+{
+    uint64_t now = getMonotonicTime();
+    SegmentInfo *old;
+
+    while (seg->tail - seg->head > 1) {  // never the current one
+        old = &seg->segment[seg->head % SEGMENT_MAX];
+        if (!(seg->maxBytes > 0 && seg->totalBytes > seg->maxBytes) &&
+            !(seg->maxAge > 0 && now - old->start > (uint64_t)seg->maxAge * 1000000))
+            break;
+        if (unlink(old->name) < 0) {
+            LOGE("unlink %s error\n", old->name);
+        }
+        seg->totalBytes -= old->bytes;
+        seg->deleted++;
+        seg->head++;
+    }
+}
+
+static void segmenterFinish(SegmenterContext *seg)
+{
+    SegmentInfo *cur = &seg->segment[(seg->tail - 1) % SEGMENT_MAX];
+
+    cur->bytes = seg->ts.bytes;
+    seg->totalBytes += cur->bytes;
+}
+
+static int segmenterStart(SegmenterContext *seg, const MediaFrame *frame)
+{
+    SegmentInfo *cur;
+    char name[SEGMENT_NAME_MAX];
+    char date[16];  // YYYYmmdd-HHMMSS
+    time_t now = time(NULL);
+    int res, len;
+
+    if (seg->tail - seg->head == SEGMENT_MAX) {  // no budget can reach it, stop tracking the oldest
+        seg->totalBytes -= seg->segment[seg->head % SEGMENT_MAX].bytes;
+        seg->head++;
+    }
+
+    cur = &seg->segment[seg->tail % SEGMENT_MAX];
+    strftime(date, sizeof(date), "%Y%m%d-%H%M%S", localtime(&now));
+    if (now == seg->lastTime) {  // rotated within a second
+        len = snprintf(name, sizeof(name), "%s-%s-%d.ts", seg->prefix, date, ++seg->sameTime);
+    } else {
+        len = snprintf(name, sizeof(name), "%s-%s.ts", seg->prefix, date);
+        seg->sameTime = 0;
+    }
+    if (len < 0 || len >= (int)sizeof(name)) {  // a cut name could collide with the next one
+        LOGE("segment name of %s too long\n", seg->prefix);
+        return -1;
+    }
+    memcpy(cur->name, name, (size_t)len + 1);
+    seg->lastTime = now;
+    cur->bytes = 0;
+    cur->start = getMonotonicTime();
+
+    res = seg->open ? recorderReopen(&seg->rec, cur->name) : recorderOpen(&seg->rec, cur->name);
+    if (res) {
+        return -1;
+    }
+    seg->open = 1;
+    seg->tail++;
+    seg->segmentPts = frame->pts;
+    tsInit(&seg->ts);
+
+    LOGD("segment %s\n", cur->name);
+    return 0;
+}
+
+int segmenterWrite(SegmenterContext *seg, const MediaFrame *frame)
+{
+    if (!seg->open && !frame->keyFrame) {  // a segment starts with an IDR
+        seg->skipped++;
+        return 0;
+    }
+
+    if (frame->keyFrame) {
+        if (!seg->open || frame->pts - seg->segmentPts >= (uint64_t)seg->duration * 1000000) {
+            if (seg->open) {
+                segmenterFinish(seg);
+            }
+            if (segmenterStart(seg, frame)) {
+                if (seg->open) {  // the last segment is already counted, the next IDR starts cleanly
+                    recorderClose(&seg->rec);
+                    seg->open = 0;
+                }
+                return -1;
+            }
+            segmenterRetain(seg);
+        }
+        tsWriteTables(&seg->ts);  // decoders may join at any IDR
+    }
+
+    tsWriteFrame(&seg->ts, frame);
+    recorderPoll(&seg->rec);
+    return 0;
+}
+
+int segmenterOpen(SegmenterContext *seg)
+{
+    if (NULL == seg || seg->prefix[0] == '\0' || seg->duration <= 0) {
+        LOGE("segmenterOpen param error.\n");
+        return -1;
+    }
+
+    seg->ts.codec = seg->codec;
+    seg->ts.write = segmenterOutput;
+    seg->ts.arg = seg;
+    tsInit(&seg->ts);
+    seg->open = 0;
+    seg->head = seg->tail = 0;
+    seg->totalBytes = 0;
+    seg->deleted = 0;
+    seg->skipped = 0;
+    seg->lastTime = 0;
+
+    return 0;
+}
+
+void segmenterClose(SegmenterContext *seg)
+{
+    if (NULL == seg || !seg->open)
+        return;
+
+    recorderClose(&seg->rec);
+    segmenterFinish(seg);
+    segmenterDumpStats(seg);
+    seg->open = 0;
+}
+
+void segmenterDumpStats(SegmenterContext *seg)
+{
+    LOGI("segments: %u kept, %llu MB, %u deleted, %u frames before the first IDR\n", seg->tail - seg->head,
+         (unsigned long long)(seg->totalBytes >> 20), seg->deleted, seg->skipped);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_SEGMENTER_H
+#define HISILIVE_SEGMENTER_H
+
+#include "Media.h"
+#include "Recorder.h"
+#include "TS.h"
+#include <stdint.h>
+#include <time.h>
+
+#define SEGMENT_MAX 256  // segments tracked for retention, older ones are left alone
+#define SEGMENT_PREFIX_MAX 64
+#define SEGMENT_NAME_MAX (SEGMENT_PREFIX_MAX + 32)  // prefix-YYYYmmdd-HHMMSS-n.ts
+
+typedef struct {
+    char name[SEGMENT_NAME_MAX];
+    uint64_t bytes;
+    uint64_t start;  // μs, monotonic
+} SegmentInfo;
+
+/*
+ * MPEG-TS recording in segments named <prefix>-YYYYmmdd-HHMMSS.ts. A segment starts with PAT/PMT and an IDR,
+ * it is closed at the first IDR after duration seconds. After each segment the oldest ones are deleted while
+ * the total size or the age of the oldest is over its budget.
+ */
+typedef struct {
+    char prefix[SEGMENT_PREFIX_MAX];  // path and name
+    int codec;                        // 0: H.264, 1: HEVC
+    int duration;                     // s
+    uint64_t maxBytes;                // all segments, 0: no limit
+    int maxAge;                       // s, 0: no limit
+
+    RecorderContext rec;  // flushInterval and direct are set by the caller
+    TSMuxer ts;
+    int open;
+    uint64_t segmentPts;  // μs, pts of the first frame
+    time_t lastTime;      // of the last segment name
+    int sameTime;         // segments named in lastTime
+
+    SegmentInfo segment[SEGMENT_MAX];
+    uint32_t head;  // oldest segment
+    uint32_t tail;  // after the current one
+    uint64_t totalBytes;
+    uint32_t deleted;
+    uint32_t skipped;  // frames before the first IDR
+} SegmenterContext;
+
+int segmenterOpen(SegmenterContext *seg);
+
+/* mux a frame, rotating the segment at an IDR */
+int segmenterWrite(SegmenterContext *seg, const MediaFrame *frame);
+
+/* finish the current segment */
+void segmenterClose(SegmenterContext *seg);
+
+void segmenterDumpStats(SegmenterContext *seg);
+
+#endif  // HISILIVE_SEGMENTER_H
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "Source.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+int sourceRun(MediaSource *src, void (*onFrame)(void *arg, const MediaFrame *frame), void *arg, int realtime,
+              volatile int *running, SourceStats *stats)
+{
+    MediaFrame frame;
+    struct timespec ts;
+    uint64_t start = getMonotonicTime(), firstPts = 0, due, now;
+    int i, res = 0;
+
+    if (NULL == src || NULL == src->read || NULL == onFrame) {
+        LOGE("sourceRun param error.\n");
+        return -1;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    while (!running || *running) {
+        res = src->read(src, &frame);
+        if (res) {
+            break;
+        }
+
+        if (stats->frames == 0) {
+            firstPts = frame.pts;
+        }
+        if (realtime) {
+            due = start + (frame.pts - firstPts);
+            now = getMonotonicTime();
+            if (now < due) {
+                ts.tv_sec = (time_t)(due / 1000000);
+                ts.tv_nsec = (long)(due % 1000000) * 1000;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            } else if (now > due + 1000000 / (src->frameRate > 0 ? src->frameRate : 30)) {
+                stats->lateFrames++;
+            }
+        }
+
+        frame.readTime = getMonotonicTime();
+        onFrame(arg, &frame);
+
+        stats->frames++;
+        stats->keyFrames += frame.keyFrame;
+        for (i = 0; i < frame.packCount; i++) {
+            stats->bytes += frame.packs[i].len;
+        }
+    }
+    stats->elapsed = getMonotonicTime() - start;
+
+    return res < 0 ? -1 : 0;
+}
+
+void sourceClose(MediaSource *src)
+{
+    if (src && src->close) {
+        src->close(src);
+    }
+}
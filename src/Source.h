@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_SOURCE_H
+#define HISILIVE_SOURCE_H
+
+#include "Media.h"
+#include <stdint.h>
+
+typedef struct MediaSource MediaSource;
+
+/*
+ * A producer of encoded frames for the streaming path (StreamSink, RTP, recorder). read() returns 0 with the
+ * next frame, valid until the following read(), 1 at the end of the stream, or -1 on error.
+ */
+struct MediaSource {
+    const char *name;
+    int codec;      // 0: H.264, 1: H.265
+    int frameRate;  // fps
+    int (*read)(MediaSource *src, MediaFrame *frame);
+    void (*close)(MediaSource *src);
+};
+
+typedef struct {
+    uint64_t frames;
+    uint64_t keyFrames;
+    uint64_t bytes;
+    uint64_t lateFrames;  // realtime: read after their time was due
+    uint64_t elapsed;     // μs
+} SourceStats;
+
+/*
+ * Call onFrame for every frame of src until the end of the stream or *running is cleared. realtime: each frame
+ * at its pts from the first frame, else as fast as possible. Return 0 at the end of the stream, -1 on error.
+ */
+int sourceRun(MediaSource *src, void (*onFrame)(void *arg, const MediaFrame *frame), void *arg, int realtime,
+              volatile int *running, SourceStats *stats);
+
+void sourceClose(MediaSource *src);
+
+#endif  // HISILIVE_SOURCE_H
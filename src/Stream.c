@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "Stream.h"
+#include "Utils.h"
+#include <errno.h>
+#include <stdio.h>
+#include <sys/prctl.h>
+#include <time.h>
+
+static void *streamSinkThread(void *arg)
+{
+    StreamSink *sink = (StreamSink *)arg;
+    const MediaFrame *frame;
+    struct timespec ts;
+
+    prctl(PR_SET_NAME, sink->name, 0, 0, 0);
+
+    for (;;) {
+        while ((frame = frameQueueFront(&sink->queue)) != NULL) {
+            sink->onFrame(sink->arg, frame);
+            frameQueuePop(&sink->queue);
+        }
+        if (!__atomic_load_n(&sink->running, __ATOMIC_ACQUIRE))
+            break;  // drained
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        if (sem_timedwait(&sink->ready, &ts) < 0 && errno != ETIMEDOUT && errno != EINTR) {
+            LOGE("%s sem_timedwait error\n", sink->name);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+int streamSinkStart(StreamSink *sink)
+{
+    if (NULL == sink || NULL == sink->onFrame) {
+        LOGE("streamSinkStart param error.\n");
+        return -1;
+    }
+
+    if (frameQueueInit(&sink->queue, sink->queueSize ? sink->queueSize : STREAM_QUEUE_SIZE, STREAM_QUEUE_SLOTS)) {
+        return -1;
+    }
+    sink->queue.dropWatermark = sink->dropWatermark < 0 ? 0 : (sink->dropWatermark ? sink->dropWatermark : STREAM_DROP_WATERMARK);
+    sem_init(&sink->ready, 0, 0);
+
+    sink->running = 1;
+    if (pthread_create(&sink->thread, NULL, streamSinkThread, sink)) {
+        LOGE("%s pthread_create error.\n", sink->name);
+        sink->running = 0;
+        frameQueueDestroy(&sink->queue);
+        return -1;
+    }
+
+    return 0;
+}
+
+void streamSinkStop(StreamSink *sink)
+{
+    if (NULL == sink || !sink->running)
+        return;
+
+    __atomic_store_n(&sink->running, 0, __ATOMIC_RELEASE);
+    sem_post(&sink->ready);
+    pthread_join(sink->thread, NULL);
+    streamSinkDumpStats(sink);
+    sem_destroy(&sink->ready);
+    frameQueueDestroy(&sink->queue);
+}
+
+int streamSinkPush(StreamSink *sink, const MediaFrame *frame)
+{
+    int res;
+
+    if (!sink->running)
+        return -1;
+
+    res = frameQueuePush(&sink->queue, frame);
+    if (res == 0) {
+        sem_post(&sink->ready);
+    }
+    return res;
+}
+
+void streamSinkDumpStats(StreamSink *sink)
+{
+    FrameQueue *q = &sink->queue;
+
+    LOGI("%s: queue %d%%, max %u%%, frames in %u out %u, dropped full %u, until IDR %u, non-reference %u\n", sink->name,
+         frameQueueOccupancy(q), __atomic_load_n(&q->maxOccupancy, __ATOMIC_RELAXED), __atomic_load_n(&q->pushed, __ATOMIC_RELAXED),
+         __atomic_load_n(&q->popped, __ATOMIC_RELAXED), __atomic_load_n(&q->droppedFull, __ATOMIC_RELAXED),
+         __atomic_load_n(&q->droppedWaitKey, __ATOMIC_RELAXED), __atomic_load_n(&q->droppedNonRef, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_STREAM_H
+#define HISILIVE_STREAM_H
+
+#include "FrameQueue.h"
+#include "Media.h"
+#include <pthread.h>
+#include <semaphore.h>
+
+#define STREAM_QUEUE_SIZE (4 * 1024 * 1024)  // bytes of frames a sink may fall behind
+#define STREAM_QUEUE_SLOTS 64
+#define STREAM_DROP_WATERMARK 50  // %, default occupancy above which non-reference frames are skipped
+
+typedef void (*StreamFrameFunc)(void *arg, const MediaFrame *frame);
+
+/* a consumer of the encoded stream (network sender, recorder) running in its own thread */
+typedef struct {
+    const char *name;  // thread name
+    StreamFrameFunc onFrame;
+    void *arg;
+    uint32_t queueSize;  // STREAM_QUEUE_SIZE if 0
+    int dropWatermark;   // %, < 0: never skip non-reference frames, 0: STREAM_DROP_WATERMARK
+
+    FrameQueue queue;
+    sem_t ready;  // frames pushed
+    int running;
+    pthread_t thread;
+} StreamSink;
+
+int streamSinkStart(StreamSink *sink);
+
+/* stop the thread after the queued frames are consumed */
+void streamSinkStop(StreamSink *sink);
+
+/* called by the capture thread: copy the frame for the sink, never blocks; return 0 or -1 if dropped */
+int streamSinkPush(StreamSink *sink, const MediaFrame *frame);
+
+/* log occupancy and drop counters */
+void streamSinkDumpStats(StreamSink *sink);
+
+#endif  // HISILIVE_STREAM_H
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#include "TS.h"
+#include "Utils.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TS_PID_PAT 0x0000
+#define TS_STREAM_H264 0x1b
+#define TS_STREAM_HEVC 0x24
+#define TS_PES_HEADER_LEN 14  // start code, stream id, length, flags, PTS
+#define TS_PACK_MAX 64
+
+// access unit delimiters, required before each H.264 access unit in a transport stream
+static const uint8_t h264AUD[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xf0 };
+static const uint8_t hevcAUD[] = { 0x00, 0x00, 0x00, 0x01, 0x46, 0x01, 0x50 };
+
+/* bytes of a frame as one sequence: PES header, AUD, packs */
+typedef struct {
+    const uint8_t *data[2 + TS_PACK_MAX];
+    uint32_t len[2 + TS_PACK_MAX];
+    int count;
+    int index;
+    uint32_t offset;
+} TSCursor;
+
+static uint32_t tsCRC32(const uint8_t *data, int len)
+{
+    uint32_t crc = 0xffffffff;
+    int i, j;
+
+    for (i = 0; i < len; i++) {
+        crc ^= (uint32_t)data[i] << 24;
+        for (j = 0; j < 8; j++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+static int tsOutput(TSMuxer *mux, const uint8_t *packet)
+{
+    mux->bytes += TS_PACKET_SIZE;
+    return mux->write(mux->arg, packet, TS_PACKET_SIZE);
+}
+
+/*
+ * TS packet header
+ *
+ *  0                   1                   2                   3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ * |   sync 0x47   |E|S|T|          PID            |SC |AF |  CC   |
+ * +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ */
+static uint8_t *tsHeader(uint8_t *p, int pid, int start, int adaptation, uint8_t cc)
+{
+    p = Load8(p, 0x47);
+    p = Load16(p, (uint16_t)((start ? 0x4000 : 0) | (pid & 0x1fff)));
+    p = Load8(p, (uint8_t)((adaptation ? 0x30 : 0x10) | (cc & 0x0f)));
+    return p;
+}
+
+/* a PSI section in one packet, pointer field 0, padded with 0xff */
+static int tsWriteSection(TSMuxer *mux, int pid, uint8_t *cc, const uint8_t *section, int len)
+{
+    uint8_t packet[TS_PACKET_SIZE];
+    uint8_t *p;
+    uint32_t crc = tsCRC32(section, len);
+
+    memset(packet, 0xff, sizeof(packet));
+    p = tsHeader(packet, pid, 1, 0, (*cc)++);
+    p = Load8(p, 0);  // pointer field
+    memcpy(p, section, len);
+    Load32(p + len, crc);
+
+    return tsOutput(mux, packet);
+}
+
+int tsWriteTables(TSMuxer *mux)
+{
+    uint8_t section[32];
+    uint8_t *p;
+
+    // PAT: program 1 in TS_PID_PMT
+    p = Load8(section, 0x00);    // table id
+    p = Load16(p, 0xb000 | 13);  // section syntax, length
+    p = Load16(p, 1);            // transport stream id
+    p = Load8(p, 0xc1);          // version 0, current
+    p = Load8(p, 0);             // section number
+    p = Load8(p, 0);             // last section number
+    p = Load16(p, 1);            // program number
+    p = Load16(p, 0xe000 | TS_PID_PMT);
+    if (tsWriteSection(mux, TS_PID_PAT, &mux->ccPAT, section, (int)(p - section)) < 0)
+        return -1;
+
+    // PMT: one video stream, also carrying the PCR
+    p = Load8(section, 0x02);
+    p = Load16(p, 0xb000 | 18);
+    p = Load16(p, 1);  // program number
+    p = Load8(p, 0xc1);
+    p = Load8(p, 0);
+    p = Load8(p, 0);
+    p = Load16(p, 0xe000 | TS_PID_VIDEO);  // PCR PID
+    p = Load16(p, 0xf000);                 // program info length
+    p = Load8(p, mux->codec == 0 ? TS_STREAM_H264 : TS_STREAM_HEVC);
+    p = Load16(p, 0xe000 | TS_PID_VIDEO);
+    p = Load16(p, 0xf000);  // ES info length
+    return tsWriteSection(mux, TS_PID_PMT, &mux->ccPMT, section, (int)(p - section));
+}
+
+static void tsCursorRead(TSCursor *cur, uint8_t *dst, uint32_t len)
+{
+    uint32_t n;
+
+    while (len > 0 && cur->index < cur->count) {
+        n = cur->len[cur->index] - cur->offset;
+        if (n > len)
+            n = len;
+        memcpy(dst, cur->data[cur->index] + cur->offset, n);
+        dst += n;
+        len -= n;
+        cur->offset += n;
+        if (cur->offset == cur->len[cur->index]) {
+            cur->index++;
+            cur->offset = 0;
+        }
+    }
+}
+
+/*
+ * PES header, no length for video
+ *
+ * 00 00 01 E0 | 00 00 | 80 | 80 (PTS only) | 05 | PTS (5 bytes)
+ */
+static void tsPESHeader(uint8_t *p, uint64_t pts)
+{
+    p = Load8(p, 0x00);
+    p = Load16(p, 0x0001);
+    p = Load8(p, 0xe0);  // video stream 0
+    p = Load16(p, 0);    // unbounded
+    p = Load8(p, 0x80);
+    p = Load8(p, 0x80);  // PTS, DTS = PTS without B frames
+    p = Load8(p, 5);
+    p = Load8(p, (uint8_t)(0x21 | ((pts >> 29) & 0x0e)));
+    p = Load16(p, (uint16_t)(((pts >> 14) & 0xfffe) | 1));
+    Load16(p, (uint16_t)(((pts << 1) & 0xfffe) | 1));
+}
+
+int tsWriteFrame(TSMuxer *mux, const MediaFrame *frame)
+{
+    uint8_t packet[TS_PACKET_SIZE];
+    uint8_t pes[TS_PES_HEADER_LEN];
+    uint64_t pcr = (frame->pts * 9 / 100) & 0x1ffffffffULL;  // μs to 90 kHz
+    uint64_t pts = (pcr + TS_PTS_DELAY) & 0x1ffffffffULL;
+    uint32_t total, payload, afLen;
+    TSCursor cur;
+    uint8_t *p;
+    int i, first = 1;
+
+    tsPESHeader(pes, pts);
+    cur.count = 0;
+    cur.data[cur.count] = pes;
+    cur.len[cur.count++] = TS_PES_HEADER_LEN;
+    cur.data[cur.count] = mux->codec == 0 ? h264AUD : hevcAUD;
+    cur.len[cur.count++] = mux->codec == 0 ? sizeof(h264AUD) : sizeof(hevcAUD);
+    total = cur.len[0] + cur.len[1];
+    for (i = 0; i < frame->packCount; i++) {
+        if (cur.count == sizeof(cur.len) / sizeof(cur.len[0])) {
+            LOGE("too many packs %d\n", frame->packCount);
+            return -1;
+        }
+        cur.data[cur.count] = frame->packs[i].data;
+        cur.len[cur.count++] = frame->packs[i].len;
+        total += frame->packs[i].len;
+    }
+    cur.index = 0;
+    cur.offset = 0;
+
+    while (total > 0) {
+        // adaptation field: PCR and random access in the first packet, stuffing in the last
+        afLen = first ? 8 : 0;
+        payload = TS_PACKET_SIZE - 4 - afLen;
+        if (total < payload) {
+            afLen += payload - total;
+            payload = total;
+        }
+
+        p = tsHeader(packet, TS_PID_VIDEO, first, afLen > 0, mux->ccVideo++);
+        if (afLen > 0) {
+            p = Load8(p, (uint8_t)(afLen - 1));
+            if (afLen > 1) {
+                uint8_t flags = first ? 0x10 : 0;  // PCR
+                if (first && frame->keyFrame)
+                    flags |= 0x40;  // random access
+                p = Load8(p, flags);
+                if (first) {
+                    p = Load32(p, (uint32_t)(pcr >> 1));
+                    p = Load8(p, (uint8_t)(((pcr & 1) << 7) | 0x7e));
+                    p = Load8(p, 0);  // extension
+                }
+                memset(p, 0xff, packet + TS_PACKET_SIZE - payload - p);
+                p = packet + TS_PACKET_SIZE - payload;
+            }
+        }
+        tsCursorRead(&cur, p, payload);
+        total -= payload;
+        first = 0;
+
+        if (tsOutput(mux, packet) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+void tsInit(TSMuxer *mux)
+{
+    mux->ccPAT = 0;
+    mux->ccPMT = 0;
+    mux->ccVideo = 0;
+    mux->bytes = 0;
+}
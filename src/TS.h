@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+#ifndef HISILIVE_TS_H
+#define HISILIVE_TS_H
+
+#include "Media.h"
+#include <stdint.h>
+
+#define TS_PACKET_SIZE 188
+#define TS_PID_PMT 0x1000
+#define TS_PID_VIDEO 0x100  // also the PCR PID
+#define TS_PTS_DELAY 9000   // 90 kHz, PTS ahead of PCR
+
+typedef int (*TSWriteFunc)(void *arg, const uint8_t *data, uint32_t len);
+
+/* MPEG-2 transport stream muxer, one H.264/HEVC video program */
+typedef struct {
+    int codec;  // 0: H.264, 1: HEVC, as RTPMuxContext payload_type
+    TSWriteFunc write;
+    void *arg;
+
+    uint8_t ccPAT;
+    uint8_t ccPMT;
+    uint8_t ccVideo;
+    uint64_t bytes;  // written through write
+} TSMuxer;
+
+/* reset continuity counters and the byte count, for a new file */
+void tsInit(TSMuxer *mux);
+
+/* PAT and PMT, at the start of a file and before key frames */
+int tsWriteTables(TSMuxer *mux);
+
+/* one access unit as a PES packet, with PCR; key frames are marked random access */
+int tsWriteFrame(TSMuxer *mux, const MediaFrame *frame);
+
+#endif  // HISILIVE_TS_H
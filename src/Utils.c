@@ -8,6 +8,14 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && defined(__arm__)
+#include <sys/auxv.h>
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1 << 12)
+#endif
+#endif
 
 uint8_t *Load8(uint8_t *p, uint8_t x)
 {
@@ -29,17 +37,6 @@ uint8_t *Load32(uint8_t *p, uint32_t x)
     return p;
 }
 
-int writeFile(char *filename, char *data, int len, int append) {
-    FILE *fp = fopen(filename, append ? "a+" : "w+");
-    if (!fp)
-        return -1;
-
-    fwrite(data, 1, len, fp);
-
-    fclose(fp);
-    return 0;
-}
-
 void dumpHex(const uint8_t *ptr, int len)
 {
     int i;
@@ -56,4 +53,81 @@ char *getCurrentTime()
     time_t currentTime = time(NULL);
     strftime(ts, 20, "%Y-%m-%d %H:%M:%S", localtime(&currentTime));
     return ts;
-}
\ No newline at end of file
+}
+
+uint64_t getMonotonicTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+uint32_t getRandom32(void)
+{
+    uint32_t r = 0;
+    FILE *fp = fopen("/dev/urandom", "rb");
+
+    if (!fp || fread(&r, sizeof(r), 1, fp) != 1) {
+        srand((unsigned)time(NULL) ^ (unsigned)getpid());
+        r = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    }
+    if (fp)
+        fclose(fp);
+
+    return r;
+}
+
+int getCPUSimd(const char **name)
+{
+    static const char *names[] = {"C", "SSE2", "AVX2", "NEON"};
+    static int simd = -1;
+    int level = __atomic_load_n(&simd, __ATOMIC_RELAXED);
+
+    if (level < 0) {
+        level = CPU_SIMD_NONE;
+#if defined(__SSE2__)
+        level = CPU_SIMD_SSE2;
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            level = CPU_SIMD_AVX2;
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#if defined(__arm__)  // optional on ARMv7, always there on AArch64
+        if (getauxval(AT_HWCAP) & HWCAP_NEON)
+#endif
+            level = CPU_SIMD_NEON;
+#endif
+        __atomic_store_n(&simd, level, __ATOMIC_RELAXED);  // the same result in any thread racing here
+    }
+
+    if (name)
+        *name = names[level];
+    return level;
+}
+
+int base64Encode(const uint8_t *in, int len, char *out)
+{
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    int i, n = 0;
+
+    for (i = 0; i + 2 < len; i += 3) {
+        out[n++] = table[in[i] >> 2];
+        out[n++] = table[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+        out[n++] = table[((in[i + 1] & 0x0F) << 2) | (in[i + 2] >> 6)];
+        out[n++] = table[in[i + 2] & 0x3F];
+    }
+
+    if (i < len) {
+        out[n++] = table[in[i] >> 2];
+        if (i + 1 < len) {
+            out[n++] = table[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+            out[n++] = table[(in[i + 1] & 0x0F) << 2];
+        } else {
+            out[n++] = table[(in[i] & 0x03) << 4];
+            out[n++] = '=';
+        }
+        out[n++] = '=';
+    }
+
+    out[n] = '\0';
+    return n;
+}
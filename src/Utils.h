@@ -5,43 +5,18 @@
 #ifndef HISILIVE_UTILS_H
 #define HISILIVE_UTILS_H
 
+#include "Log.h"
 #include <stdint.h>
 
-#define LOG(fmt...)                                                                                                                        \
-    do {                                                                                                                                   \
-        printf("[%s:%d]:", __FUNCTION__, __LINE__);                                                                                        \
-        printf(fmt);                                                                                                                       \
-    } while (0)
-
-#define LOGD(fmt...)                                                                                                                       \
-    do {                                                                                                                                   \
-        printf("\033[32m");                                                                                                                \
-        printf("[%s:%d]:", __FUNCTION__, __LINE__);                                                                                        \
-        printf(fmt);                                                                                                                       \
-        printf("\033[0m");                                                                                                                 \
-    } while (0)
-
-#define GREEN(fmt...)                                                                                                                      \
-    do {                                                                                                                                   \
-        printf("\033[32m");                                                                                                                \
-        printf(fmt);                                                                                                                       \
-        printf("\033[0m");                                                                                                                 \
-    } while (0)
-
-#define LOGE(fmt...)                                                                                                                       \
-    do {                                                                                                                                   \
-        printf("\033[31m");                                                                                                                \
-        printf("[%s:%d]:", __FUNCTION__, __LINE__);                                                                                        \
-        printf(fmt);                                                                                                                       \
-        printf("\033[0m");                                                                                                                 \
-    } while (0)
-
-#define RED(fmt...)                                                                                                                        \
-    do {                                                                                                                                   \
-        printf("\033[31m");                                                                                                                \
-        printf(fmt);                                                                                                                       \
-        printf("\033[0m");                                                                                                                 \
-    } while (0)
+// SIMD kernels of this CPU, each one implies the ones before it of the same architecture
+// clang-format off
+enum {
+    CPU_SIMD_NONE,
+    CPU_SIMD_SSE2,  // x86, always with an SSE2 build
+    CPU_SIMD_AVX2,
+    CPU_SIMD_NEON
+};
+// clang-format on
 
 uint8_t *Load8(uint8_t *p, uint8_t x);
 
@@ -49,10 +24,20 @@ uint8_t *Load16(uint8_t *p, uint16_t x);
 
 uint8_t *Load32(uint8_t *p, uint32_t x);
 
-int writeFile(char *filename, char *data, int len, int append);
-
 void dumpHex(const uint8_t *ptr, int len);
 
 char *getCurrentTime();
 
+/* monotonic clock in μs */
+uint64_t getMonotonicTime(void);
+
+/* random number for SSRCs, from /dev/urandom */
+uint32_t getRandom32(void);
+
+/* the best SIMD level of this CPU the build has kernels for, probed once; name is set to e.g. "AVX2" */
+int getCPUSimd(const char **name);
+
+/* base64 encode len bytes into out (4 * (len + 2) / 3 + 1 bytes), return the string length */
+int base64Encode(const uint8_t *in, int len, char *out);
+
 #endif  // HISILIVE_UTILS_H
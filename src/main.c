@@ -9,6 +9,7 @@ extern "C" {
 #endif
 #endif /* End of #ifdef __cplusplus */
 
+#include <errno.h>
 #include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
@@ -16,13 +17,34 @@ extern "C" {
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/epoll.h>
 #include <sys/prctl.h>
 
+#include "Event.h"
+#include "FEC.h"
+#include "GopCache.h"
+#include "Latency.h"
+#include "Media.h"
+#include "Metrics.h"
 #include "Network.h"
+#include "Pacer.h"
+#include "RTCP.h"
 #include "RTP.h"
+#include "RTSP.h"
+#include "Recorder.h"
+#include "Retransmit.h"
+#include "Segmenter.h"
+#include "Stream.h"
 #include "Utils.h"
 #include "sample_comm.h"
 
+#define DEFAULT_RTP_PORT 1234
+#define PACK_POOL_MIN 8    // packs of a frame without slice split: VPS/SPS/PPS/SEI + slice
+#define PACK_POOL_EXTRA 4  // non-slice packs in a frame, per slice the pool has one more
+#define LIVE_CHN_MAX 2     // main stream + sub stream
+#define VENC_DRAIN_MAX 4   // frames taken from an encoder per wakeup
+#define PTS_SYNC_INTERVAL 1000000  // μs between reads of the encoder PTS clock
+
 // clang-format off
 typedef enum {
     MODE_FILE,
@@ -34,16 +56,81 @@ typedef struct {
     RunMode mode;                // -m
     int frameRate;               // -f
     int bitRate;                 // -b
-    char ip[16];                 // -i
+    char ip[UDP_DEST_MAX][16];   // -i, repeatable
+    int port[UDP_DEST_MAX];      // -i ip:port
+    int ipCount;
     PAYLOAD_TYPE_E videoFormat;  // -e
     PIC_SIZE_E videoSize;        // -s
+    int subStream;               // -a, 1: a second encoder channel
+    PIC_SIZE_E subSize;          // -a size
+    PAYLOAD_TYPE_E subFormat;    // -a size,264|265, default as -e
+    int subBitRate;              // -a size,format,kbps, default by size
+    char subIp[16];              // -a size,format,kbps,ip[:port], "": only RTSP sessions
+    int subPort;
+    int batchSize;               // -n
+    int gso;                     // -n n,gso: FU-A runs as one UDP_SEGMENT send
+    int rtspPort;                // -r, 0: no RTSP server
+    int pacing;                  // -p, % of the frame interval, 0: no pacing
+    int nackWindow;              // -t, ms of sent packets kept for NACK, 0: no retransmission
+    int rtxPayloadType;          // -x, RFC 4588 RTX payload type, 0: resend in the original stream
+    int fecGroup;                // -u, media packets per FEC packet, 0: no FEC
+    int fecGroupKey;             // -u n,k: in key frames
+    int gopCacheRate;            // -c, times the bitrate a new RTSP session is sent the current GOP at, 0: no GOP cache
+    int gopCacheAge;             // -c n,ms: request an IDR instead of sending an older GOP, 0: never
+    int dropWatermark;           // -q, queue occupancy % above which non-reference frames are dropped
+    int flushInterval;           // -w, ms between writes of a partly filled recording buffer
+    int directIO;                // -w ms,direct: record with O_DIRECT
+    int segmentDuration;         // -g, s of an MPEG-TS segment, 0: one raw stream file
+    int keepSize;                // -k, MB of segments kept, 0: no limit
+    int keepTime;                // -k MB,min: minutes of segments kept, 0: no limit
+    int preRoll;                 // -v, s kept in memory before an event, 0: record continuously
+    int postRoll;                // -v pre,post: s recorded after the last trigger
+    int preRollMemory;           // -v pre,post,KB: memory of the pre-roll ring
+    int metricsPort;             // -d, HTTP port of the metrics endpoint, 0: none
 } ParamOption;
 
+/* an encoder channel and everything it is streamed with: packetizer state, SSRC, receivers and RTSP server */
+typedef struct {
+    VENC_CHN VencChn;
+    VPSS_CHN VpssChn;
+    PAYLOAD_TYPE_E enPayload;
+    PIC_SIZE_E enSize;
+    int bitRate;   // kbps
+    int rtspPort;  // 0: no RTSP server
+
+    RTPMuxContext rtp;
+    UDPContext udp;
+    RTCPContext rtcp;
+    PacerContext pacer;
+    RetransmitContext history;
+    FECContext fec;
+    GopCache gop;
+    RTSPServer rtsp;
+    StreamSink sender;
+    uint64_t frames;
+    LatencyStats latency;  // encode/get/hold added by the capture thread, queue/send/total by the sender thread
+} LiveChannel;
+
+/* pack descriptors of a channel, allocated before streaming and reused for every frame */
+typedef struct {
+    VENC_PACK_S *pstPack;  // for HI_MPI_VENC_GetStream
+    MediaPack *packs;      // the same packs as seen by the streaming path
+    HI_U32 u32Size;
+} PackPool;
+
 ParamOption gParamOption;
-static RTPMuxContext gRTPCtx;
-static UDPContext gUDPCtx;
+static LiveChannel gChannel[LIVE_CHN_MAX];
+static int gChannelCount;
+static StreamSink gRecorderSink[VENC_MAX_CHN_NUM];
+static RecorderContext gRecorder[VENC_MAX_CHN_NUM];
+static SegmenterContext gSegmenter[VENC_MAX_CHN_NUM];
+static EventContext gEvent[VENC_MAX_CHN_NUM];
 static pthread_t gMediaProcPid;
 static SAMPLE_VENC_GETSTREAM_PARA_S gMediaProcPara;
+static HI_U32 gStreamAllocs;  // heap allocations of the stream loop, constant once streaming
+static int64_t gPtsOffset;    // monotonic clock - encoder PTS clock, μs, 0: unknown
+static CaptureCounters gCapture[VENC_MAX_CHN_NUM];  // written by the capture thread
+static MetricsServer gMetrics;
 
 void HisiLive_ShowUsage(char *sPrgNm)
 {
@@ -53,18 +140,56 @@ void HisiLive_ShowUsage(char *sPrgNm)
     printf("\t -e: video decode format, default H.264.\n");
     printf("\t -f: frame rate, default 24 fps.\n");
     printf("\t -b: bitrate, default 1024 kbps.\n");
-    printf("\t -i: IP, default 192.168.1.100.\n");
+    printf("\t -i: IP[:port] of a receiver, repeat for up to %d receivers, default 192.168.1.100:%d.\n", UDP_DEST_MAX,
+           DEFAULT_RTP_PORT);
     printf("\t -s: video size: 1080p/720p/360p/CIF, default 1080p\n");
+    printf("\t -a: size[,264|265[,kbps[,IP[:port]]]]: a sub stream from a second encoder with its own RTP stream, e.g. 360p,\n"
+           "\t     RTSP on port + 1, default format as -e, bitrate by size, no receiver.\n");
+    printf("\t -n: n[,gso]: RTP packets per sendmmsg, with gso the FU-A fragments of a NAL in one UDP_SEGMENT sendmsg,\n"
+           "\t     default %d, no GSO.\n", RTP_BATCH_MAX);
+    printf("\t -r: RTSP server port, e.g. 554, default no RTSP server.\n");
+    printf("\t -p: pace each frame over this %% of the frame interval, (0, 100], default no pacing.\n");
+    printf("\t -t: resend packets NACKed within this many ms, e.g. %d, default no retransmission.\n", RETRANSMIT_WINDOW);
+    printf("\t -x: RTX payload type of retransmissions (RFC 4588), e.g. 97, default resend in the original stream.\n");
+    printf("\t -u: n[,k]: one ULPFEC packet per n media packets, per k in key frames, e.g. 10,4, default no FEC.\n");
+    printf("\t -c: n[,ms]: RTSP sessions start with the current GOP sent at n times the bitrate, e.g. %d,\n"
+           "\t     request an IDR instead if it is older than ms, default no GOP cache.\n",
+           GOP_CACHE_RATE);
+    printf("\t -w: ms[,direct]: file mode, write buffered frames at least this often, with O_DIRECT, default %d.\n",
+           RECORDER_FLUSH_INTERVAL);
+    printf("\t -g: file mode, record MPEG-TS segments of this many seconds, cut at IDR, default one raw stream file.\n");
+    printf("\t -k: MB[,min]: delete the oldest segments over this size or age, 0: no limit, default no limit.\n");
+    printf("\t -v: pre[,post[,KB]]: file mode, record only around events (SIGUSR1 or \"trigger\" to UDP 127.0.0.1:%d),\n"
+           "\t     with pre seconds before, default post %d s, KB of memory for pre-roll, default from bitrate.\n",
+           EVENT_CONTROL_PORT, EVENT_POST_ROLL);
+    printf("\t -q: drop non-reference frames when the send queue is over this %%, 100: never, default %d.\n", STREAM_DROP_WATERMARK);
+    printf("\t -l: log level: 0 errors, 1 and summaries, 2 and debug, default %d.\n", LOG_LEVEL_DEBUG);
+    printf("\t -d: serve Prometheus metrics on http://IP:port/metrics, e.g. %d, default no metrics.\n", METRICS_PORT);
     printf("Default parameters: %s -m rtp -e 264 -f 30 -b 1024 -s 720p -i 192.168.1.100\n", sPrgNm);
     printf("\033[0m");
 
     return;
 }
 
+static const char *HisiLive_SizeName(PIC_SIZE_E enSize)
+{
+    if (enSize == PIC_1080P) {
+        return "1080P";
+    } else if (enSize == PIC_720P) {
+        return "720P";
+    } else if (enSize == PIC_360P) {
+        return "360p";
+    } else if (enSize == PIC_CIF) {
+        return "CIF";
+    }
+    return "unknown";
+}
+
 void printParamOptions(ParamOption *options)
 {
-    char buff[256] = { 0 };
-    char *mode, *format, *resolution;
+    char buff[512] = { 0 };
+    char *mode, *format;
+    int i, len;
 
     if (options->mode == MODE_FILE) {
         mode = "File";
@@ -82,27 +207,93 @@ void printParamOptions(ParamOption *options)
         format = "unknown";
     }
 
-    if (options->videoSize == PIC_1080P) {
-        resolution = "1080P";
-    } else if (options->videoSize == PIC_720P) {
-        resolution = "720P";
-    } else if (options->videoSize == PIC_360P) {
-        resolution = "360p";
-    } else if (options->videoSize == PIC_CIF) {
-        resolution = "CIF";
-    } else {
-        resolution = "unknown";
+    len = sprintf(buff, "mode:%s, format:%s, framerate: %dfps, bitrate: %dkb/s, resolution: %s, to ip:", mode, format, options->frameRate,
+                  options->bitRate, HisiLive_SizeName(options->videoSize));
+    for (i = 0; i < options->ipCount; i++) {
+        len += sprintf(buff + len, " %s:%d", options->ip[i], options->port[i]);
+    }
+    if (options->subStream) {
+        len += sprintf(buff + len, "; sub stream format:%s, bitrate: %dkb/s, resolution: %s, to ip: %s:%d",
+                       options->subFormat == PT_H264 ? "H.264" : "H.265", options->subBitRate, HisiLive_SizeName(options->subSize),
+                       options->subIp[0] ? options->subIp : "-", options->subPort);
     }
-
-    sprintf(buff, "mode:%s, format:%s, framerate: %dfps, bitrate: %dkb/s, to ip: %s, resolution: %s", mode, format, options->frameRate,
-            options->bitRate, options->ip, resolution);
 
     LOGD("%s\n", buff);
-    writeFile("log.txt", buff, strlen(buff), 1);
 
     return;
 }
 
+static int HisiLive_ParseSize(const char *arg, PIC_SIZE_E *penSize)
+{
+    if (!strcmp(arg, "1080p") || !strcmp(arg, "1080P")) {
+        *penSize = PIC_1080P;
+    } else if (!strcmp(arg, "720p") || !strcmp(arg, "720P")) {
+        *penSize = PIC_720P;
+    } else if (!strcmp(arg, "360p") || !strcmp(arg, "360")) {
+        *penSize = PIC_360P;
+    } else if (!strcmp(arg, "CIF") || !strcmp(arg, "cif")) {
+        *penSize = PIC_CIF;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int HisiLive_ParseFormat(const char *arg, PAYLOAD_TYPE_E *penFormat)
+{
+    if (strstr(arg, "264") || !strcmp(arg, "AVC") || !strcmp(arg, "avc")) {
+        *penFormat = PT_H264;
+    } else if (strstr(arg, "265") || !strcmp(arg, "HEVC") || !strcmp(arg, "hevc")) {
+        *penFormat = PT_H265;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int HisiLive_DefaultBitRate(PIC_SIZE_E enSize, int frameRate)
+{
+    if (enSize == PIC_1080P) {
+        return 2048 * frameRate / 30;
+    } else if (enSize == PIC_720P) {
+        return 1024 * frameRate / 30;
+    } else {
+        return 512 * frameRate / 30;
+    }
+}
+
+/* -a size[,format[,kbps[,ip[:port]]]] */
+static int HisiLive_ParseSubStream(char *arg)
+{
+    char *tok, *save = NULL, *colon;
+    int n;
+
+    gParamOption.subStream = 1;
+    for (n = 0, tok = strtok_r(arg, ",", &save); tok; n++, tok = strtok_r(NULL, ",", &save)) {
+        if (n == 0 && HisiLive_ParseSize(tok, &gParamOption.subSize)) {
+            return -1;
+        } else if (n == 1 && HisiLive_ParseFormat(tok, &gParamOption.subFormat)) {
+            return -1;
+        } else if (n == 2) {
+            gParamOption.subBitRate = atoi(tok);
+            if (gParamOption.subBitRate <= 0 || gParamOption.subBitRate > 4096)
+                return -1;
+        } else if (n == 3) {
+            colon = strchr(tok, ':');
+            gParamOption.subPort = colon ? atoi(colon + 1) : DEFAULT_RTP_PORT + 2;
+            if (colon)
+                *colon = '\0';
+            if (inet_addr(tok) == INADDR_NONE || strlen(tok) >= 16 || gParamOption.subPort <= 0 || gParamOption.subPort > 65535)
+                return -1;
+            sprintf(gParamOption.subIp, "%s", tok);
+        } else if (n > 3) {
+            return -1;
+        }
+    }
+
+    return n > 0 ? 0 : -1;
+}
+
 int HisiLive_ParseParam(int argc, char **argv)
 {
     int ret = 0;
@@ -114,11 +305,36 @@ int HisiLive_ParseParam(int argc, char **argv)
     gParamOption.mode = MODE_RTP;
     gParamOption.frameRate = 30;  // fps
     gParamOption.bitRate = 0;     // kbps
-    sprintf(gParamOption.ip, "%s", "192.168.1.100");
+    gParamOption.ipCount = 0;
     gParamOption.videoSize = PIC_720P;
     gParamOption.videoFormat = PT_H264;  // H.264
-
-    while ((ret = getopt(argc, argv, ":m:e:f:b:i:s:")) != -1) {
+    gParamOption.subStream = 0;
+    gParamOption.subSize = PIC_360P;
+    gParamOption.subFormat = PT_BUTT;  // as the main stream
+    gParamOption.subBitRate = 0;
+    gParamOption.subIp[0] = '\0';
+    gParamOption.subPort = 0;
+    gParamOption.batchSize = RTP_BATCH_MAX;
+    gParamOption.rtspPort = 0;
+    gParamOption.pacing = 0;
+    gParamOption.nackWindow = 0;
+    gParamOption.rtxPayloadType = 0;
+    gParamOption.fecGroup = 0;
+    gParamOption.fecGroupKey = 0;
+    gParamOption.dropWatermark = STREAM_DROP_WATERMARK;
+    gParamOption.gopCacheRate = 0;
+    gParamOption.gopCacheAge = 0;
+    gParamOption.flushInterval = RECORDER_FLUSH_INTERVAL;
+    gParamOption.directIO = 0;
+    gParamOption.segmentDuration = 0;
+    gParamOption.keepSize = 0;
+    gParamOption.keepTime = 0;
+    gParamOption.preRoll = 0;
+    gParamOption.postRoll = EVENT_POST_ROLL;
+    gParamOption.preRollMemory = 0;
+    gParamOption.metricsPort = 0;
+
+    while ((ret = getopt(argc, argv, ":m:e:f:b:i:s:a:n:r:p:t:x:u:c:q:w:g:k:v:d:l:")) != -1) {
         switch (ret) {
             case ('m'):
                 LOGD("-m: %s \n", optarg);
@@ -133,16 +349,11 @@ int HisiLive_ParseParam(int argc, char **argv)
                 break;
             case ('e'):
                 LOGD("-e: %s\n", optarg);
-                if (strstr(optarg, "264") || !strcmp(optarg, "AVC") || !strcmp(optarg, "avc")) {
-                    gParamOption.videoFormat = PT_H264;
-                    LOGD("PT_H264\n");
-                } else if (strstr(optarg, "265") || !strcmp(optarg, "HEVC") || !strcmp(optarg, "hevc")) {
-                    gParamOption.videoFormat = PT_H265;
-                    LOGD("PT_H265\n");
-                } else {
+                if (HisiLive_ParseFormat(optarg, &gParamOption.videoFormat)) {
                     LOGE("VedeoFormat is invalid.\n");
                     return -1;
                 }
+                LOGD("%s\n", gParamOption.videoFormat == PT_H264 ? "PT_H264" : "PT_H265");
                 break;
             case ('f'):
                 LOGD("-f: %s\n", optarg);
@@ -166,28 +377,193 @@ int HisiLive_ParseParam(int argc, char **argv)
                 break;
             case ('i'):
                 LOGD("-i: %s\n", optarg);
-                if (inet_addr(optarg) == INADDR_NONE) {
+                if (gParamOption.ipCount >= UDP_DEST_MAX) {
+                    LOGE("too many receivers, max %d.\n", UDP_DEST_MAX);
+                    return -1;
+                }
+                char *colon = strchr(optarg, ':');
+                int port = DEFAULT_RTP_PORT;
+                if (colon) {
+                    *colon = '\0';
+                    port = atoi(colon + 1);
+                }
+                if (inet_addr(optarg) == INADDR_NONE || strlen(optarg) >= 16 || port <= 0 || port > 65535) {
                     LOGE("IP is invalid.\n");
                     return -1;
                 } else {
-                    sprintf(gParamOption.ip, "%s", optarg);
+                    sprintf(gParamOption.ip[gParamOption.ipCount], "%s", optarg);
+                    gParamOption.port[gParamOption.ipCount++] = port;
                 }
                 break;
             case ('s'):
                 LOGD("-s: %s\n", optarg);
-                if (!strcmp(optarg, "1080p") || !strcmp(optarg, "1080P")) {
-                    gParamOption.videoSize = PIC_1080P;
-                } else if (!strcmp(optarg, "720p") || !strcmp(optarg, "720P")) {
-                    gParamOption.videoSize = PIC_720P;
-                } else if (!strcmp(optarg, "360p") || !strcmp(optarg, "360")) {
-                    gParamOption.videoSize = PIC_360P;
-                } else if (!strcmp(optarg, "CIF") || !strcmp(optarg, "cif")) {
-                    gParamOption.videoSize = PIC_CIF;
-                } else {
+                if (HisiLive_ParseSize(optarg, &gParamOption.videoSize)) {
                     LOGE("VedeoSize is invalid.\n");
                     return -1;
                 }
                 break;
+            case ('a'):
+                LOGD("-a: %s\n", optarg);
+                if (HisiLive_ParseSubStream(optarg)) {
+                    LOGE("sub stream is invalid.\n");
+                    return -1;
+                }
+                break;
+            case ('n'):
+                LOGD("-n: %s\n", optarg);
+                char *offload = strchr(optarg, ',');
+                int n = atoi(optarg);
+                if (n <= 0 || n > RTP_BATCH_MAX || (offload && strcmp(offload + 1, "gso"))) {
+                    LOGE("batch size is not in (0, %d] or not followed by ,gso\n", RTP_BATCH_MAX);
+                    return -1;
+                } else {
+                    gParamOption.batchSize = n;
+                    gParamOption.gso = offload != NULL;
+                }
+                break;
+            case ('r'):
+                LOGD("-r: %s\n", optarg);
+                int r = atoi(optarg);
+                if (r <= 0 || r > 65535) {
+                    LOGE("RTSP port is invalid.\n");
+                    return -1;
+                } else {
+                    gParamOption.rtspPort = r;
+                }
+                break;
+            case ('p'):
+                LOGD("-p: %s\n", optarg);
+                int p = atoi(optarg);
+                if (p <= 0 || p > 100) {
+                    LOGE("pacing is not in (0, 100]\n");
+                    return -1;
+                } else {
+                    gParamOption.pacing = p;
+                }
+                break;
+            case ('t'):
+                LOGD("-t: %s\n", optarg);
+                int t = atoi(optarg);
+                if (t <= 0 || t > 10000) {
+                    LOGE("NACK window is not in (0, 10000] ms\n");
+                    return -1;
+                } else {
+                    gParamOption.nackWindow = t;
+                }
+                break;
+            case ('x'):
+                LOGD("-x: %s\n", optarg);
+                int x = atoi(optarg);
+                if (x <= 96 || x > 127) {
+                    LOGE("RTX payload type is not in (96, 127]\n");
+                    return -1;
+                } else {
+                    gParamOption.rtxPayloadType = x;
+                }
+                break;
+            case ('u'):
+                LOGD("-u: %s\n", optarg);
+                char *comma = strchr(optarg, ',');
+                int u = atoi(optarg);
+                int k = comma ? atoi(comma + 1) : u;
+                if (u <= 0 || u > FEC_GROUP_MAX || k <= 0 || k > FEC_GROUP_MAX) {
+                    LOGE("FEC group size is not in (0, %d]\n", FEC_GROUP_MAX);
+                    return -1;
+                } else {
+                    gParamOption.fecGroup = u;
+                    gParamOption.fecGroupKey = k;
+                }
+                break;
+            case ('c'):
+                LOGD("-c: %s\n", optarg);
+                char *idrAge = strchr(optarg, ',');
+                int c = atoi(optarg);
+                if (c < 2 || c > 16) {
+                    LOGE("GOP burst rate is not in [2, 16] times the bitrate\n");
+                    return -1;
+                } else {
+                    gParamOption.gopCacheRate = c;
+                    gParamOption.gopCacheAge = idrAge ? atoi(idrAge + 1) : 0;
+                }
+                break;
+            case ('q'):
+                LOGD("-q: %s\n", optarg);
+                int q = atoi(optarg);
+                if (q <= 0 || q > 100) {
+                    LOGE("drop watermark is not in (0, 100]\n");
+                    return -1;
+                } else {
+                    gParamOption.dropWatermark = q;
+                }
+                break;
+            case ('w'):
+                LOGD("-w: %s\n", optarg);
+                int w = atoi(optarg);
+                if (w <= 0 || w > 60000) {
+                    LOGE("flush interval is not in (0, 60000] ms\n");
+                    return -1;
+                } else {
+                    gParamOption.flushInterval = w;
+                    gParamOption.directIO = strstr(optarg, ",direct") != NULL;
+                }
+                break;
+            case ('g'):
+                LOGD("-g: %s\n", optarg);
+                int g = atoi(optarg);
+                if (g <= 0 || g > 3600) {
+                    LOGE("segment duration is not in (0, 3600] s\n");
+                    return -1;
+                } else {
+                    gParamOption.segmentDuration = g;
+                }
+                break;
+            case ('k'):
+                LOGD("-k: %s\n", optarg);
+                char *sep = strchr(optarg, ',');
+                int size = atoi(optarg);
+                int age = sep ? atoi(sep + 1) : 0;
+                if (size < 0 || age < 0 || (size == 0 && age == 0)) {
+                    LOGE("retention is invalid\n");
+                    return -1;
+                } else {
+                    gParamOption.keepSize = size;
+                    gParamOption.keepTime = age;
+                }
+                break;
+            case ('v'):
+                LOGD("-v: %s\n", optarg);
+                char *post = strchr(optarg, ',');
+                char *mem = post ? strchr(post + 1, ',') : NULL;
+                int v = atoi(optarg);
+                if (v <= 0 || v > 60) {
+                    LOGE("pre-roll is not in (0, 60] s\n");
+                    return -1;
+                } else {
+                    gParamOption.preRoll = v;
+                    gParamOption.postRoll = post ? atoi(post + 1) : EVENT_POST_ROLL;
+                    gParamOption.preRollMemory = mem ? atoi(mem + 1) : 0;
+                }
+                break;
+            case ('d'):
+                LOGD("-d: %s\n", optarg);
+                int d = atoi(optarg);
+                if (d <= 0 || d > 65535) {
+                    LOGE("metrics port is invalid.\n");
+                    return -1;
+                } else {
+                    gParamOption.metricsPort = d;
+                }
+                break;
+            case ('l'):
+                LOGD("-l: %s\n", optarg);
+                int l = atoi(optarg);
+                if (l < LOG_LEVEL_ERROR || l > LOG_LEVEL_DEBUG) {
+                    LOGE("log level is not in [%d, %d]\n", LOG_LEVEL_ERROR, LOG_LEVEL_DEBUG);
+                    return -1;
+                } else {
+                    gLogLevel = l;
+                }
+                break;
             case ':':
                 LOGE("option [-%c] requires an argument\n", (char)optopt);
                 break;
@@ -199,13 +575,40 @@ int HisiLive_ParseParam(int argc, char **argv)
         }
     }
 
+    if (gParamOption.ipCount == 0 && gParamOption.rtspPort == 0) {  // with RTSP, receivers may come only from the server
+        sprintf(gParamOption.ip[0], "%s", "192.168.1.100");
+        gParamOption.port[0] = DEFAULT_RTP_PORT;
+        gParamOption.ipCount = 1;
+    }
+
+    if (gParamOption.rtxPayloadType > 0 && gParamOption.nackWindow == 0) {
+        gParamOption.nackWindow = RETRANSMIT_WINDOW;
+    }
+
+    if (gParamOption.rtxPayloadType == FEC_PAYLOAD_TYPE && gParamOption.fecGroup > 0) {
+        LOGE("RTX payload type %d is the FEC payload type\n", gParamOption.rtxPayloadType);
+        return -1;
+    }
+
     if (gParamOption.bitRate == 0) {
-        if (gParamOption.videoSize == PIC_1080P) {
-            gParamOption.bitRate = 2048 * gParamOption.frameRate / 30;
-        } else if (gParamOption.videoSize == PIC_720P) {
-            gParamOption.bitRate = 1024 * gParamOption.frameRate / 30;
-        } else {
-            gParamOption.bitRate = 512 * gParamOption.frameRate / 30;
+        gParamOption.bitRate = HisiLive_DefaultBitRate(gParamOption.videoSize, gParamOption.frameRate);
+    }
+
+    if (gParamOption.subStream) {
+        if (gParamOption.subFormat == PT_BUTT) {
+            gParamOption.subFormat = gParamOption.videoFormat;
+        }
+        if (gParamOption.subBitRate == 0) {
+            gParamOption.subBitRate = HisiLive_DefaultBitRate(gParamOption.subSize, gParamOption.frameRate);
+        }
+    }
+
+    if (gParamOption.preRoll > 0) {
+        if (gParamOption.segmentDuration == 0) {  // events are recorded as segments
+            gParamOption.segmentDuration = 60;
+        }
+        if (gParamOption.preRollMemory == 0) {  // pre-roll plus a GOP at twice the bitrate
+            gParamOption.preRollMemory = (gParamOption.preRoll + 2) * gParamOption.bitRate / 8 * 2;
         }
     }
 
@@ -412,7 +815,7 @@ HI_S32 SAMPLE_VENC_VI_Init(SAMPLE_VI_CONFIG_S *pstViConfig, HI_BOOL bLowDelay, H
 }
 
 HI_S32 SAMPLE_VENC_VPSS_Init(VPSS_GRP VpssGrp, HI_BOOL *pabChnEnable, DYNAMIC_RANGE_E enDynamicRange, PIXEL_FORMAT_E enPixelFormat,
-                             SIZE_S stSize, SAMPLE_SNS_TYPE_E enSnsType)
+                             SIZE_S *pastSize, SAMPLE_SNS_TYPE_E enSnsType)
 {
     HI_S32 i;
     HI_S32 s32Ret;
@@ -453,8 +856,8 @@ HI_S32 SAMPLE_VENC_VPSS_Init(VPSS_GRP VpssGrp, HI_BOOL *pabChnEnable, DYNAMIC_RA
     for (i = 0; i < VPSS_MAX_PHY_CHN_NUM; i++) {
         if (HI_TRUE == pabChnEnable[i]) {
             SAMPLE_PRT("set stVpssChnAttr[%d]\n", i);
-            stVpssChnAttr[i].u32Width = stSize.u32Width;
-            stVpssChnAttr[i].u32Height = stSize.u32Height;
+            stVpssChnAttr[i].u32Width = pastSize[i].u32Width;
+            stVpssChnAttr[i].u32Height = pastSize[i].u32Height;
             stVpssChnAttr[i].enChnMode = VPSS_CHN_MODE_USER;
             stVpssChnAttr[i].enCompressMode = COMPRESS_MODE_NONE;  // COMPRESS_MODE_SEG;
             stVpssChnAttr[i].enDynamicRange = enDynamicRange;
@@ -548,7 +951,7 @@ HI_S32 HisiLive_COMM_VENC_GetFilePostfix(PAYLOAD_TYPE_E enPayload, char *szFileP
 }
 
 /******************************************************************************
- * funciton : save stream
+ * funciton : save stream, only JPEG snapshots, video goes through the recorder
  ******************************************************************************/
 HI_S32 HisiLive_COMM_VENC_SaveStream(FILE *pFd, VENC_STREAM_S *pstStream)
 {
@@ -557,36 +960,348 @@ HI_S32 HisiLive_COMM_VENC_SaveStream(FILE *pFd, VENC_STREAM_S *pstStream)
     for (i = 0; i < pstStream->u32PackCount; i++) {
         fwrite(pstStream->pstPack[i].pu8Addr + pstStream->pstPack[i].u32Offset,
                pstStream->pstPack[i].u32Len - pstStream->pstPack[i].u32Offset, 1, pFd);
-
-        fflush(pFd);
     }
+    fflush(pFd);
 
     return HI_SUCCESS;
 }
 
-HI_S32 HisiLive_RTPSendVideo(VENC_STREAM_S *pstStream)
+/******************************************************************************
+ * funciton : map the monotonic clock to the encoder PTS clock, read again every PTS_SYNC_INTERVAL by the
+ *            capture thread as the clocks drift apart.
+ ******************************************************************************/
+static HI_VOID HisiLive_SyncPts(HI_VOID)
 {
-    int i;
-    gRTPCtx.payload_type = (gParamOption.videoFormat == PT_H264) ? 0 : 1;
+    HI_U64 u64Pts;
 
-    static uint64_t packets = 0;
-    ++packets;
-    int count10s = gParamOption.frameRate * 10;
+    if (HI_SUCCESS == HI_MPI_SYS_GetCurPts(&u64Pts)) {
+        __atomic_store_n(&gPtsOffset, (int64_t)getMonotonicTime() - (int64_t)u64Pts, __ATOMIC_RELAXED);
+    }
+}
+
+/* monotonic μs of an encoder PTS, 0 if unknown */
+static uint64_t HisiLive_PtsToMonotonic(HI_U64 u64Pts)
+{
+    int64_t offset = __atomic_load_n(&gPtsOffset, __ATOMIC_RELAXED);
+
+    return offset ? (uint64_t)((int64_t)u64Pts + offset) : 0;
+}
+
+/******************************************************************************
+ * funciton : NAL unit type of a pack, from the encoder pack info.
+ ******************************************************************************/
+static int HisiLive_GetNALType(PAYLOAD_TYPE_E enPayload, const VENC_PACK_S *pstPack)
+{
+    if (PT_H264 == enPayload) {
+        switch (pstPack->DataType.enH264EType) {
+            case H264E_NALU_IDRSLICE:
+                return H264_NAL_IDR;
+            case H264E_NALU_SEI:
+                return H264_NAL_SEI;
+            case H264E_NALU_SPS:
+                return H264_NAL_SPS;
+            case H264E_NALU_PPS:
+                return H264_NAL_PPS;
+            default:
+                return H264_NAL_SLICE;
+        }
+    } else if (PT_H265 == enPayload) {
+        switch (pstPack->DataType.enH265EType) {
+            case H265E_NALU_IDRSLICE:
+                return HEVC_NAL_IDR_W_RADL;
+            case H265E_NALU_VPS:
+                return HEVC_NAL_VPS;
+            case H265E_NALU_SPS:
+                return HEVC_NAL_SPS;
+            case H265E_NALU_PPS:
+                return HEVC_NAL_PPS;
+            case H265E_NALU_SEI:
+                return HEVC_NAL_SEI_PREFIX;
+            default:
+                return HEVC_NAL_TRAIL_R;
+        }
+    }
+
+    return -1;
+}
+
+/******************************************************************************
+ * funciton : describe the packs of an encoder stream as a MediaFrame, packs holds u32PackCount entries.
+ ******************************************************************************/
+static void HisiLive_GetMediaFrame(PAYLOAD_TYPE_E enPayload, VENC_STREAM_S *pstStream, MediaPack *packs, MediaFrame *frame)
+{
+    int i;
 
     for (i = 0; i < pstStream->u32PackCount; i++) {
         // LOG("packet %d / %d, %lld\n", i + 1, pstStream->u32PackCount, pstStream->pstPack[i].u64PTS);
-        gRTPCtx.timestamp = (HI_U32)(pstStream->pstPack[i].u64PTS / 100 * 9);  // (μs / 10^6) * (90 * 10^3)
-        if (packets % count10s == 0) {                                         // debug once every 10 seconds
-            LOGD("packet pts %llu, rtp ts %u\n", pstStream->pstPack[i].u64PTS, gRTPCtx.timestamp);
+        packs[i].data = pstStream->pstPack[i].pu8Addr + pstStream->pstPack[i].u32Offset;  // stream ptr
+        packs[i].len = pstStream->pstPack[i].u32Len - pstStream->pstPack[i].u32Offset;    // stream length
+        packs[i].nalType = HisiLive_GetNALType(enPayload, &pstStream->pstPack[i]);
+        // u32DataNum: NALs of other types carried in this pack, only then the packetizer scans it
+        packs[i].nalCount = (0 == pstStream->pstPack[i].u32DataNum) ? 1 : 0;
+    }
+
+    frame->packs = packs;
+    frame->packCount = (int)pstStream->u32PackCount;
+    frame->pts = pstStream->pstPack[0].u64PTS;
+    frame->readTime = 0;
+    frame->keyFrame = 0;
+    for (i = 0; i < frame->packCount; i++) {
+        if (packs[i].nalType == H264_NAL_IDR || packs[i].nalType == HEVC_NAL_IDR_W_RADL) {
+            frame->keyFrame = 1;
+        }
+    }
+
+    // only frames of the enhance layer that nothing refers to can be dropped alone
+    if (PT_H264 == enPayload) {
+        frame->reference = (ENHANCE_PSLICE_NOTFORREF != pstStream->stH264Info.enRefType);
+    } else if (PT_H265 == enPayload) {
+        frame->reference = (ENHANCE_PSLICE_NOTFORREF != pstStream->stH265Info.enRefType);
+    } else {
+        frame->reference = 1;
+    }
+    frame->reference |= frame->keyFrame;
+}
+
+/******************************************************************************
+ * funciton : recorder thread, buffer a queued frame for the file writer
+ ******************************************************************************/
+static void HisiLive_RecordFrame(void *arg, const MediaFrame *frame)
+{
+    recorderWrite((RecorderContext *)arg, frame);
+}
+
+/******************************************************************************
+ * funciton : recorder thread, mux a queued frame into the current MPEG-TS segment
+ ******************************************************************************/
+static void HisiLive_SegmentFrame(void *arg, const MediaFrame *frame)
+{
+    segmenterWrite((SegmenterContext *)arg, frame);
+}
+
+/******************************************************************************
+ * funciton : recorder thread, keep a queued frame as pre-roll or record it during an event
+ ******************************************************************************/
+static void HisiLive_EventFrame(void *arg, const MediaFrame *frame)
+{
+    eventWrite((EventContext *)arg, frame);
+}
+
+static void HisiLive_HandleTrigger(int signo)
+{
+    eventTrigger();
+}
+
+/******************************************************************************
+ * funciton : capture thread, count a frame taken from the encoder
+ ******************************************************************************/
+static HI_VOID HisiLive_CountFrame(CaptureCounters *pstCounters, const VENC_STREAM_S *pstStream, HI_U32 u32LeftFrames)
+{
+    HI_U64 u64Bytes = 0;
+    HI_U32 i;
+
+    for (i = 0; i < pstStream->u32PackCount; i++) {
+        u64Bytes += pstStream->pstPack[i].u32Len - pstStream->pstPack[i].u32Offset;
+    }
+    metricsAdd(&pstCounters->frames, 1);
+    metricsAdd(&pstCounters->packs, pstStream->u32PackCount);
+    metricsAdd(&pstCounters->bytes, u64Bytes);
+    metricsSet(&pstCounters->leftFrames, u32LeftFrames);
+}
+
+/******************************************************************************
+ * funciton : the counters of every channel on the metrics endpoint, read while streaming without locks
+ ******************************************************************************/
+static int HisiLive_StartMetrics(void)
+{
+    static char aszLabel[LIVE_CHN_MAX][8];
+    int i;
+
+    gMetrics.port = gParamOption.metricsPort;
+    gMetrics.streamCount = gChannelCount;
+    for (i = 0; i < gChannelCount; i++) {
+        LiveChannel *ch = &gChannel[i];
+        MetricsStream *st = &gMetrics.stream[i];
+
+        snprintf(aszLabel[i], sizeof(aszLabel[i]), "%d", ch->VencChn);
+        st->label = aszLabel[i];
+        st->capture = &gCapture[i];
+        if (gParamOption.mode == MODE_FILE) {
+            st->sink = &gRecorderSink[i];
+            continue;
+        }
+        st->sink = &ch->sender;
+        st->rtp = &ch->rtp;
+        st->udp = &ch->udp;
+        st->pacer = &ch->pacer;
+        st->rtcp = &ch->rtcp;
+        st->latency = &ch->latency;
+    }
+
+    return metricsStart(&gMetrics);
+}
+
+/******************************************************************************
+ * funciton : control thread, the latency histograms of every channel for a "latency" query
+ ******************************************************************************/
+static int HisiLive_QueryLatency(char *buf, int size)
+{
+    char name[16];
+    int i, len = 0;
+
+    for (i = 0; i < gChannelCount && len < size - 1; i++) {
+        snprintf(name, sizeof(name), "chn %d", gChannel[i].VencChn);
+        len += latencyFormat(&gChannel[i].latency, name, buf + len, size - len);
+    }
+    if (len == 0) {
+        len = snprintf(buf, size, "no frames sent\n");
+    }
+    return len;
+}
+
+/******************************************************************************
+ * funciton : sender thread, packetize a queued frame
+ ******************************************************************************/
+static void HisiLive_SendFrame(void *arg, const MediaFrame *frame)
+{
+    LiveChannel *ch = (LiveChannel *)arg;
+
+    // all packs of a frame are packetized together and sent with sendmmsg
+    rtpSendFrame(&ch->rtp, &ch->udp, frame);
+
+    latencyAdd(&ch->latency, LATENCY_QUEUE, frame->readTime, ch->rtp.firstSendTime);
+    latencyAdd(&ch->latency, LATENCY_SEND, ch->rtp.firstSendTime, ch->rtp.sentTime);
+    latencyAdd(&ch->latency, LATENCY_TOTAL, HisiLive_PtsToMonotonic(frame->pts), ch->rtp.sentTime);
+}
+
+/******************************************************************************
+ * funciton : RTSP thread, a session joins while the cached GOP is too old
+ ******************************************************************************/
+static void HisiLive_RequestIDR(void *arg)
+{
+    HI_S32 s32Ret = HI_MPI_VENC_RequestIDR(((LiveChannel *)arg)->VencChn, HI_TRUE);
+    if (HI_SUCCESS != s32Ret) {
+        LOGE("HI_MPI_VENC_RequestIDR failed with %#x!\n", s32Ret);
+    }
+}
+
+HI_S32 HisiLive_RecordVideo(VENC_CHN VencChn, PAYLOAD_TYPE_E enPayload, VENC_STREAM_S *pstStream, MediaPack *packs)
+{
+    MediaFrame frame;
+    static uint64_t frames[VENC_MAX_CHN_NUM];  // per channel, each counted by the thread of its channel
+
+    HisiLive_GetMediaFrame(enPayload, pstStream, packs, &frame);
+
+    if (++frames[VencChn] % (gParamOption.frameRate * 10) == 0) {  // summaries once every 10 seconds
+        streamSinkDumpStats(&gRecorderSink[VencChn]);
+        if (gParamOption.preRoll > 0) {
+            eventDumpStats(&gEvent[VencChn]);
+            segmenterDumpStats(&gSegmenter[VencChn]);
+        } else if (gParamOption.segmentDuration > 0) {
+            recorderDumpStats(&gSegmenter[VencChn].rec);
+            segmenterDumpStats(&gSegmenter[VencChn]);
+        } else {
+            recorderDumpStats(&gRecorder[VencChn]);
+        }
+    }
+
+    // a dropped frame is counted by the queue, the encoder goes on
+    streamSinkPush(&gRecorderSink[VencChn], &frame);
+
+    return 0;
+}
+
+HI_S32 HisiLive_RTPSendVideo(LiveChannel *ch, VENC_STREAM_S *pstStream, MediaPack *packs, HI_U64 u64ReadTime)
+{
+    int i;
+    MediaFrame frame;
+    int count10s = gParamOption.frameRate * 10;
+    char name[16];
+
+    HisiLive_GetMediaFrame(ch->enPayload, pstStream, packs, &frame);
+    frame.readTime = u64ReadTime;
+
+    if (++ch->frames % count10s == 0) {  // summaries once every 10 seconds
+        RTCPReceiverStats stats[RTCP_RECEIVER_MAX];
+        int n = ch->rtcp.running ? rtcpGetStats(&ch->rtcp, stats, RTCP_RECEIVER_MAX) : 0;
+        LOGI("chn %d: packet pts %llu, rtp ts %u, ssrc %08X\n", ch->VencChn, frame.pts, (HI_U32)(frame.pts / 100 * 9), ch->rtp.ssrc);
+        for (i = 0; i < n; i++) {
+            LOGI("receiver %s: lost %d (%d/256), jitter %u ms, rtt %d ms\n", inet_ntoa(stats[i].addr.sin_addr),
+                 stats[i].cumulativeLost, stats[i].fractionLost, stats[i].jitter / 90, stats[i].rtt / 1000);
+        }
+        streamSinkDumpStats(&ch->sender);
+        if (ch->rtp.gop) {
+            gopCacheDumpStats(ch->rtp.gop);
         }
-        rtpSendH264HEVC(&gRTPCtx, &gUDPCtx,
-                        pstStream->pstPack[i].pu8Addr + pstStream->pstPack[i].u32Offset,  // stream ptr
-                        pstStream->pstPack[i].u32Len - pstStream->pstPack[i].u32Offset);  // stream length
+        LOGI("stream loop heap allocations %u\n", gStreamAllocs);
+        snprintf(name, sizeof(name), "chn %d", ch->VencChn);
+        latencyDumpStats(&ch->latency, name);
     }
 
+    // copied into the send queue of the channel, the stream is released right after and sent by its sender thread
+    streamSinkPush(&ch->sender, &frame);
+
     return 0;
 }
 
+/******************************************************************************
+ * funciton : resize a pack pool, counted in gStreamAllocs.
+ ******************************************************************************/
+static HI_S32 HisiLive_PackPoolResize(PackPool *pstPool, HI_U32 u32Size)
+{
+    VENC_PACK_S *pstPack;
+    MediaPack *packs;
+
+    pstPack = (VENC_PACK_S *)realloc(pstPool->pstPack, sizeof(VENC_PACK_S) * u32Size);
+    if (NULL == pstPack) {
+        return HI_FAILURE;
+    }
+    pstPool->pstPack = pstPack;
+    gStreamAllocs++;
+
+    packs = (MediaPack *)realloc(pstPool->packs, sizeof(MediaPack) * u32Size);
+    if (NULL == packs) {
+        return HI_FAILURE;
+    }
+    pstPool->packs = packs;
+    gStreamAllocs++;
+
+    pstPool->u32Size = u32Size;
+    return HI_SUCCESS;
+}
+
+/******************************************************************************
+ * funciton : preallocate the pack pool of a channel from its attributes, one pack per slice
+ *            plus parameter sets and SEI, so the stream loop never allocates.
+ ******************************************************************************/
+static HI_S32 HisiLive_PackPoolInit(PackPool *pstPool, VENC_CHN VencChn, const VENC_CHN_ATTR_S *pstChnAttr)
+{
+    VENC_SLICE_SPLIT_S stSliceSplit;
+    HI_U32 u32Rows = (pstChnAttr->stVencAttr.u32PicHeight + 15) / 16;  // macroblock rows, at least the CTU rows
+    HI_U32 u32Slices = 1;
+    HI_U32 u32Size;
+
+    if (HI_SUCCESS == HI_MPI_VENC_GetSliceSplit(VencChn, &stSliceSplit) && stSliceSplit.bSplitEnable &&
+        stSliceSplit.u32MbLineNum > 0) {
+        u32Slices = (u32Rows + stSliceSplit.u32MbLineNum - 1) / stSliceSplit.u32MbLineNum;
+    }
+
+    u32Size = PACK_POOL_EXTRA + u32Slices;
+    if (u32Size < PACK_POOL_MIN) {
+        u32Size = PACK_POOL_MIN;
+    }
+
+    memset(pstPool, 0, sizeof(*pstPool));
+    return HisiLive_PackPoolResize(pstPool, u32Size);
+}
+
+static HI_VOID HisiLive_PackPoolFree(PackPool *pstPool)
+{
+    free(pstPool->pstPack);
+    free(pstPool->packs);
+    memset(pstPool, 0, sizeof(*pstPool));
+}
+
 /******************************************************************************
  * funciton : get stream from each channels and save them
  ******************************************************************************/
@@ -596,9 +1311,10 @@ HI_VOID *HisiLive_COMM_VENC_GetVencStreamProc(HI_VOID *p)
     HI_S32 s32ChnTotal;
     VENC_CHN_ATTR_S stVencChnAttr;
     SAMPLE_VENC_GETSTREAM_PARA_S *pstPara;
-    HI_S32 maxfd = 0;
-    struct timeval TimeoutVal;
-    fd_set read_fds;
+    HI_S32 epfd;
+    HI_S32 k, n, s32Ready;
+    struct epoll_event stEvent;
+    struct epoll_event astEvents[VENC_MAX_CHN_NUM];
     HI_U32 u32PictureCnt[VENC_MAX_CHN_NUM] = { 0 };
     HI_S32 VencFd[VENC_MAX_CHN_NUM];
     HI_CHAR aszFileName[VENC_MAX_CHN_NUM][64];
@@ -610,6 +1326,8 @@ HI_VOID *HisiLive_COMM_VENC_GetVencStreamProc(HI_VOID *p)
     VENC_CHN VencChn;
     PAYLOAD_TYPE_E enPayLoadType[VENC_MAX_CHN_NUM];
     VENC_STREAM_BUF_INFO_S stStreamBufInfo[VENC_MAX_CHN_NUM];
+    PackPool astPackPool[VENC_MAX_CHN_NUM];
+    HI_U64 u64Wakeup, u64Read, u64PtsSync = 0;
 
     prctl(PR_SET_NAME, "GetVencStream", 0, 0, 0);
 
@@ -622,6 +1340,11 @@ HI_VOID *HisiLive_COMM_VENC_GetVencStreamProc(HI_VOID *p)
         SAMPLE_PRT("input count invaild\n");
         return NULL;
     }
+    epfd = epoll_create(VENC_MAX_CHN_NUM);
+    if (epfd < 0) {
+        SAMPLE_PRT("epoll_create failed! %s\n", strerror(errno));
+        return NULL;
+    }
     for (i = 0; i < s32ChnTotal; i++) {
         /* decide the stream file name, and open file to save stream */
         VencChn = pstPara->VeChn[i];
@@ -640,141 +1363,199 @@ HI_VOID *HisiLive_COMM_VENC_GetVencStreamProc(HI_VOID *p)
         if (PT_JPEG != enPayLoadType[i] && gParamOption.mode == MODE_FILE) {
             snprintf(aszFileName[i], 32, "stream_chn%d%s", i, szFilePostfix);
 
-            pFile[i] = fopen(aszFileName[i], "wb");
-            if (!pFile[i]) {
-                SAMPLE_PRT("open file[%s] failed!\n", aszFileName[i]);
+            // frames are collected in large buffers by a recorder thread and written by the writer thread,
+            // a slow SD card does not hold the encoder buffer
+            gRecorderSink[i].name = "Recorder";
+            gRecorderSink[i].dropWatermark = gParamOption.dropWatermark;
+            if (gParamOption.segmentDuration > 0) {
+                // playable MPEG-TS segments instead of one endless elementary stream, opened at the first IDR
+                snprintf(gSegmenter[i].prefix, SEGMENT_PREFIX_MAX, "stream_chn%d", i);
+                gSegmenter[i].codec = (PT_H264 == enPayLoadType[i]) ? 0 : 1;
+                gSegmenter[i].duration = gParamOption.segmentDuration;
+                gSegmenter[i].maxBytes = (uint64_t)gParamOption.keepSize << 20;
+                gSegmenter[i].maxAge = gParamOption.keepTime * 60;
+                gSegmenter[i].rec.flushInterval = gParamOption.flushInterval;
+                gSegmenter[i].rec.direct = gParamOption.directIO;
+                if (segmenterOpen(&gSegmenter[i])) {
+                    return NULL;
+                }
+                gRecorderSink[i].onFrame = HisiLive_SegmentFrame;
+                gRecorderSink[i].arg = &gSegmenter[i];
+
+                // only the last seconds are kept in memory, the SD card is written around events
+                if (gParamOption.preRoll > 0) {
+                    gEvent[i].preRoll = gParamOption.preRoll;
+                    gEvent[i].postRoll = gParamOption.postRoll;
+                    gEvent[i].memory = (HI_U32)gParamOption.preRollMemory * 1024;
+                    gEvent[i].frameRate = gParamOption.frameRate;
+                    gEvent[i].seg = &gSegmenter[i];
+                    if (eventStart(&gEvent[i])) {
+                        return NULL;
+                    }
+                    gRecorderSink[i].onFrame = HisiLive_EventFrame;
+                    gRecorderSink[i].arg = &gEvent[i];
+                }
+            } else {
+                gRecorder[i].flushInterval = gParamOption.flushInterval;
+                gRecorder[i].direct = gParamOption.directIO;
+                if (recorderOpen(&gRecorder[i], aszFileName[i])) {
+                    SAMPLE_PRT("open file[%s] failed!\n", aszFileName[i]);
+                    return NULL;
+                }
+                gRecorderSink[i].onFrame = HisiLive_RecordFrame;
+                gRecorderSink[i].arg = &gRecorder[i];
+            }
+            if (streamSinkStart(&gRecorderSink[i])) {  // whatever was opened for the channel, as at the end
+                recorderClose(&gRecorder[i]);
+                eventStop(&gEvent[i]);
+                segmenterClose(&gSegmenter[i]);
                 return NULL;
             }
         }
-        /* Set Venc Fd. */
-        VencFd[i] = HI_MPI_VENC_GetFd(i);
+        /* Set Venc Fd, an event carries the index of the channel. */
+        VencFd[i] = HI_MPI_VENC_GetFd(VencChn);
         if (VencFd[i] < 0) {
             SAMPLE_PRT("HI_MPI_VENC_GetFd failed with %#x!\n", VencFd[i]);
             return NULL;
         }
-        if (maxfd <= VencFd[i]) {
-            maxfd = VencFd[i];
+        stEvent.events = EPOLLIN;
+        stEvent.data.u32 = (HI_U32)i;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, VencFd[i], &stEvent) < 0) {
+            SAMPLE_PRT("epoll_ctl chn[%d] failed! %s\n", VencChn, strerror(errno));
+            return NULL;
         }
 
-        s32Ret = HI_MPI_VENC_GetStreamBufInfo(i, &stStreamBufInfo[i]);
+        s32Ret = HI_MPI_VENC_GetStreamBufInfo(VencChn, &stStreamBufInfo[i]);
         if (HI_SUCCESS != s32Ret) {
             SAMPLE_PRT("HI_MPI_VENC_GetStreamBufInfo failed with %#x!\n", s32Ret);
             return (void *)HI_FAILURE;
         }
+
+        s32Ret = HisiLive_PackPoolInit(&astPackPool[i], VencChn, &stVencChnAttr);
+        if (HI_SUCCESS != s32Ret) {
+            SAMPLE_PRT("malloc stream pack failed!\n");
+            return NULL;
+        }
     }
 
     /******************************************
-     step 2:  Start to get streams of each channel.
+     step 2:  Start to get streams of each channel, every frame a ready encoder holds is drained.
     ******************************************/
     while (HI_TRUE == pstPara->bThreadStart) {
-        FD_ZERO(&read_fds);
-        for (i = 0; i < s32ChnTotal; i++) {
-            FD_SET(VencFd[i], &read_fds);
-        }
-
-        TimeoutVal.tv_sec = 2;
-        TimeoutVal.tv_usec = 0;
-        s32Ret = select(maxfd + 1, &read_fds, NULL, NULL, &TimeoutVal);
-        if (s32Ret < 0) {
-            SAMPLE_PRT("select failed!\n");
+        s32Ready = epoll_wait(epfd, astEvents, VENC_MAX_CHN_NUM, 2000);
+        if (s32Ready < 0) {
+            if (errno == EINTR)
+                continue;
+            SAMPLE_PRT("epoll_wait failed!\n");
             break;
-        } else if (s32Ret == 0) {
+        } else if (s32Ready == 0) {
             SAMPLE_PRT("get venc stream time out, exit thread\n");
             continue;
-        } else {
-            for (i = 0; i < s32ChnTotal; i++) {
-                if (FD_ISSET(VencFd[i], &read_fds)) {
-                    // SAMPLE_PRT("get channel [%d] data.\n", i);
-                    /*******************************************************
-                     step 2.1 : query how many packs in one-frame stream.
-                    *******************************************************/
-                    memset(&stStream, 0, sizeof(stStream));
-
-                    s32Ret = HI_MPI_VENC_QueryStatus(i, &stStat);
-                    if (HI_SUCCESS != s32Ret) {
-                        SAMPLE_PRT("HI_MPI_VENC_QueryStatus chn[%d] failed with %#x!\n", i, s32Ret);
-                        break;
-                    }
+        }
+        u64Wakeup = getMonotonicTime();
+        if (u64Wakeup - u64PtsSync >= PTS_SYNC_INTERVAL) {
+            HisiLive_SyncPts();
+            u64PtsSync = u64Wakeup;
+        }
 
-                    /*******************************************************
-                    step 2.2 :suggest to check both u32CurPacks and u32LeftStreamFrames at the same time,for example:
-                     if(0 == stStat.u32CurPacks || 0 == stStat.u32LeftStreamFrames)
-                     {
-                        SAMPLE_PRT("NOTE: Current  frame is NULL!\n");
-                        continue;
-                     }
-                    *******************************************************/
-                    if (0 == stStat.u32CurPacks) {
+        for (k = 0; k < s32Ready; k++) {
+            i = (HI_S32)astEvents[k].data.u32;
+            VencChn = pstPara->VeChn[i];
+            for (n = 0; n < VENC_DRAIN_MAX; n++) {
+                /*******************************************************
+                 step 2.1 : query how many packs in one-frame stream.
+                *******************************************************/
+                memset(&stStream, 0, sizeof(stStream));
+
+                s32Ret = HI_MPI_VENC_QueryStatus(VencChn, &stStat);
+                if (HI_SUCCESS != s32Ret) {
+                    SAMPLE_PRT("HI_MPI_VENC_QueryStatus chn[%d] failed with %#x!\n", VencChn, s32Ret);
+                    break;
+                }
+
+                /*******************************************************
+                step 2.2 :suggest to check both u32CurPacks and u32LeftStreamFrames at the same time,for example:
+                 if(0 == stStat.u32CurPacks || 0 == stStat.u32LeftStreamFrames)
+                 {
+                    SAMPLE_PRT("NOTE: Current  frame is NULL!\n");
+                    continue;
+                 }
+                *******************************************************/
+                if (0 == stStat.u32CurPacks) {
+                    if (0 == n) {
                         SAMPLE_PRT("NOTE: Current  frame is NULL!\n");
-                        continue;
                     }
-                    /*******************************************************
-                     step 2.3 : malloc corresponding number of pack nodes.
-                    *******************************************************/
-                    stStream.pstPack = (VENC_PACK_S *)malloc(sizeof(VENC_PACK_S) * stStat.u32CurPacks);
-                    if (NULL == stStream.pstPack) {
+                    break;  // drained
+                }
+                /*******************************************************
+                 step 2.3 : take pack nodes from the channel pool, it only grows
+                            if the encoder outputs more packs than expected.
+                *******************************************************/
+                if (stStat.u32CurPacks > astPackPool[i].u32Size) {
+                    LOGE("chn %d: %u packs in a frame, pack pool %u\n", VencChn, stStat.u32CurPacks, astPackPool[i].u32Size);
+                    if (HI_SUCCESS != HisiLive_PackPoolResize(&astPackPool[i], stStat.u32CurPacks)) {
                         SAMPLE_PRT("malloc stream pack failed!\n");
                         break;
                     }
-
-                    /*******************************************************
-                     step 2.4 : call mpi to get one-frame stream
-                    *******************************************************/
-                    stStream.u32PackCount = stStat.u32CurPacks;
-                    s32Ret = HI_MPI_VENC_GetStream(i, &stStream, HI_TRUE);
-                    if (HI_SUCCESS != s32Ret) {
-                        free(stStream.pstPack);
-                        stStream.pstPack = NULL;
-                        SAMPLE_PRT("HI_MPI_VENC_GetStream failed with %#x!\n", s32Ret);
-                        break;
-                    }
-
-                    /*******************************************************
-                     step 2.5 : save frame to file
-                    *******************************************************/
-                    if (PT_JPEG == enPayLoadType[i]) {
-                        snprintf(aszFileName[i], 32, "stream_chn%d_%d%s", i, u32PictureCnt[i], szFilePostfix);
-                        pFile[i] = fopen(aszFileName[i], "wb");
-                        if (!pFile[i]) {
-                            SAMPLE_PRT("open file err!\n");
-                            return NULL;
-                        }
+                }
+                stStream.pstPack = astPackPool[i].pstPack;
+
+                /*******************************************************
+                 step 2.4 : call mpi to get one-frame stream
+                *******************************************************/
+                stStream.u32PackCount = stStat.u32CurPacks;
+                s32Ret = HI_MPI_VENC_GetStream(VencChn, &stStream, HI_TRUE);
+                if (HI_SUCCESS != s32Ret) {
+                    SAMPLE_PRT("HI_MPI_VENC_GetStream failed with %#x!\n", s32Ret);
+                    break;
+                }
+                u64Read = getMonotonicTime();
+                HisiLive_CountFrame(&gCapture[i], &stStream, stStat.u32LeftStreamFrames);
+
+                /*******************************************************
+                 step 2.5 : save frame to file
+                *******************************************************/
+                if (PT_JPEG == enPayLoadType[i]) {
+                    snprintf(aszFileName[i], 32, "stream_chn%d_%d%s", i, u32PictureCnt[i], szFilePostfix);
+                    pFile[i] = fopen(aszFileName[i], "wb");
+                    if (!pFile[i]) {
+                        SAMPLE_PRT("open file err!\n");
+                        return NULL;
                     }
+                }
 
-                    if (gParamOption.mode == MODE_FILE) {
-                        s32Ret = HisiLive_COMM_VENC_SaveStream(pFile[i], &stStream);
-                    } else if (gParamOption.mode == MODE_RTP) {
-                        s32Ret = HisiLive_RTPSendVideo(&stStream);
-                    } else {
-                        LOGE("Unsupported running mode.\n");
-                    }
+                if (gParamOption.mode == MODE_FILE && PT_JPEG == enPayLoadType[i]) {
+                    s32Ret = HisiLive_COMM_VENC_SaveStream(pFile[i], &stStream);
+                } else if (gParamOption.mode == MODE_FILE) {
+                    s32Ret = HisiLive_RecordVideo(i, enPayLoadType[i], &stStream, astPackPool[i].packs);
+                } else if (gParamOption.mode == MODE_RTP) {
+                    s32Ret = HisiLive_RTPSendVideo(&gChannel[i], &stStream, astPackPool[i].packs, u64Read);
+                } else {
+                    LOGE("Unsupported running mode.\n");
+                }
 
-                    if (HI_SUCCESS != s32Ret) {
-                        free(stStream.pstPack);
-                        stStream.pstPack = NULL;
-                        SAMPLE_PRT("save stream failed!\n");
-                        break;
-                    }
-                    /*******************************************************
-                     step 2.6 : release stream
-                     *******************************************************/
-                    s32Ret = HI_MPI_VENC_ReleaseStream(i, &stStream);
-                    if (HI_SUCCESS != s32Ret) {
-                        SAMPLE_PRT("HI_MPI_VENC_ReleaseStream failed!\n");
-                        free(stStream.pstPack);
-                        stStream.pstPack = NULL;
-                        break;
-                    }
+                if (HI_SUCCESS != s32Ret) {
+                    SAMPLE_PRT("save stream failed!\n");
+                    break;
+                }
+                /*******************************************************
+                 step 2.6 : release stream
+                 *******************************************************/
+                s32Ret = HI_MPI_VENC_ReleaseStream(VencChn, &stStream);
+                if (HI_SUCCESS != s32Ret) {
+                    SAMPLE_PRT("HI_MPI_VENC_ReleaseStream failed!\n");
+                    break;
+                }
+                if (gParamOption.mode == MODE_RTP && stStream.u32PackCount > 0) {
+                    LatencyStats *pstLatency = &gChannel[i].latency;
+                    latencyAdd(pstLatency, LATENCY_ENCODE, HisiLive_PtsToMonotonic(stStream.pstPack[0].u64PTS), u64Wakeup);
+                    latencyAdd(pstLatency, LATENCY_GET, u64Wakeup, u64Read);
+                    latencyAdd(pstLatency, LATENCY_HOLD, u64Read, getMonotonicTime());
+                }
 
-                    /*******************************************************
-                     step 2.7 : free pack nodes
-                    *******************************************************/
-                    free(stStream.pstPack);
-                    stStream.pstPack = NULL;
-                    u32PictureCnt[i]++;
-                    if (PT_JPEG == enPayLoadType[i]) {
-                        fclose(pFile[i]);
-                    }
+                u32PictureCnt[i]++;
+                if (PT_JPEG == enPayLoadType[i]) {
+                    fclose(pFile[i]);
                 }
             }
         }
@@ -782,9 +1563,14 @@ HI_VOID *HisiLive_COMM_VENC_GetVencStreamProc(HI_VOID *p)
     /*******************************************************
      * step 3 : close save-file
      *******************************************************/
+    close(epfd);
     for (i = 0; i < s32ChnTotal; i++) {
-        if (PT_JPEG != enPayLoadType[i]) {
-            fclose(pFile[i]);
+        HisiLive_PackPoolFree(&astPackPool[i]);
+        if (PT_JPEG != enPayLoadType[i] && gParamOption.mode == MODE_FILE) {
+            streamSinkStop(&gRecorderSink[i]);  // the queued frames are written first
+            recorderClose(&gRecorder[i]);
+            eventStop(&gEvent[i]);
+            segmenterClose(&gSegmenter[i]);
         }
     }
     return NULL;
@@ -793,11 +1579,15 @@ HI_VOID *HisiLive_COMM_VENC_GetVencStreamProc(HI_VOID *p)
 /******************************************************************************
  * funciton : start get venc stream process thread
  ******************************************************************************/
-HI_S32 HisiLive_COMM_VENC_StartGetStream(VENC_CHN VeChn)
+HI_S32 HisiLive_COMM_VENC_StartGetStream(const VENC_CHN *pVeChn, HI_S32 s32Cnt)
 {
+    HI_S32 i;
+
     gMediaProcPara.bThreadStart = HI_TRUE;
-    gMediaProcPara.s32Cnt = 1;
-    gMediaProcPara.VeChn[0] = VeChn;
+    gMediaProcPara.s32Cnt = s32Cnt;
+    for (i = 0; i < s32Cnt; i++) {
+        gMediaProcPara.VeChn[i] = pVeChn[i];
+    }
     return pthread_create(&gMediaProcPid, 0, HisiLive_COMM_VENC_GetVencStreamProc, (HI_VOID *)&gMediaProcPara);
 }
 
@@ -838,8 +1628,8 @@ HI_S32 HisiLive_COMM_VENC_CloseReEncode(VENC_CHN VencChn)
     return HI_SUCCESS;
 }
 
-HI_S32 HisiLive_COMM_VENC_Create(VENC_CHN VencChn, PAYLOAD_TYPE_E enType, PIC_SIZE_E enSize, SAMPLE_RC_E enRcMode, HI_U32 u32Profile,
-                                 HI_BOOL bRcnRefShareBuf, VENC_GOP_ATTR_S *pstGopAttr)
+HI_S32 HisiLive_COMM_VENC_Create(VENC_CHN VencChn, PAYLOAD_TYPE_E enType, PIC_SIZE_E enSize, HI_U32 u32BitRate, SAMPLE_RC_E enRcMode,
+                                 HI_U32 u32Profile, HI_BOOL bRcnRefShareBuf, VENC_GOP_ATTR_S *pstGopAttr)
 {
     HI_S32 s32Ret;
     SIZE_S stPicSize;
@@ -1103,7 +1893,7 @@ HI_S32 HisiLive_COMM_VENC_Create(VENC_CHN VencChn, PAYLOAD_TYPE_E enType, PIC_SI
                 stH264Cbr.u32StatTime = u32StatTime;                 /* stream rate statics time(s) */
                 stH264Cbr.u32SrcFrameRate = u32FrameRate;            /* input (vi) frame rate */
                 stH264Cbr.fr32DstFrameRate = gParamOption.frameRate; /* target frame rate */
-                stH264Cbr.u32BitRate = gParamOption.bitRate;
+                stH264Cbr.u32BitRate = u32BitRate;
 #if 0
                 switch (enSize) {
                     case PIC_720P:
@@ -1453,8 +2243,8 @@ HI_S32 HisiLive_COMM_VENC_Create(VENC_CHN VencChn, PAYLOAD_TYPE_E enType, PIC_SI
  * funciton : Start venc stream mode
  * note      : rate control parameter need adjust, according your case.
  ******************************************************************************/
-HI_S32 HisiLive_COMM_VENC_Start(VENC_CHN VencChn, PAYLOAD_TYPE_E enType, PIC_SIZE_E enSize, SAMPLE_RC_E enRcMode, HI_U32 u32Profile,
-                                HI_BOOL bRcnRefShareBuf, VENC_GOP_ATTR_S *pstGopAttr)
+HI_S32 HisiLive_COMM_VENC_Start(VENC_CHN VencChn, PAYLOAD_TYPE_E enType, PIC_SIZE_E enSize, HI_U32 u32BitRate, SAMPLE_RC_E enRcMode,
+                                HI_U32 u32Profile, HI_BOOL bRcnRefShareBuf, VENC_GOP_ATTR_S *pstGopAttr)
 {
     HI_S32 s32Ret;
     VENC_RECV_PIC_PARAM_S stRecvParam;
@@ -1462,7 +2252,7 @@ HI_S32 HisiLive_COMM_VENC_Start(VENC_CHN VencChn, PAYLOAD_TYPE_E enType, PIC_SIZ
     /******************************************
      step 1:  Creat Encode Chnl
     ******************************************/
-    s32Ret = HisiLive_COMM_VENC_Create(VencChn, enType, enSize, enRcMode, u32Profile, bRcnRefShareBuf, pstGopAttr);
+    s32Ret = HisiLive_COMM_VENC_Create(VencChn, enType, enSize, u32BitRate, enRcMode, u32Profile, bRcnRefShareBuf, pstGopAttr);
     if (HI_SUCCESS != s32Ret) {
         SAMPLE_PRT("SAMPLE_COMM_VENC_Creat faild with%#x! \n", s32Ret);
         return HI_FAILURE;
@@ -1480,20 +2270,21 @@ HI_S32 HisiLive_COMM_VENC_Start(VENC_CHN VencChn, PAYLOAD_TYPE_E enType, PIC_SIZ
 }
 
 /******************************************************************************
- * function: H.265e + H264e@720P, H.265 Channel resolution adaptable with sensor
+ * function: H.265e / H.264e of every LiveChannel, the main channel resolution adaptable with sensor
  ******************************************************************************/
 HI_S32 SAMPLE_VENC_H265_H264(void)
 {
     HI_S32 s32Ret;
+    HI_S32 i, s32Started = 0;
     SIZE_S stSize;
-    PIC_SIZE_E enSize = gParamOption.videoSize;
-    VENC_CHN VencChn = 0;
+    SIZE_S astSize[VPSS_MAX_PHY_CHN_NUM] = { 0 };
+    VENC_CHN aVencChn[LIVE_CHN_MAX];
     HI_U32 u32Profile = 0;  // H.264: 0:baseline; 1:MP; 2:HP; 3:SVC-T ; H.265: 0:MP; 1:Main 10 [0 1];
-    PAYLOAD_TYPE_E enPayLoad = gParamOption.videoFormat;
     VENC_GOP_MODE_E enGopMode;
     VENC_GOP_ATTR_S stGopAttr;
     SAMPLE_RC_E enRcMode;
     HI_BOOL bRcnRefShareBuf = HI_TRUE;
+    LiveChannel *ch;
 
     VI_DEV ViDev = 0;
     VI_PIPE ViPipe = 0;
@@ -1501,30 +2292,35 @@ HI_S32 SAMPLE_VENC_H265_H264(void)
     SAMPLE_VI_CONFIG_S stViConfig;
 
     VPSS_GRP VpssGrp = 0;
-    VPSS_CHN VpssChn = 1;  // use chn 1 for zoom-out, chn 0 for zoom-in only
-    HI_BOOL abChnEnable[VPSS_MAX_PHY_CHN_NUM] = { 0, 1, 0 };
+    HI_BOOL abChnEnable[VPSS_MAX_PHY_CHN_NUM] = { 0 };  // use chn 1, 2 for zoom-out, chn 0 for zoom-in only
 
     HI_U32 u32SupplementConfig = HI_FALSE;
 
-    s32Ret = SAMPLE_COMM_SYS_GetPicSize(enSize, &stSize);
-    if (HI_SUCCESS != s32Ret) {
-        SAMPLE_PRT("SAMPLE_COMM_SYS_GetPicSize failed!\n");
-        return s32Ret;
-    }
-
     SAMPLE_COMM_VI_GetSensorInfo(&stViConfig);
     if (SAMPLE_SNS_TYPE_BUTT == stViConfig.astViInfo[0].stSnsInfo.enSnsType) {
         SAMPLE_PRT("Not set SENSOR%d_TYPE !\n", 0);
         return HI_FAILURE;
     }
 
-    s32Ret = SAMPLE_VENC_CheckSensor(stViConfig.astViInfo[0].stSnsInfo.enSnsType, stSize);
-    if (s32Ret != HI_SUCCESS) {
-        SAMPLE_PRT("before SAMPLE_VENC_ModifyResolution\n");
-        s32Ret = SAMPLE_VENC_ModifyResolution(stViConfig.astViInfo[0].stSnsInfo.enSnsType, &enSize, &stSize);
+    for (i = 0; i < gChannelCount; i++) {
+        ch = &gChannel[i];
+        s32Ret = SAMPLE_COMM_SYS_GetPicSize(ch->enSize, &stSize);
+        if (HI_SUCCESS != s32Ret) {
+            SAMPLE_PRT("SAMPLE_COMM_SYS_GetPicSize failed!\n");
+            return s32Ret;
+        }
+
+        s32Ret = SAMPLE_VENC_CheckSensor(stViConfig.astViInfo[0].stSnsInfo.enSnsType, stSize);
         if (s32Ret != HI_SUCCESS) {
-            return HI_FAILURE;
+            SAMPLE_PRT("before SAMPLE_VENC_ModifyResolution chn %d\n", ch->VencChn);
+            s32Ret = SAMPLE_VENC_ModifyResolution(stViConfig.astViInfo[0].stSnsInfo.enSnsType, &ch->enSize, &stSize);
+            if (s32Ret != HI_SUCCESS) {
+                return HI_FAILURE;
+            }
         }
+        abChnEnable[ch->VpssChn] = HI_TRUE;
+        astSize[ch->VpssChn] = stSize;
+        aVencChn[i] = ch->VencChn;
     }
 
     stViConfig.s32WorkingViNum = 1;
@@ -1540,7 +2336,7 @@ HI_S32 SAMPLE_VENC_H265_H264(void)
         return HI_FAILURE;
     }
 
-    s32Ret = SAMPLE_VENC_VPSS_Init(VpssGrp, abChnEnable, DYNAMIC_RANGE_SDR8, PIXEL_FORMAT_YVU_SEMIPLANAR_420, stSize,
+    s32Ret = SAMPLE_VENC_VPSS_Init(VpssGrp, abChnEnable, DYNAMIC_RANGE_SDR8, PIXEL_FORMAT_YVU_SEMIPLANAR_420, astSize,
                                    stViConfig.astViInfo[0].stSnsInfo.enSnsType);
     if (HI_SUCCESS != s32Ret) {
         SAMPLE_PRT("Init VPSS err for %#x!\n", s32Ret);
@@ -1568,25 +2364,31 @@ HI_S32 SAMPLE_VENC_H265_H264(void)
         goto EXIT_VI_VPSS_UNBIND;
     }
 
-    s32Ret = HisiLive_COMM_VENC_Start(VencChn, enPayLoad, enSize, enRcMode, u32Profile, bRcnRefShareBuf, &stGopAttr);
-    if (HI_SUCCESS != s32Ret) {
-        SAMPLE_PRT("Venc Start failed for %#x!\n", s32Ret);
-        goto EXIT_VI_VPSS_UNBIND;
-    }
+    // every channel is encoded from its own VPSS channel at its own size and bitrate
+    for (s32Started = 0; s32Started < gChannelCount; s32Started++) {
+        ch = &gChannel[s32Started];
+        s32Ret = HisiLive_COMM_VENC_Start(ch->VencChn, ch->enPayload, ch->enSize, (HI_U32)ch->bitRate, enRcMode, u32Profile,
+                                          bRcnRefShareBuf, &stGopAttr);
+        if (HI_SUCCESS != s32Ret) {
+            SAMPLE_PRT("Venc Start chn %d failed for %#x!\n", ch->VencChn, s32Ret);
+            goto EXIT_VENC_STOP;
+        }
 
-    s32Ret = SAMPLE_COMM_VPSS_Bind_VENC(VpssGrp, VpssChn, VencChn);
-    if (HI_SUCCESS != s32Ret) {
-        SAMPLE_PRT("Venc Get GopAttr failed for %#x!\n", s32Ret);
-        goto EXIT_VENC_H265_STOP;
+        s32Ret = SAMPLE_COMM_VPSS_Bind_VENC(VpssGrp, ch->VpssChn, ch->VencChn);
+        if (HI_SUCCESS != s32Ret) {
+            SAMPLE_PRT("Venc bind VPSS chn %d failed for %#x!\n", ch->VencChn, s32Ret);
+            SAMPLE_COMM_VENC_Stop(ch->VencChn);
+            goto EXIT_VENC_STOP;
+        }
     }
 
     /******************************************
      stream save process
     ******************************************/
-    s32Ret = HisiLive_COMM_VENC_StartGetStream(VencChn);
+    s32Ret = HisiLive_COMM_VENC_StartGetStream(aVencChn, gChannelCount);
     if (HI_SUCCESS != s32Ret) {
         SAMPLE_PRT("Start Venc failed!\n");
-        goto EXIT_VENC_H264_UnBind;
+        goto EXIT_VENC_STOP;
     }
 
     LOGD("please press twice ENTER to exit this sample\n");
@@ -1598,10 +2400,12 @@ HI_S32 SAMPLE_VENC_H265_H264(void)
     ******************************************/
     HisiLive_COMM_VENC_StopGetStream();
 
-EXIT_VENC_H264_UnBind:
-    SAMPLE_COMM_VPSS_UnBind_VENC(VpssGrp, VpssChn, VencChn);
-EXIT_VENC_H265_STOP:
-    SAMPLE_COMM_VENC_Stop(VencChn);
+EXIT_VENC_STOP:
+    while (s32Started-- > 0) {
+        ch = &gChannel[s32Started];
+        SAMPLE_COMM_VPSS_UnBind_VENC(VpssGrp, ch->VpssChn, ch->VencChn);
+        SAMPLE_COMM_VENC_Stop(ch->VencChn);
+    }
 EXIT_VI_VPSS_UNBIND:
     SAMPLE_COMM_VI_UnBind_VPSS(ViPipe, ViChn, VpssGrp);
 EXIT_VPSS_STOP:
@@ -1613,6 +2417,154 @@ EXIT_VI_STOP:
     return s32Ret;
 }
 
+/* the main stream from VPSS chn 1 to VENC chn 0, and with -a a sub stream from VPSS chn 2 to VENC chn 1 */
+static void HisiLive_InitChannels(void)
+{
+    LiveChannel *ch = &gChannel[0];
+
+    ch->VencChn = 0;
+    ch->VpssChn = 1;
+    ch->enPayload = gParamOption.videoFormat;
+    ch->enSize = gParamOption.videoSize;
+    ch->bitRate = gParamOption.bitRate;
+    ch->rtspPort = gParamOption.rtspPort;
+    gChannelCount = 1;
+
+    if (gParamOption.subStream) {
+        ch = &gChannel[1];
+        ch->VencChn = 1;
+        ch->VpssChn = 2;
+        ch->enPayload = gParamOption.subFormat;
+        ch->enSize = gParamOption.subSize;
+        ch->bitRate = gParamOption.subBitRate;
+        ch->rtspPort = gParamOption.rtspPort > 0 ? gParamOption.rtspPort + 1 : 0;
+        gChannelCount = 2;
+    }
+}
+
+static void HisiLive_StopChannel(LiveChannel *ch)
+{
+    streamSinkStop(&ch->sender);
+    rtspStop(&ch->rtsp);
+    gopCacheStop(&ch->gop);
+    rtcpStop(&ch->rtcp);
+    pacerStop(&ch->pacer);
+}
+
+/* RTP sending of a channel: its own socket, SSRC, sequence numbers, receivers, RTCP and RTSP server */
+static int HisiLive_StartChannel(LiveChannel *ch)
+{
+    int i;
+
+    if (ch == &gChannel[0]) {
+        if (gParamOption.ipCount > 0) {
+            strcpy(ch->udp.dstIp, gParamOption.ip[0]);
+            ch->udp.dstPort = gParamOption.port[0];
+        }
+    } else if (gParamOption.subIp[0]) {
+        strcpy(ch->udp.dstIp, gParamOption.subIp);
+        ch->udp.dstPort = gParamOption.subPort;
+    }
+    ch->udp.gso = gParamOption.gso;
+    if (udpInit(&ch->udp)) {
+        LOGE("udpInit error.\n");
+        return -1;
+    }
+
+    // every frame is packetized once and sent to all receivers
+    for (i = 1; ch == &gChannel[0] && i < gParamOption.ipCount; i++) {
+        udpAddDest(&ch->udp, gParamOption.ip[i], gParamOption.port[i], 0);
+    }
+
+    initRTPMuxContext(&ch->rtp);
+    ch->rtp.batchSize = gParamOption.batchSize;
+    ch->rtp.payload_type = (ch->enPayload == PT_H264) ? 0 : 1;
+
+    // IDR bursts are spread over part of the frame interval by the pacer thread
+    if (gParamOption.pacing > 0) {
+        ch->pacer.udp = &ch->udp;
+        ch->pacer.frameRate = gParamOption.frameRate;
+        ch->pacer.bitRate = ch->bitRate;
+        ch->pacer.fraction = gParamOption.pacing;
+        if (pacerStart(&ch->pacer)) {
+            LOGE("pacerStart error.\n");
+            return -1;
+        }
+        ch->rtp.pacer = &ch->pacer;
+    }
+
+    // NACKed packets are resent from the history by the RTCP thread
+    if (gParamOption.nackWindow > 0) {
+        ch->history.window = gParamOption.nackWindow;
+        ch->history.rtxPayloadType = gParamOption.rtxPayloadType;
+        retransmitInit(&ch->history);
+        ch->rtp.history = &ch->history;
+    }
+
+    // for one-way links, lost packets are recovered from XOR FEC without feedback
+    if (gParamOption.fecGroup > 0) {
+        ch->fec.groupSize = gParamOption.fecGroup;
+        ch->fec.groupSizeKey = gParamOption.fecGroupKey;
+        if (fecInit(&ch->fec)) {
+            pacerStop(&ch->pacer);
+            return -1;
+        }
+        ch->rtp.fec = &ch->fec;
+    }
+
+    // sender reports to every receiver, receiver reports give loss/jitter/RTT
+    ch->rtcp.rtp = &ch->rtp;
+    ch->rtcp.udp = &ch->udp;
+    if (rtcpStart(&ch->rtcp)) {
+        LOGE("rtcpStart error, no RTCP.\n");
+    }
+
+    if (ch->rtspPort > 0) {
+        // SDP is generated from the encoder settings and the parameter sets of the live stream
+        ch->rtsp.port = ch->rtspPort;
+        ch->rtsp.codec = ch->rtp.payload_type;
+        ch->rtsp.frameRate = gParamOption.frameRate;
+        ch->rtsp.bitRate = ch->bitRate;
+        ch->rtsp.rtp = &ch->rtp;
+        ch->rtsp.udp = &ch->udp;
+        ch->rtsp.rtcp = ch->rtcp.running ? &ch->rtcp : NULL;
+
+        // a new session is sent the GOP from the last IDR and gets its first picture at once
+        if (gParamOption.gopCacheRate > 0) {
+            ch->gop.udp = &ch->udp;
+            ch->gop.bitRate = ch->bitRate;
+            ch->gop.rate = gParamOption.gopCacheRate;
+            ch->gop.maxAge = gParamOption.gopCacheAge;
+            ch->gop.requestKeyFrame = HisiLive_RequestIDR;
+            ch->gop.arg = ch;
+            if (gopCacheStart(&ch->gop) == 0) {
+                ch->rtp.gop = &ch->gop;
+                ch->rtsp.gop = &ch->gop;
+            }
+        }
+        if (rtspStart(&ch->rtsp)) {
+            LOGE("rtspStart error.\n");
+            HisiLive_StopChannel(ch);
+            return -1;
+        }
+    }
+
+    // the capture thread only queues frames, packetizing and sending run in the sender thread
+    ch->sender.name = ch == &gChannel[0] ? "RTPSender" : "RTPSender1";
+    ch->sender.onFrame = HisiLive_SendFrame;
+    ch->sender.arg = ch;
+    ch->sender.dropWatermark = gParamOption.dropWatermark;
+    if (streamSinkStart(&ch->sender)) {
+        LOGE("streamSinkStart error.\n");
+        HisiLive_StopChannel(ch);
+        return -1;
+    }
+
+    LOGD("chn %d: %s %s %d kbps, RTP port %d, RTSP port %d\n", ch->VencChn, ch->enPayload == PT_H264 ? "H.264" : "H.265",
+         HisiLive_SizeName(ch->enSize), ch->bitRate, ch->udp.localPort, ch->rtspPort);
+    return 0;
+}
+
 /******************************************************************************
  * function    : main()
  * Description : video venc sample
@@ -1621,31 +2573,55 @@ EXIT_VI_STOP:
 int main(int argc, char *argv[])
 {
     HI_S32 s32Ret;
+    int i;
     char logo[200] = { 0 };
     sprintf(logo, "+-------------------------+\n|         HisiLive        |\n|  %s %s   |\n+-------------------------+\n", __DATE__,
             __TIME__);
-    GREEN("%s\n", logo);
 
-    writeFile("log.txt", logo, strlen(logo), 0);
+    // the console and log.txt are written by the logger thread, the log of the previous run is kept as log.txt.1
+    logStart("log.txt", LOG_FILE_MAX, LOG_FILE_KEEP);
+    GREEN("%s\n", logo);
 
     if (HisiLive_ParseParam(argc, argv)) {
         HisiLive_ShowUsage(argv[0]);
         return -1;
     }
 
+    HisiLive_InitChannels();
     if (gParamOption.mode == MODE_RTP) {
-        strcpy(gUDPCtx.dstIp, gParamOption.ip);
-        gUDPCtx.dstPort = 1234;
-        int res = udpInit(&gUDPCtx);
-        if (res) {
-            LOGE("udpInit error.\n");
-            return -1;
+        for (i = 0; i < gChannelCount; i++) {
+            if (HisiLive_StartChannel(&gChannel[i])) {
+                LOGE("channel %d start error.\n", i);
+                while (i-- > 0) {
+                    HisiLive_StopChannel(&gChannel[i]);
+                }
+                return -1;
+            }
         }
+    }
 
-        initRTPMuxContext(&gRTPCtx);
+    if (gParamOption.mode == MODE_FILE && gParamOption.preRoll > 0) {
+        signal(SIGUSR1, HisiLive_HandleTrigger);
+        if (eventControlStart(EVENT_CONTROL_PORT, NULL)) {
+            LOGE("eventControlStart error, trigger with SIGUSR1 only.\n");
+        }
+    } else if (gParamOption.mode == MODE_RTP && eventControlStart(EVENT_CONTROL_PORT, HisiLive_QueryLatency)) {
+        LOGE("eventControlStart error, no latency query.\n");
+    }
+
+    if (gParamOption.metricsPort > 0 && HisiLive_StartMetrics()) {
+        LOGE("HisiLive_StartMetrics error, no metrics.\n");
     }
 
     s32Ret = SAMPLE_VENC_H265_H264();
+    metricsStop(&gMetrics);
+    for (i = 0; i < gChannelCount; i++) {
+        streamSinkStop(&gChannel[i].sender);
+    }
+    eventControlStop();
+    for (i = 0; i < gChannelCount; i++) {
+        HisiLive_StopChannel(&gChannel[i]);
+    }
     if (HI_SUCCESS == s32Ret) {
         LOGD("program exit normally!\n");
     } else {
@@ -0,0 +1,594 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+/*
+ * Microbenchmarks of the streaming hot paths: the start code scanner, the RTP packetizer (single NAL, STAP-A/AP,
+ * FU-A/FU) and the UDP send path to a loopback sink, over synthetic streams at camera bitrates or a recorded one.
+ */
+
+#define _GNU_SOURCE  // recvmmsg
+#include "FileSource.h"
+#include "Media.h"
+#include "Network.h"
+#include "RTP.h"
+#include "Utils.h"
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_FRAME_RATE 30
+#define BENCH_GOP 30
+#define BENCH_IDR_RATIO 5    // an IDR is this many times a P frame
+#define BENCH_FRAMES 300     // synthetic stream length, 10 s
+#define BENCH_SLICE_SINGLE 1000  // bytes of a slice sent as one single NAL packet
+#define BENCH_SLICE_AGGREGATE 200  // bytes of a slice aggregated into STAP-A/AP packets
+#define BENCH_SINK_PORT 15004
+
+typedef struct {
+    const char *name;
+    int bitRate;  // kbps
+} BenchProfile;
+
+static const BenchProfile gProfiles[] = {
+    { "720p", 2048 },
+    { "1080p", 4096 },
+    { "4k", 16384 },
+};
+
+/* a stream in memory: Annex-B data and its frames */
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    MediaFrame *frames;
+    MediaPack *packs;
+    int frameCount;
+    int packCount;
+} BenchStream;
+
+typedef struct {
+    const char *name;
+    const char *profile;
+    int bitRate;
+    uint64_t frames;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t time;    // μs
+    uint64_t cycles;  // 0: no cycle counter
+    uint64_t lost;    // transport: packets not seen by the sink
+} BenchResult;
+
+static int gCodec;           // 0: H.264, 1: H.265
+static int gDuration = 1000;  // ms per case
+static FILE *gJson;  // -j, one JSON object per benchmark and line
+static int gCycleFd = -1;
+static const char *gFilter;
+
+static volatile int gSinkRunning;
+static uint64_t gSinkPackets;
+
+/* CPU cycles from the perf counter of this thread, or the TSC on x86 */
+static uint64_t benchCycles(void)
+{
+    uint64_t count;
+
+    if (gCycleFd >= 0 && read(gCycleFd, &count, sizeof(count)) == sizeof(count)) {
+        return count;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void benchInitCycles(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    gCycleFd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void benchPrint(const BenchResult *r)
+{
+    double sec = r->time / 1e6;
+    double cpb = r->cycles && r->bytes ? (double)r->cycles / r->bytes : 0;
+
+    printf("%-12s %-8s %8.0f frames/s %10.0f packets/s %8.3f Gbit/s %7.3f cycles/B", r->name, r->profile, r->frames / sec,
+           r->packets / sec, r->bytes * 8 / sec / 1e9, cpb);
+    if (r->lost)
+        printf("  lost %llu", (unsigned long long)r->lost);
+    printf("\n");
+    fflush(stdout);
+
+    if (gJson) {
+        fprintf(gJson, "{\"bench\":\"%s\",\"stream\":\"%s\",\"codec\":\"%s\",\"kbps\":%d,\"frames\":%llu,\"packets\":%llu,"
+               "\"bytes\":%llu,\"seconds\":%.6f,\"frames_per_s\":%.1f,\"packets_per_s\":%.1f,\"gbit_per_s\":%.4f,"
+               "\"cycles_per_byte\":%.4f,\"lost\":%llu}\n",
+               r->name, r->profile, gCodec ? "h265" : "h264", r->bitRate, (unsigned long long)r->frames,
+               (unsigned long long)r->packets, (unsigned long long)r->bytes, sec, r->frames / sec, r->packets / sec,
+               r->bytes * 8 / sec / 1e9, cpb, (unsigned long long)r->lost);
+        fflush(gJson);
+    }
+}
+
+/* random payload without 00 bytes, so no emulated start codes */
+static void benchFill(uint8_t *p, size_t len, uint32_t *seed)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        *seed = *seed * 1103515245 + 12345;
+        p[i] = (uint8_t)((*seed >> 16) % 255 + 1);
+    }
+}
+
+/* a NAL of len bytes after the header; slice: -1 not a slice, 1 the first slice of the picture, 0 another one */
+static uint8_t *benchNAL(uint8_t *p, int type, int slice, size_t len, uint32_t *seed)
+{
+    memcpy(p, "\x00\x00\x00\x01", 4);
+    p += 4;
+    if (gCodec == 0) {
+        *p++ = (uint8_t)type;
+    } else {
+        *p++ = (uint8_t)(type << 1);
+        *p++ = 1;  // TID 1
+    }
+    benchFill(p, len, seed);
+    if (slice >= 0) {
+        p[0] = slice ? 0x88 : 0x08;  // first_mb_in_slice 0 / first_slice_segment_in_pic_flag
+    }
+    return p + len;
+}
+
+/*
+ * BENCH_FRAMES frames at bitRate, a GOP per second, every frame cut into slices of sliceSize bytes
+ * (0: one NAL per frame); key frames start with the parameter sets.
+ */
+static int benchSynthStream(BenchStream *s, int bitRate, int sliceSize)
+{
+    uint32_t seed = 1;
+    size_t pFrame = (size_t)bitRate * 1000 / 8 / (BENCH_GOP - 1 + BENCH_IDR_RATIO);
+    size_t maxPacks = 0, frameSize, len, left;
+    uint8_t *p;
+    int i, n, key;
+
+    s->size = 0;
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        frameSize = i % BENCH_GOP ? pFrame : pFrame * BENCH_IDR_RATIO;
+        n = sliceSize ? (int)((frameSize + sliceSize - 1) / sliceSize) : 1;
+        s->size += frameSize + (size_t)n * 6 + 64;
+        maxPacks += (size_t)n + 3;
+    }
+    s->data = (uint8_t *)malloc(s->size);
+    s->frames = (MediaFrame *)calloc(BENCH_FRAMES, sizeof(MediaFrame));
+    s->packs = (MediaPack *)calloc(maxPacks, sizeof(MediaPack));
+    if (!s->data || !s->frames || !s->packs) {
+        LOGE("bench malloc error.\n");
+        return -1;
+    }
+
+    p = s->data;
+    s->packCount = 0;
+    for (i = 0; i < BENCH_FRAMES; i++) {
+        MediaFrame *f = &s->frames[i];
+        key = i % BENCH_GOP == 0;
+        f->packs = &s->packs[s->packCount];
+        f->pts = (uint64_t)i * 1000000 / BENCH_FRAME_RATE;
+        f->keyFrame = key;
+        f->reference = 1;
+        n = 0;
+
+        if (key) {
+            int sets[3] = { 32, 33, 34 };
+            int j, first = gCodec ? 0 : 1;
+            for (j = first; j < 3; j++) {
+                MediaPack *pack = &s->packs[s->packCount + n++];
+                int type = gCodec ? sets[j] : 6 + j;  // SPS 7, PPS 8
+                pack->data = p;
+                p = benchNAL(p, type, -1, j == 1 ? 16 : 8, &seed);
+                pack->len = (uint32_t)(p - pack->data);
+                pack->nalType = type;
+                pack->nalCount = 1;
+            }
+        }
+
+        frameSize = i % BENCH_GOP ? pFrame : pFrame * BENCH_IDR_RATIO;
+        for (left = frameSize; left > 0; left -= len) {
+            MediaPack *pack = &s->packs[s->packCount + n++];
+            int type = gCodec ? (key ? HEVC_NAL_IDR_W_RADL : HEVC_NAL_TRAIL_R) : (key ? 0x65 : 0x41);
+            len = sliceSize && left > (size_t)sliceSize ? (size_t)sliceSize : left;
+            pack->data = p;
+            p = benchNAL(p, type, left == frameSize, len, &seed);
+            pack->len = (uint32_t)(p - pack->data);
+            pack->nalType = gCodec ? type : (type & 0x1f);
+            pack->nalCount = 1;
+        }
+        f->packCount = n;
+        s->packCount += n;
+    }
+    s->size = (size_t)(p - s->data);
+    s->frameCount = BENCH_FRAMES;
+    return 0;
+}
+
+/* the frames of a recorded stream, the packs point into a copy of the file */
+static int benchLoadStream(BenchStream *s, const char *path)
+{
+    FileSource fs;
+    MediaFrame frame;
+    size_t cap = 1024, packCap = 4096;
+    int i;
+
+    memset(&fs, 0, sizeof(fs));
+    fs.src.codec = -1;
+    fs.loop = 1;
+    if (fileSourceOpen(&fs, path)) {
+        return -1;
+    }
+    gCodec = fs.src.codec;
+    s->size = fs.size;
+    s->data = (uint8_t *)malloc(s->size);
+    s->frames = (MediaFrame *)malloc(cap * sizeof(MediaFrame));
+    s->packs = (MediaPack *)malloc(packCap * sizeof(MediaPack));
+    if (!s->data || !s->frames || !s->packs) {
+        sourceClose(&fs.src);
+        return -1;
+    }
+    memcpy(s->data, fs.data, s->size);
+
+    s->frameCount = 0;
+    s->packCount = 0;
+    while (fs.src.read(&fs.src, &frame) == 0) {
+        if ((size_t)s->frameCount == cap) {
+            cap *= 2;
+            s->frames = (MediaFrame *)realloc(s->frames, cap * sizeof(MediaFrame));
+        }
+        while ((size_t)(s->packCount + frame.packCount) > packCap) {
+            packCap *= 2;
+            s->packs = (MediaPack *)realloc(s->packs, packCap * sizeof(MediaPack));
+        }
+        if (!s->frames || !s->packs) {
+            sourceClose(&fs.src);
+            return -1;
+        }
+        s->frames[s->frameCount] = frame;
+        s->frames[s->frameCount].packs = (const MediaPack *)(uintptr_t)s->packCount;  // index until the array is final
+        for (i = 0; i < frame.packCount; i++) {
+            s->packs[s->packCount + i] = frame.packs[i];
+            s->packs[s->packCount + i].data = s->data + (frame.packs[i].data - fs.data);
+        }
+        s->packCount += frame.packCount;
+        s->frameCount++;
+    }
+    for (i = 0; i < s->frameCount; i++) {
+        s->frames[i].packs = s->packs + (uintptr_t)s->frames[i].packs;
+    }
+    sourceClose(&fs.src);
+    return s->frameCount > 0 ? 0 : -1;
+}
+
+static void benchFreeStream(BenchStream *s)
+{
+    free(s->data);
+    free(s->frames);
+    free(s->packs);
+    memset(s, 0, sizeof(*s));
+}
+
+static int benchSelected(const char *name)
+{
+    return NULL == gFilter || strstr(name, gFilter) != NULL;
+}
+
+/* ff_avc_find_startcode over the whole stream, NAL by NAL as the packetizer does */
+static void benchStartCode(const BenchStream *s, BenchResult *r)
+{
+    const uint8_t *end = s->data + s->size;
+    const uint8_t *p;
+    uint64_t start, cycles, nals = 0;
+
+    start = getMonotonicTime();
+    cycles = benchCycles();
+    do {
+        p = ff_avc_find_startcode(s->data, end);
+        while (p < end) {
+            while (p < end && !*p)
+                p++;
+            p = ff_avc_find_startcode(p + 1, end);
+            nals++;
+        }
+        r->bytes += s->size;
+        r->frames += (uint64_t)s->frameCount;
+        r->time = getMonotonicTime() - start;
+    } while (r->time < (uint64_t)gDuration * 1000);
+    r->cycles = cycles ? benchCycles() - cycles : 0;
+    r->packets = nals;  // NALs found
+}
+
+/* rtpSendFrame over the stream: packetizing only when udp has no receiver, else sent to the sink */
+static void benchPacketize(const BenchStream *s, UDPContext *udp, int aggregation, BenchResult *r)
+{
+    RTPMuxContext *ctx = (RTPMuxContext *)calloc(1, sizeof(RTPMuxContext));
+    uint64_t start, cycles;
+    int i, j;
+
+    if (NULL == ctx)
+        return;
+    initRTPMuxContext(ctx);
+    ctx->payload_type = gCodec;
+    ctx->aggregation = aggregation;
+
+    start = getMonotonicTime();
+    cycles = benchCycles();
+    do {
+        for (i = 0; i < s->frameCount; i++) {
+            rtpSendFrame(ctx, udp, &s->frames[i]);
+            for (j = 0; j < s->frames[i].packCount; j++) {
+                r->bytes += s->frames[i].packs[j].len;
+            }
+        }
+        r->frames += (uint64_t)s->frameCount;
+        r->time = getMonotonicTime() - start;
+    } while (r->time < (uint64_t)gDuration * 1000);
+    r->cycles = cycles ? benchCycles() - cycles : 0;
+    r->packets = ctx->sentPackets;
+    free(ctx);
+}
+
+static void *benchSinkThread(void *arg)
+{
+    int sock = *(int *)arg;
+    struct mmsghdr msgs[UDP_BATCH_MAX];
+    struct iovec iov[UDP_BATCH_MAX];
+    static uint8_t buf[UDP_BATCH_MAX][1500];
+    struct timeval tv = { 0, 100000 };
+    int i, n;
+
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    for (i = 0; i < UDP_BATCH_MAX; i++) {
+        iov[i].iov_base = buf[i];
+        iov[i].iov_len = sizeof(buf[i]);
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    while (gSinkRunning) {
+        n = recvmmsg(sock, msgs, UDP_BATCH_MAX, 0, NULL);
+        if (n > 0)
+            __atomic_add_fetch(&gSinkPackets, (uint64_t)n, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/* a loopback receiver draining its socket in a thread */
+static int benchSinkStart(int *sock, pthread_t *thread)
+{
+    struct sockaddr_in addr;
+    int size = 8 * 1024 * 1024;
+
+    *sock = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(BENCH_SINK_PORT);
+    setsockopt(*sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (*sock < 0 || bind(*sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOGE("bench sink bind error.\n");
+        return -1;
+    }
+    gSinkPackets = 0;
+    gSinkRunning = 1;
+    return pthread_create(thread, NULL, benchSinkThread, sock);
+}
+
+static void benchSinkStop(int sock, pthread_t thread)
+{
+    usleep(200000);  // the last packets
+    gSinkRunning = 0;
+    pthread_join(thread, NULL);
+    close(sock);
+}
+
+/* udpSend of one RTP sized packet at a time, the send path without batching */
+static void benchUDPSend(UDPContext *udp, BenchResult *r)
+{
+    uint8_t packet[RTP_HEADER_SIZE + RTP_PAYLOAD_MAX];
+    uint64_t start, cycles;
+    uint32_t seed = 1;
+    int i;
+
+    benchFill(packet, sizeof(packet), &seed);
+    start = getMonotonicTime();
+    cycles = benchCycles();
+    do {
+        for (i = 0; i < 1000; i++) {
+            udpSend(udp, packet, sizeof(packet));
+        }
+        r->packets += 1000;
+        r->bytes += 1000 * sizeof(packet);
+        r->time = getMonotonicTime() - start;
+    } while (r->time < (uint64_t)gDuration * 1000);
+    r->cycles = cycles ? benchCycles() - cycles : 0;
+}
+
+static void benchRun(const BenchStream *s, const char *profile, int bitRate, int sliceSize)
+{
+    static const char *packetizeName[3][2] = { { "rtp_single", "rtp_single" }, { "rtp_stapa", "rtp_ap" }, { "rtp_fua", "rtp_fu" } };
+    UDPContext udp;
+    BenchResult r;
+    pthread_t thread;
+    int sock, mode;
+
+    memset(&udp, 0, sizeof(udp));
+    if (udpInit(&udp)) {  // no receiver: packetizing only
+        return;
+    }
+
+    // the modes by slice size, a recorded stream is packetized as it is, with and without aggregation
+    for (mode = 0; mode < 3; mode++) {
+        if (sliceSize >= 0 && sliceSize != (mode == 0 ? BENCH_SLICE_SINGLE : mode == 1 ? BENCH_SLICE_AGGREGATE : 0))
+            continue;
+        if (sliceSize < 0 && mode == 2)
+            continue;
+        memset(&r, 0, sizeof(r));
+        r.name = sliceSize < 0 ? (mode ? "rtp_aggregate" : "rtp") : packetizeName[mode][gCodec];
+        if (!benchSelected(r.name))
+            continue;
+        r.profile = profile;
+        r.bitRate = bitRate;
+        benchPacketize(s, &udp, mode == 1, &r);
+        benchPrint(&r);
+    }
+
+    if (sliceSize <= 0) {  // once per stream
+        if (benchSelected("startcode")) {
+            memset(&r, 0, sizeof(r));
+            r.name = "startcode";
+            r.profile = profile;
+            r.bitRate = bitRate;
+            benchStartCode(s, &r);
+            benchPrint(&r);
+        }
+
+        // the whole send path: packetizing and sendmmsg to a loopback receiver, then with FU-A runs sent by UDP GSO
+        for (mode = 0; mode < 2; mode++) {
+            if (!benchSelected(mode ? "rtp_gso" : "rtp_udp") || benchSinkStart(&sock, &thread))
+                continue;
+            udpAddDest(&udp, "127.0.0.1", BENCH_SINK_PORT, 0);
+            udp.gso = mode;
+            memset(&r, 0, sizeof(r));
+            r.name = mode ? "rtp_gso" : "rtp_udp";
+            r.profile = profile;
+            r.bitRate = bitRate;
+            benchPacketize(s, &udp, 0, &r);
+            udpRemoveDest(&udp, "127.0.0.1", BENCH_SINK_PORT);
+            benchSinkStop(sock, thread);
+            r.lost = r.packets > gSinkPackets ? r.packets - gSinkPackets : 0;
+            benchPrint(&r);
+        }
+    }
+    close(udp.socket);
+}
+
+static void benchTransport(void)
+{
+    UDPContext udp;
+    BenchResult r;
+    pthread_t thread;
+    int sock;
+
+    if (!benchSelected("udp_send") || benchSinkStart(&sock, &thread)) {
+        return;
+    }
+    memset(&udp, 0, sizeof(udp));
+    strcpy(udp.dstIp, "127.0.0.1");
+    udp.dstPort = BENCH_SINK_PORT;
+    if (udpInit(&udp) == 0) {
+        usleep(200000);
+        __atomic_store_n(&gSinkPackets, 0, __ATOMIC_RELAXED);  // without the test packet of udpInit
+        memset(&r, 0, sizeof(r));
+        r.name = "udp_send";
+        r.profile = "loopback";
+        benchUDPSend(&udp, &r);
+        benchSinkStop(sock, thread);
+        r.lost = r.packets > gSinkPackets ? r.packets - gSinkPackets : 0;
+        benchPrint(&r);
+        close(udp.socket);
+    } else {
+        benchSinkStop(sock, thread);
+    }
+}
+
+static void benchUsage(const char *name)
+{
+    printf("Usage : %s [options]\n", name);
+    printf("\t -e: 264/265, synthetic streams, default 264.\n");
+    printf("\t -f: a recorded .h264/.h265 stream instead of the synthetic ones.\n");
+    printf("\t -t: ms per benchmark, default 1000.\n");
+    printf("\t -b: only benchmarks whose name contains this, e.g. rtp_fua, startcode, udp.\n");
+    printf("\t -j: also write the results to this file, one JSON object per line.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    BenchStream s;
+    const char *file = NULL;
+    size_t i;
+    int c;
+
+    while ((c = getopt(argc, argv, "e:f:t:b:j:h")) != -1) {
+        switch (c) {
+            case 'e':
+                gCodec = !strcmp(optarg, "265");
+                break;
+            case 'f':
+                file = optarg;
+                break;
+            case 't':
+                gDuration = atoi(optarg);
+                if (gDuration <= 0) {
+                    benchUsage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'b':
+                gFilter = optarg;
+                break;
+            case 'j':
+                gJson = fopen(optarg, "w");
+                if (NULL == gJson) {
+                    LOGE("open %s error.\n", optarg);
+                    return -1;
+                }
+                break;
+            default:
+                benchUsage(argv[0]);
+                return -1;
+        }
+    }
+
+    benchInitCycles();
+    memset(&s, 0, sizeof(s));
+
+    if (file) {
+        if (benchLoadStream(&s, file)) {
+            LOGE("load %s error.\n", file);
+            return -1;
+        }
+        benchRun(&s, "file", 0, -1);
+        benchFreeStream(&s);
+    } else {
+        for (i = 0; i < sizeof(gProfiles) / sizeof(gProfiles[0]); i++) {
+            int slices[3] = { BENCH_SLICE_SINGLE, BENCH_SLICE_AGGREGATE, 0 };
+            int j;
+            for (j = 0; j < 3; j++) {
+                if (benchSynthStream(&s, gProfiles[i].bitRate, slices[j]) == 0) {
+                    benchRun(&s, gProfiles[i].name, gProfiles[i].bitRate, slices[j]);
+                }
+                benchFreeStream(&s);
+            }
+        }
+    }
+    benchTransport();
+
+    if (gCycleFd >= 0)
+        close(gCycleFd);
+    if (gJson)
+        fclose(gJson);
+    return 0;
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+/*
+ * Receive the RTP stream of HisiLive (or tools/replay) on a host: jitter buffer, H.264/H.265 depacketizer,
+ * and reports of loss, reordering, frame completion and sender-to-receiver latency.
+ *
+ * Latency maps the RTP timestamp of a frame to the sender's wall clock with the last RTCP sender report, so it
+ * is measured after the first SR and needs the clocks of both hosts in sync (the same host over loopback).
+ */
+
+#define _GNU_SOURCE  // recvmmsg
+#include "Histogram.h"
+#include "JitterBuffer.h"
+#include "RTCP.h"
+#include "RTP.h"
+#include "RTPDemux.h"
+#include "Utils.h"
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define RECV_RTP_PORT 1234
+#define RECV_JITTER_DELAY 50    // ms
+#define RECV_REPORT_INTERVAL 5  // s
+#define RECV_BATCH 64           // packets per recvmmsg
+#define RECV_BUFFER_SIZE (4 * 1024 * 1024)
+#define RECV_BYE_LINGER 200  // ms, packets still in flight after a BYE
+
+typedef struct {
+    int port;
+    int codec;
+    int delay;
+    const char *output;
+    int duration;  // s, 0: until BYE or Ctrl+C
+    int interval;  // s between reports, 0: only at the end
+} RecvOption;
+
+typedef struct {
+    int valid;
+    uint32_t ssrc;
+    uint32_t rtpTime;
+    int64_t wallTime;  // μs since 1970 at rtpTime
+} RecvSenderReport;
+
+static RecvOption gOption;
+static volatile int gRunning = 1;
+
+static JitterBuffer gJitter;
+static RTPDemuxContext gDemux;
+static RecvSenderReport gReport;
+static FILE *gOutput;
+
+static int64_t gWallOffset;  // wall clock - monotonic clock, μs
+static uint64_t gPopTime;    // monotonic μs when the packets being demuxed left the jitter buffer
+
+static uint32_t gKeyFrames;
+static uint32_t gUnmapped;        // frames received before the first sender report
+static Histogram gNetworkLatency;  // last packet of a frame received
+static Histogram gPlayoutLatency;  // frame out of the jitter buffer
+static uint64_t gBytes;
+
+static void recvUsage(const char *name)
+{
+    printf("Usage : %s [options]\n", name);
+    printf("\t -p: RTP port, RTCP on port + 1, default %d.\n", RECV_RTP_PORT);
+    printf("\t -e: 264/265, default 264.\n");
+    printf("\t -d: jitter buffer delay in ms, default %d.\n", RECV_JITTER_DELAY);
+    printf("\t -o: write the received frames to this file.\n");
+    printf("\t -t: stop after this many seconds, default at RTCP BYE or Ctrl+C.\n");
+    printf("\t -r: report every this many seconds, 0: only at the end, default %d.\n", RECV_REPORT_INTERVAL);
+    printf("e.g. %s -p 5004 -d 100 -o out.h264\n", name);
+}
+
+static int recvParseParam(int argc, char *argv[])
+{
+    int c;
+
+    gOption.port = RECV_RTP_PORT;
+    gOption.delay = RECV_JITTER_DELAY;
+    gOption.interval = RECV_REPORT_INTERVAL;
+
+    while ((c = getopt(argc, argv, "p:e:d:o:t:r:h")) != -1) {
+        switch (c) {
+            case 'p':
+                gOption.port = atoi(optarg);
+                if (gOption.port <= 0 || gOption.port >= 65535)
+                    return -1;
+                break;
+            case 'e':
+                if (!strcmp(optarg, "264")) {
+                    gOption.codec = 0;
+                } else if (!strcmp(optarg, "265")) {
+                    gOption.codec = 1;
+                } else {
+                    return -1;
+                }
+                break;
+            case 'd':
+                gOption.delay = atoi(optarg);
+                if (gOption.delay < 0)
+                    return -1;
+                break;
+            case 'o':
+                gOption.output = optarg;
+                break;
+            case 't':
+                gOption.duration = atoi(optarg);
+                if (gOption.duration <= 0)
+                    return -1;
+                break;
+            case 'r':
+                gOption.interval = atoi(optarg);
+                if (gOption.interval < 0)
+                    return -1;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    return optind == argc ? 0 : -1;
+}
+
+static int64_t recvWallTime(uint64_t monotonic)
+{
+    return (int64_t)monotonic + gWallOffset;
+}
+
+/* a negative latency is clock error: the SR extrapolates the send time of the last frame */
+static uint64_t recvLatency(int64_t latency)
+{
+    return latency > 0 ? (uint64_t)latency : 0;
+}
+
+static void recvFrame(void *arg, const RTPFrame *frame)
+{
+    int64_t sent;
+
+    (void)arg;
+    gKeyFrames += frame->keyFrame;
+    gBytes += (uint64_t)frame->len;
+    if (gOutput && frame->len > 0) {
+        fwrite(frame->data, 1, frame->len, gOutput);
+    }
+
+    if (!gReport.valid || gReport.ssrc != gDemux.ssrc) {
+        gUnmapped++;
+        return;
+    }
+
+    // the sender's wall clock when it sent the frame, from the RTP timestamp distance to the sender report
+    sent = gReport.wallTime + (int64_t)(int32_t)(frame->timestamp - gReport.rtpTime) * 100 / 9;
+    histogramAdd(&gNetworkLatency, recvLatency(recvWallTime(frame->lastArrival) - sent));
+    histogramAdd(&gPlayoutLatency, recvLatency(recvWallTime(gPopTime) - sent));
+}
+
+/* the sender reports and BYE of a compound RTCP packet, return 1 on BYE */
+static int recvHandleRTCP(const uint8_t *buf, int len)
+{
+    uint32_t sec, frac;
+    int bye = 0;
+
+    while (len >= 4) {
+        int pt = buf[1];
+        int size = (((buf[2] << 8) | buf[3]) + 1) * 4;
+
+        if ((buf[0] >> 6) != RTP_VERSION || size > len)
+            break;
+
+        if (pt == RTCP_SR && size >= 28) {
+            gReport.ssrc = ((uint32_t)buf[4] << 24) | ((uint32_t)buf[5] << 16) | ((uint32_t)buf[6] << 8) | buf[7];
+            sec = ((uint32_t)buf[8] << 24) | ((uint32_t)buf[9] << 16) | ((uint32_t)buf[10] << 8) | buf[11];
+            frac = ((uint32_t)buf[12] << 24) | ((uint32_t)buf[13] << 16) | ((uint32_t)buf[14] << 8) | buf[15];
+            gReport.rtpTime = ((uint32_t)buf[16] << 24) | ((uint32_t)buf[17] << 16) | ((uint32_t)buf[18] << 8) | buf[19];
+            gReport.wallTime = (int64_t)(sec - NTP_OFFSET) * 1000000 + (int64_t)(((uint64_t)frac * 1000000) >> 32);
+            gReport.valid = 1;
+        } else if (pt == RTCP_BYE) {
+            bye = 1;
+        }
+
+        buf += size;
+        len -= size;
+    }
+
+    return bye;
+}
+
+static int recvSocket(int port, int bufferSize)
+{
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (fd < 0) {
+        LOGE("socket error. %s\n", strerror(errno));
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        LOGE("bind port %d error. %s\n", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* demux the packets ready in the jitter buffer, all of them at the end */
+static void recvDrain(uint64_t now, int end)
+{
+    const JitterSlot *slot;
+    int gap;
+
+    gPopTime = now;
+    while ((slot = jitterPop(&gJitter, end ? UINT64_MAX : now, &gap)) != NULL) {
+        rtpDemuxPacket(&gDemux, slot->data, slot->len, slot->arrival);
+    }
+    if (end) {
+        rtpDemuxFlush(&gDemux);
+    }
+}
+
+static void recvDumpStats(uint64_t elapsed)
+{
+    char buf[256];
+
+    GREEN("%llu s: %u packets, %u lost, %u duplicate, %u reordered, %u late, %u ignored\n", (unsigned long long)elapsed / 1000000,
+          gJitter.received, gJitter.lost, gJitter.duplicates, gJitter.reordered, gJitter.late, gDemux.ignored);
+    GREEN("\t%u frames (%u key), %u complete (%.2f%%), %llu KB\n", gDemux.frames, gKeyFrames, gDemux.completeFrames,
+          gDemux.frames ? gDemux.completeFrames * 100.0 / gDemux.frames : 0.0, (unsigned long long)gBytes / 1024);
+    if (gUnmapped) {
+        GREEN("\t%u frames before the first sender report, no latency\n", gUnmapped);
+    }
+    histogramFormat(&gNetworkLatency, buf, sizeof(buf));
+    GREEN("\tnetwork latency μs: %s\n", buf);
+    histogramFormat(&gPlayoutLatency, buf, sizeof(buf));
+    GREEN("\tplayout latency μs: %s\n", buf);
+}
+
+static void recvStop(int signo)
+{
+    (void)signo;
+    gRunning = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t packets[RECV_BATCH][JITTER_SLOT_SIZE];
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iovs[RECV_BATCH];
+    struct pollfd fds[2];
+    struct timeval tv;
+    uint64_t start, now, nextReport, stopTime = 0;
+    int64_t wait;
+    int i, n, timeout;
+
+    if (recvParseParam(argc, argv)) {
+        recvUsage(argv[0]);
+        return -1;
+    }
+
+    gJitter.delay = gOption.delay;
+    gDemux.payload_type = gOption.codec;
+    gDemux.onFrame = recvFrame;
+    if (initRTPDemuxContext(&gDemux)) {
+        return -1;
+    }
+    if (gOption.output && NULL == (gOutput = fopen(gOption.output, "wb"))) {
+        LOGE("open %s error. %s\n", gOption.output, strerror(errno));
+        return -1;
+    }
+
+    fds[0].fd = recvSocket(gOption.port, RECV_BUFFER_SIZE);
+    fds[1].fd = recvSocket(gOption.port + 1, 64 * 1024);
+    if (fds[0].fd < 0 || fds[1].fd < 0) {
+        return -1;
+    }
+    fds[0].events = POLLIN;
+    fds[1].events = POLLIN;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < RECV_BATCH; i++) {
+        iovs[i].iov_base = packets[i];
+        iovs[i].iov_len = JITTER_SLOT_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    signal(SIGINT, recvStop);
+    signal(SIGTERM, recvStop);
+
+    start = getMonotonicTime();
+    gettimeofday(&tv, NULL);
+    gWallOffset = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - (int64_t)start;
+    nextReport = start + (uint64_t)gOption.interval * 1000000;
+    if (gOption.duration > 0) {
+        stopTime = start + (uint64_t)gOption.duration * 1000000;
+    }
+    LOGD("receiving %s RTP on port %d, RTCP on %d, jitter buffer %d ms\n", gOption.codec ? "H.265" : "H.264", gOption.port,
+         gOption.port + 1, gOption.delay);
+
+    while (gRunning) {
+        now = getMonotonicTime();
+        if (stopTime && now >= stopTime)
+            break;
+
+        // wake up for the next packet due in the jitter buffer, the next report or the end
+        timeout = 1000;
+        wait = jitterWaitTime(&gJitter, now);
+        if (wait >= 0 && wait / 1000 + 1 < timeout)
+            timeout = (int)(wait / 1000 + 1);
+        if (gOption.interval > 0 && nextReport > now && (nextReport - now) / 1000 + 1 < (uint64_t)timeout)
+            timeout = (int)((nextReport - now) / 1000 + 1);
+        if (stopTime && stopTime > now && (stopTime - now) / 1000 + 1 < (uint64_t)timeout)
+            timeout = (int)((stopTime - now) / 1000 + 1);
+
+        if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+            LOGE("poll error. %s\n", strerror(errno));
+            break;
+        }
+        now = getMonotonicTime();
+
+        if (fds[0].revents & POLLIN) {
+            n = recvmmsg(fds[0].fd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+            for (i = 0; i < n; i++) {  // FEC too, it takes sequence numbers of the stream
+                jitterPush(&gJitter, packets[i], (int)msgs[i].msg_len, now);
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            n = (int)recv(fds[1].fd, packets[0], JITTER_SLOT_SIZE, MSG_DONTWAIT);
+            if (n > 0 && recvHandleRTCP(packets[0], n) && !stopTime) {
+                LOGD("RTCP BYE from %08X\n", gReport.ssrc);
+                stopTime = now + RECV_BYE_LINGER * 1000;
+            }
+        }
+
+        recvDrain(now, 0);
+
+        if (gOption.interval > 0 && now >= nextReport) {
+            recvDumpStats(now - start);
+            nextReport += (uint64_t)gOption.interval * 1000000;
+        }
+    }
+
+    now = getMonotonicTime();
+    recvDrain(now, 1);
+    recvDumpStats(now - start);
+
+    close(fds[0].fd);
+    close(fds[1].fd);
+    if (gOutput) {
+        fclose(gOutput);
+    }
+    rtpDemuxClose(&gDemux);
+    return 0;
+}
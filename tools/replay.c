@@ -0,0 +1,466 @@
+/*
+ * Copyright (c) 2017 Liming Shao <lmshao@163.com>
+ */
+
+/*
+ * Replay a recorded H.264/H.265 elementary stream through the streaming path of HisiLive (send queue, RTP
+ * packetizer, pacer, RTCP, NACK/FEC, GOP cache, RTSP, recorder) on a host without the encoder.
+ */
+
+#include "FEC.h"
+#include "FileSource.h"
+#include "GopCache.h"
+#include "Latency.h"
+#include "Metrics.h"
+#include "Network.h"
+#include "Pacer.h"
+#include "RTCP.h"
+#include "RTP.h"
+#include "RTSP.h"
+#include "Recorder.h"
+#include "Retransmit.h"
+#include "Segmenter.h"
+#include "Source.h"
+#include "Stream.h"
+#include "Utils.h"
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define REPLAY_RECEIVER_MAX 8
+#define REPLAY_RTP_PORT 1234
+#define REPLAY_FAST_WATERMARK 50  // %, as fast as possible: the reader waits above this queue occupancy
+
+typedef struct {
+    const char *input;
+    int codec;  // -1: auto
+    int frameRate;
+    int bitRate;  // kbps, for the pacer, RTSP and GOP cache
+    int loop;
+    int fast;
+    char ip[REPLAY_RECEIVER_MAX][16];
+    int port[REPLAY_RECEIVER_MAX];
+    int ipCount;
+    int rtspPort;
+    int batchSize;
+    int gso;
+    int pacing;
+    int nackWindow;
+    int fecGroup;
+    int fecGroupKey;
+    int gopCacheRate;
+    const char *output;
+    int segmentDuration;
+    int dropWatermark;
+    int rtcpInterval;
+    int metricsPort;
+} ReplayOption;
+
+static ReplayOption gOption;
+static volatile int gRunning = 1;
+
+static FileSource gSource;
+static UDPContext gUDP;
+static RTPMuxContext gRTP;
+static RTCPContext gRTCP;
+static PacerContext gPacer;
+static RetransmitContext gHistory;
+static FECContext gFEC;
+static GopCache gGop;
+static RTSPServer gRTSP;
+static StreamSink gSender;
+static RecorderContext gRecorder;
+static SegmenterContext gSegmenter;
+static StreamSink gRecorderSink;
+static LatencyStats gLatency;  // queue/send, and total from the time a frame was due in realtime
+static int64_t gPtsOffset;     // monotonic clock - pts, μs
+static CaptureCounters gCapture;  // frames read from the file
+static MetricsServer gMetrics;
+
+static void replayUsage(const char *name)
+{
+    printf("Usage : %s [options] stream.h264|stream.h265\n", name);
+    printf("\t -e: 264/265, default from the file name or the first NAL.\n");
+    printf("\t -f: frame rate of the stream, default %d fps.\n", FILE_SOURCE_FRAME_RATE);
+    printf("\t -b: bitrate for pacing, RTSP and GOP cache, default 1024 kbps.\n");
+    printf("\t -l: play the stream this many times, 0: forever, default 1.\n");
+    printf("\t -a: as fast as possible, default at the frame rate.\n");
+    printf("\t -i: IP[:port] of a receiver, repeat for up to %d receivers, default port %d.\n", REPLAY_RECEIVER_MAX,
+           REPLAY_RTP_PORT);
+    printf("\t -r: RTSP server port, e.g. 8554, default no RTSP server.\n");
+    printf("\t -n: n[,gso]: RTP packets per sendmmsg, with gso FU-A fragments in one UDP_SEGMENT sendmsg, default %d.\n",
+           RTP_BATCH_MAX);
+    printf("\t -p: pace each frame over this %% of the frame interval, default no pacing.\n");
+    printf("\t -t: resend packets NACKed within this many ms, default no retransmission.\n");
+    printf("\t -u: n[,k]: one ULPFEC packet per n media packets, per k in key frames, default no FEC.\n");
+    printf("\t -c: n: RTSP sessions start with the current GOP sent at n times the bitrate, default no GOP cache.\n");
+    printf("\t -o: record to this file, or with -g to MPEG-TS segments with this prefix.\n");
+    printf("\t -g: record segments of this many seconds.\n");
+    printf("\t -s: ms between RTCP sender reports, default %d.\n", RTCP_INTERVAL);
+    printf("\t -q: drop non-reference frames when a queue is over this %%, 100: never, default %d.\n", STREAM_DROP_WATERMARK);
+    printf("\t -d: serve Prometheus metrics on http://IP:port/metrics, e.g. %d.\n", METRICS_PORT);
+    printf("e.g. %s -i 127.0.0.1:5004 -r 8554 stream_chn0.h264\n", name);
+}
+
+static int replayParseParam(int argc, char *argv[])
+{
+    char *colon, *comma;
+    int c;
+
+    gOption.codec = -1;
+    gOption.bitRate = 1024;
+    gOption.loop = 1;
+
+    while ((c = getopt(argc, argv, "e:f:b:l:ai:r:n:p:t:u:c:o:g:q:s:d:h")) != -1) {
+        switch (c) {
+            case 'e':
+                if (!strcmp(optarg, "264")) {
+                    gOption.codec = 0;
+                } else if (!strcmp(optarg, "265")) {
+                    gOption.codec = 1;
+                } else {
+                    return -1;
+                }
+                break;
+            case 'f':
+                gOption.frameRate = atoi(optarg);
+                if (gOption.frameRate <= 0 || gOption.frameRate > 240)
+                    return -1;
+                break;
+            case 'b':
+                gOption.bitRate = atoi(optarg);
+                if (gOption.bitRate <= 0)
+                    return -1;
+                break;
+            case 'l':
+                gOption.loop = atoi(optarg);
+                if (gOption.loop < 0)
+                    return -1;
+                break;
+            case 'a':
+                gOption.fast = 1;
+                break;
+            case 'i':
+                if (gOption.ipCount >= REPLAY_RECEIVER_MAX)
+                    return -1;
+                colon = strchr(optarg, ':');
+                gOption.port[gOption.ipCount] = colon ? atoi(colon + 1) : REPLAY_RTP_PORT;
+                if (colon)
+                    *colon = '\0';
+                if (inet_addr(optarg) == INADDR_NONE || strlen(optarg) >= 16 || gOption.port[gOption.ipCount] <= 0 ||
+                    gOption.port[gOption.ipCount] > 65535)
+                    return -1;
+                strcpy(gOption.ip[gOption.ipCount++], optarg);
+                break;
+            case 'r':
+                gOption.rtspPort = atoi(optarg);
+                if (gOption.rtspPort <= 0 || gOption.rtspPort > 65535)
+                    return -1;
+                break;
+            case 'n':
+                gOption.batchSize = atoi(optarg);
+                comma = strchr(optarg, ',');
+                gOption.gso = comma != NULL;
+                if (gOption.batchSize <= 0 || gOption.batchSize > RTP_BATCH_MAX || (comma && strcmp(comma + 1, "gso")))
+                    return -1;
+                break;
+            case 'p':
+                gOption.pacing = atoi(optarg);
+                if (gOption.pacing <= 0 || gOption.pacing > 100)
+                    return -1;
+                break;
+            case 't':
+                gOption.nackWindow = atoi(optarg);
+                if (gOption.nackWindow <= 0)
+                    return -1;
+                break;
+            case 'u':
+                if (sscanf(optarg, "%d,%d", &gOption.fecGroup, &gOption.fecGroupKey) < 1 || gOption.fecGroup < 2)
+                    return -1;
+                break;
+            case 'c':
+                gOption.gopCacheRate = atoi(optarg);
+                if (gOption.gopCacheRate < 2 || gOption.gopCacheRate > 16)
+                    return -1;
+                break;
+            case 'o':
+                gOption.output = optarg;
+                break;
+            case 'g':
+                gOption.segmentDuration = atoi(optarg);
+                if (gOption.segmentDuration <= 0)
+                    return -1;
+                break;
+            case 'q':
+                gOption.dropWatermark = atoi(optarg);
+                if (gOption.dropWatermark <= 0 || gOption.dropWatermark > 100)
+                    return -1;
+                break;
+            case 's':
+                gOption.rtcpInterval = atoi(optarg);
+                if (gOption.rtcpInterval <= 0)
+                    return -1;
+                break;
+            case 'd':
+                gOption.metricsPort = atoi(optarg);
+                if (gOption.metricsPort <= 0 || gOption.metricsPort > 65535)
+                    return -1;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    if (optind != argc - 1 || (gOption.segmentDuration > 0 && NULL == gOption.output))
+        return -1;
+    gOption.input = argv[optind];
+
+    return 0;
+}
+
+static void replaySendFrame(void *arg, const MediaFrame *frame)
+{
+    (void)arg;
+    rtpSendFrame(&gRTP, &gUDP, frame);
+
+    latencyAdd(&gLatency, LATENCY_QUEUE, frame->readTime, gRTP.firstSendTime);
+    latencyAdd(&gLatency, LATENCY_SEND, gRTP.firstSendTime, gRTP.sentTime);
+    if (!gOption.fast) {
+        latencyAdd(&gLatency, LATENCY_TOTAL, (uint64_t)((int64_t)frame->pts + gPtsOffset), gRTP.sentTime);
+    }
+}
+
+static void replayRecordFrame(void *arg, const MediaFrame *frame)
+{
+    (void)arg;
+    if (gOption.segmentDuration > 0) {
+        segmenterWrite(&gSegmenter, frame);
+    } else {
+        recorderWrite(&gRecorder, frame);
+    }
+}
+
+/* as fast as possible, the queue is the only limit: wait for the sink rather than drop */
+static void replayPush(StreamSink *sink, const MediaFrame *frame)
+{
+    if (!sink->running)
+        return;
+    while (gOption.fast && gRunning && frameQueueOccupancy(&sink->queue) > REPLAY_FAST_WATERMARK) {
+        usleep(1000);
+    }
+    streamSinkPush(sink, frame);
+}
+
+static void replayFrame(void *arg, const MediaFrame *frame)
+{
+    uint64_t bytes = 0;
+    int i;
+
+    (void)arg;
+    for (i = 0; i < frame->packCount; i++) {
+        bytes += frame->packs[i].len;
+    }
+    metricsAdd(&gCapture.frames, 1);
+    metricsAdd(&gCapture.packs, (uint64_t)frame->packCount);
+    metricsAdd(&gCapture.bytes, bytes);
+    if (0 == gPtsOffset) {  // the first frame is due when it is read
+        gPtsOffset = (int64_t)frame->readTime - (int64_t)frame->pts;
+    }
+    replayPush(&gSender, frame);
+    replayPush(&gRecorderSink, frame);
+}
+
+static int replayStartSender(void)
+{
+    int i;
+
+    if (gOption.ipCount > 0) {
+        strcpy(gUDP.dstIp, gOption.ip[0]);
+        gUDP.dstPort = gOption.port[0];
+    }
+    gUDP.gso = gOption.gso;
+    if (udpInit(&gUDP)) {
+        return -1;
+    }
+    for (i = 1; i < gOption.ipCount; i++) {
+        udpAddDest(&gUDP, gOption.ip[i], gOption.port[i], 0);
+    }
+
+    initRTPMuxContext(&gRTP);
+    gRTP.batchSize = gOption.batchSize;
+    gRTP.payload_type = gSource.src.codec;
+
+    if (gOption.pacing > 0) {
+        gPacer.udp = &gUDP;
+        gPacer.frameRate = gSource.src.frameRate;
+        gPacer.bitRate = gOption.bitRate;
+        gPacer.fraction = gOption.pacing;
+        if (pacerStart(&gPacer)) {
+            return -1;
+        }
+        gRTP.pacer = &gPacer;
+    }
+
+    if (gOption.nackWindow > 0) {
+        gHistory.window = gOption.nackWindow;
+        retransmitInit(&gHistory);
+        gRTP.history = &gHistory;
+    }
+
+    if (gOption.fecGroup > 0) {
+        gFEC.groupSize = gOption.fecGroup;
+        gFEC.groupSizeKey = gOption.fecGroupKey;
+        if (fecInit(&gFEC)) {
+            return -1;
+        }
+        gRTP.fec = &gFEC;
+    }
+
+    gRTCP.rtp = &gRTP;
+    gRTCP.udp = &gUDP;
+    gRTCP.interval = gOption.rtcpInterval;
+    if (rtcpStart(&gRTCP)) {
+        LOGE("rtcpStart error, no RTCP.\n");
+    }
+
+    if (gOption.rtspPort > 0) {
+        gRTSP.port = gOption.rtspPort;
+        gRTSP.codec = gRTP.payload_type;
+        gRTSP.frameRate = gSource.src.frameRate;
+        gRTSP.bitRate = gOption.bitRate;
+        gRTSP.rtp = &gRTP;
+        gRTSP.udp = &gUDP;
+        gRTSP.rtcp = gRTCP.running ? &gRTCP : NULL;
+        if (gOption.gopCacheRate > 0) {
+            gGop.udp = &gUDP;
+            gGop.bitRate = gOption.bitRate;
+            gGop.rate = gOption.gopCacheRate;
+            if (gopCacheStart(&gGop) == 0) {
+                gRTP.gop = &gGop;
+                gRTSP.gop = &gGop;
+            }
+        }
+        if (rtspStart(&gRTSP)) {
+            return -1;
+        }
+    }
+
+    gSender.name = "RTPSender";
+    gSender.onFrame = replaySendFrame;
+    gSender.dropWatermark = gOption.fast ? -1 : gOption.dropWatermark;
+    return streamSinkStart(&gSender);
+}
+
+static int replayStartRecorder(void)
+{
+    if (gOption.segmentDuration > 0) {
+        snprintf(gSegmenter.prefix, SEGMENT_PREFIX_MAX, "%s", gOption.output);
+        gSegmenter.codec = gSource.src.codec;
+        gSegmenter.duration = gOption.segmentDuration;
+        if (segmenterOpen(&gSegmenter)) {
+            return -1;
+        }
+    } else if (recorderOpen(&gRecorder, gOption.output)) {
+        return -1;
+    }
+
+    gRecorderSink.name = "Recorder";
+    gRecorderSink.onFrame = replayRecordFrame;
+    gRecorderSink.dropWatermark = gOption.fast ? -1 : gOption.dropWatermark;
+    return streamSinkStart(&gRecorderSink);
+}
+
+static int replayStartMetrics(void)
+{
+    MetricsStream *st = &gMetrics.stream[0];
+
+    gMetrics.port = gOption.metricsPort;
+    gMetrics.streamCount = 1;
+    st->label = "0";
+    st->capture = &gCapture;
+    st->sink = gSender.running ? &gSender : &gRecorderSink;
+    if (gSender.running) {
+        st->rtp = &gRTP;
+        st->udp = &gUDP;
+        st->pacer = &gPacer;
+        st->rtcp = &gRTCP;
+        st->latency = &gLatency;
+    }
+
+    return metricsStart(&gMetrics);
+}
+
+static void replayStop(int signo)
+{
+    (void)signo;
+    gRunning = 0;
+}
+
+int main(int argc, char *argv[])
+{
+    SourceStats stats;
+    char buf[1024];
+    int res;
+
+    if (replayParseParam(argc, argv)) {
+        replayUsage(argv[0]);
+        return -1;
+    }
+    logStart(NULL, 0, 0);  // the streaming threads log as on the board, through the logger thread
+
+    gSource.src.codec = gOption.codec;
+    gSource.src.frameRate = gOption.frameRate;
+    gSource.loop = gOption.loop;
+    if (fileSourceOpen(&gSource, gOption.input)) {
+        return -1;
+    }
+
+    signal(SIGINT, replayStop);
+    signal(SIGTERM, replayStop);
+    signal(SIGPIPE, SIG_IGN);
+
+    if ((gOption.ipCount > 0 || gOption.rtspPort > 0) && replayStartSender()) {
+        LOGE("sender start error.\n");
+        return -1;
+    }
+    if (gOption.output && replayStartRecorder()) {
+        LOGE("recorder start error.\n");
+        return -1;
+    }
+
+    if (gOption.metricsPort > 0 && replayStartMetrics()) {
+        LOGE("metrics start error.\n");
+        return -1;
+    }
+
+    res = sourceRun(&gSource.src, replayFrame, NULL, !gOption.fast, &gRunning, &stats);
+
+    metricsStop(&gMetrics);
+    streamSinkStop(&gSender);
+    streamSinkStop(&gRecorderSink);
+    rtspStop(&gRTSP);
+    gopCacheStop(&gGop);
+    rtcpStop(&gRTCP);
+    pacerStop(&gPacer);
+    if (gOption.segmentDuration > 0) {
+        segmenterClose(&gSegmenter);
+        segmenterDumpStats(&gSegmenter);
+    } else if (gOption.output) {
+        recorderDumpStats(&gRecorder);
+        recorderClose(&gRecorder);
+    }
+    sourceClose(&gSource.src);
+
+    if (latencyFormat(&gLatency, "latency μs", buf, sizeof(buf)) > 0) {
+        GREEN("%s", buf);
+    }
+
+    LOGD("%llu frames (%llu key), %llu KB in %llu ms, %.1f fps, %llu late\n", (unsigned long long)stats.frames,
+         (unsigned long long)stats.keyFrames, (unsigned long long)stats.bytes / 1024, (unsigned long long)stats.elapsed / 1000,
+         stats.elapsed ? stats.frames * 1e6 / stats.elapsed : 0.0, (unsigned long long)stats.lateFrames);
+    return res;
+}